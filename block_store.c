@@ -0,0 +1,98 @@
+#include "block_store.h"
+#include <string.h>
+#include "pico/flash.h"
+#include "flash_layout.h"
+
+_Static_assert(FLASH_SECTOR_SIZE <= BLOCK_STORE_MAX_BLOCK, "flash sectors must fit a block buffer");
+
+bool block_store_read(block_store_t *store, uint32_t offset, void *buf, size_t len) {
+    if (offset > store->size || len > store->size - offset) {
+        return false;
+    }
+    store->stats.reads++;
+    if (!store->ops->read(store, offset, buf, len)) {
+        store->stats.errors++;
+        return false;
+    }
+    return true;
+}
+
+bool block_store_program(block_store_t *store, uint32_t offset, const void *data, size_t len) {
+    uint32_t mask = store->block_size - 1;
+    if ((offset & mask) || (len & mask) || offset > store->size || len > store->size - offset) {
+        return false;
+    }
+    uint64_t start = time_us_64();
+    bool ok = store->ops->program(store, offset, data, len);
+    store->stats.write_us += time_us_64() - start;
+    if (!ok) {
+        store->stats.errors++;
+        return false;
+    }
+    store->stats.blocks_written += len / store->block_size;
+    return true;
+}
+
+const uint8_t *block_store_map(block_store_t *store) {
+    return store->ops->map ? store->ops->map(store) : NULL;
+}
+
+// RAM
+
+static bool ram_read(block_store_t *store, uint32_t offset, void *buf, size_t len) {
+    memcpy(buf, (const uint8_t *)store->ctx + offset, len);
+    return true;
+}
+
+static bool ram_program(block_store_t *store, uint32_t offset, const void *data, size_t len) {
+    memcpy((uint8_t *)store->ctx + offset, data, len);
+    return true;
+}
+
+static const uint8_t *ram_map(block_store_t *store) {
+    return store->ctx;
+}
+
+static const block_store_ops_t ram_ops = { ram_read, ram_program, ram_map };
+
+void block_store_ram_init(block_store_t *store, uint8_t *mem, uint32_t size, uint32_t block_size) {
+    memset(mem, 0xff, size);
+    *store = (block_store_t){ .ops = &ram_ops, .name = "ram", .size = size & ~(block_size - 1),
+        .block_size = block_size, .ctx = mem };
+}
+
+// Internal flash; ctx is the offset of the region
+
+typedef struct {
+    uint32_t offset;
+    const void *data;
+    size_t len;
+} flash_program_t;
+
+static void flash_program(void *param) {
+    const flash_program_t *p = param;
+    flash_range_erase(p->offset, p->len);
+    flash_range_program(p->offset, p->data, p->len);
+}
+
+static bool flash_read(block_store_t *store, uint32_t offset, void *buf, size_t len) {
+    memcpy(buf, FLASH_XIP_PTR((uintptr_t)store->ctx + offset), len);
+    return true;
+}
+
+static bool flash_program_blocks(block_store_t *store, uint32_t offset, const void *data, size_t len) {
+    // data must be in RAM: flash cannot be read while it is being programmed
+    flash_program_t p = { (uintptr_t)store->ctx + offset, data, len };
+    return flash_safe_execute(flash_program, &p, 100) == PICO_OK;
+}
+
+static const uint8_t *flash_map(block_store_t *store) {
+    return FLASH_XIP_PTR((uintptr_t)store->ctx);
+}
+
+static const block_store_ops_t flash_ops = { flash_read, flash_program_blocks, flash_map };
+
+void block_store_flash_init(block_store_t *store, uint32_t offset, uint32_t size) {
+    *store = (block_store_t){ .ops = &flash_ops, .name = "flash", .size = size & ~(FLASH_SECTOR_SIZE - 1),
+        .block_size = FLASH_SECTOR_SIZE, .ctx = (void *)(uintptr_t)offset };
+}
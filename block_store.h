@@ -0,0 +1,60 @@
+#ifndef _BLOCK_STORE_H_
+#define _BLOCK_STORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Block storage the persistent logs and snapshots are written through, so the same code runs
+// on RAM, the internal QSPI flash, an SD card or, in the host build, a file. Each backend
+// writes in its own block size (a flash sector, an SD sector); users gather their data into
+// whole blocks and program one at a time, which also bounds how long each write stalls.
+
+// Largest block any backend uses; callers size their block buffers by it
+#define BLOCK_STORE_MAX_BLOCK 4096
+
+typedef struct block_store block_store_t;
+
+typedef struct {
+    // Read len bytes from offset, at any alignment
+    bool (*read)(block_store_t *store, uint32_t offset, void *buf, size_t len);
+    // Replace the whole blocks from the block-aligned offset with data, erasing first where
+    // the medium needs it
+    bool (*program)(block_store_t *store, uint32_t offset, const void *data, size_t len);
+    // Address the contents can be read at in place, or NULL if they must be read
+    const uint8_t *(*map)(block_store_t *store);
+} block_store_ops_t;
+
+typedef struct {
+    uint32_t reads;
+    uint32_t blocks_written;
+    uint32_t errors;
+    uint64_t write_us;      // time spent programming
+} block_store_stats_t;
+
+struct block_store {
+    const block_store_ops_t *ops;
+    const char *name;
+    uint32_t size;          // bytes, a multiple of block_size
+    uint32_t block_size;    // a power of two no larger than BLOCK_STORE_MAX_BLOCK
+    block_store_stats_t stats;
+    void *ctx;
+};
+
+bool block_store_read(block_store_t *store, uint32_t offset, void *buf, size_t len);
+
+// Program whole blocks; false if offset or len are not block-aligned or run off the end
+bool block_store_program(block_store_t *store, uint32_t offset, const void *data, size_t len);
+
+// NULL if the store cannot be read in place
+const uint8_t *block_store_map(block_store_t *store);
+
+// The store over a caller's array, e.g. a ring of fixes that need not outlive a reboot
+void block_store_ram_init(block_store_t *store, uint8_t *mem, uint32_t size, uint32_t block_size);
+
+// The region of internal flash from offset (relative to the start of flash, sector-aligned);
+// blocks are flash sectors and can be read in place through XIP. Programming holds off the
+// other core and interrupts for a sector erase.
+void block_store_flash_init(block_store_t *store, uint32_t offset, uint32_t size);
+
+#endif
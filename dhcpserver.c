@@ -36,6 +36,12 @@
 #include "dhcpserver.h"
 #include "lwip/udp.h"
 
+#if DHCPS_PERSIST_LEASES
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "flash_layout.h"
+#endif
+
 #define DHCPDISCOVER    (1)
 #define DHCPOFFER       (2)
 #define DHCPREQUEST     (3)
@@ -58,12 +64,14 @@
 #define DHCP_OPT_MAX_MSG_SIZE       (57)
 #define DHCP_OPT_VENDOR_CLASS_ID    (60)
 #define DHCP_OPT_CLIENT_ID          (61)
+#define DHCP_OPT_RAPID_COMMIT       (80) // RFC 4039
 #define DHCP_OPT_END                (255)
 
 #define PORT_DHCP_SERVER (67)
 #define PORT_DHCP_CLIENT (68)
 
 #define DEFAULT_LEASE_TIME_S (24 * 60 * 60) // in seconds
+#define OFFER_HOLD_TIME_S (60) // an offered address is held this long for the REQUEST
 
 #define MAC_LEN (6)
 #define MAKE_IP4(a, b, c, d) ((a) << 24 | (b) << 16 | (c) << 8 | (d))
@@ -180,6 +188,168 @@ static void opt_write_u32(uint8_t **opt, uint8_t cmd, uint32_t val) {
     *opt = o;
 }
 
+static inline uint32_t lease_expiry_ms(const dhcp_server_lease_t *lease) {
+    return lease->expiry << 16 | 0xffff;
+}
+
+static inline bool lease_is_free(const dhcp_server_lease_t *lease) {
+    return memcmp(lease->mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0;
+}
+
+static inline bool lease_is_expired(const dhcp_server_lease_t *lease) {
+    return (int32_t)(lease_expiry_ms(lease) - cyw43_hal_ticks_ms()) < 0;
+}
+
+static inline void lease_set_expiry(dhcp_server_lease_t *lease, uint32_t seconds) {
+    lease->expiry = (cyw43_hal_ticks_ms() + seconds * 1000) >> 16;
+}
+
+static inline uint32_t mac_hash(const uint8_t *mac) {
+    // FNV-1a; the vendor half of a MAC is shared by many phones so mix in every byte
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < MAC_LEN; ++i) {
+        h = (h ^ mac[i]) * 16777619u;
+    }
+    return h & (DHCPS_HASH_SIZE - 1);
+}
+
+static uint8_t lease_find(dhcp_server_t *d, const uint8_t *mac) {
+    for (uint8_t i = d->bucket[mac_hash(mac)]; i != DHCPS_NO_LEASE; i = d->lease[i].next) {
+        if (memcmp(d->lease[i].mac, mac, MAC_LEN) == 0) {
+            return i;
+        }
+    }
+    return DHCPS_NO_LEASE;
+}
+
+static void lease_unbind(dhcp_server_t *d, uint8_t yi) {
+    dhcp_server_lease_t *lease = &d->lease[yi];
+    if (lease_is_free(lease)) {
+        return;
+    }
+    uint8_t *link = &d->bucket[mac_hash(lease->mac)];
+    while (*link != yi) {
+        link = &d->lease[*link].next;
+    }
+    *link = lease->next;
+    memset(lease->mac, 0, MAC_LEN);
+    lease->next = DHCPS_NO_LEASE;
+}
+
+static void lease_bind(dhcp_server_t *d, uint8_t yi, const uint8_t *mac) {
+    dhcp_server_lease_t *lease = &d->lease[yi];
+    if (memcmp(lease->mac, mac, MAC_LEN) == 0) {
+        return;
+    }
+    lease_unbind(d, yi);
+    memcpy(lease->mac, mac, MAC_LEN);
+    uint8_t *head = &d->bucket[mac_hash(mac)];
+    lease->next = *head;
+    *head = yi;
+}
+
+// Pick an address for a new client: a never-used one if possible, else the longest expired
+static uint8_t lease_alloc(dhcp_server_t *d) {
+    uint8_t oldest = DHCPS_NO_LEASE;
+    for (uint8_t i = 0; i < DHCPS_MAX_IP; ++i) {
+        dhcp_server_lease_t *lease = &d->lease[i];
+        if (lease_is_free(lease)) {
+            return i;
+        }
+        if (lease_is_expired(lease) &&
+            (oldest == DHCPS_NO_LEASE || (int32_t)(lease_expiry_ms(lease) - lease_expiry_ms(&d->lease[oldest])) < 0)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static void lease_commit(dhcp_server_t *d, uint8_t yi, const uint8_t *mac) {
+    bool changed = memcmp(d->lease[yi].mac, mac, MAC_LEN) != 0;
+    lease_bind(d, yi, mac);
+    lease_set_expiry(&d->lease[yi], DEFAULT_LEASE_TIME_S);
+    if (changed && !d->dirty) {
+        d->dirty = true;
+        d->dirty_ms = cyw43_hal_ticks_ms();
+    }
+}
+
+#if DHCPS_PERSIST_LEASES
+
+#define DHCPS_STORE_MAGIC (0x44484350) // "DHCP"
+
+typedef struct {
+    uint8_t mac[MAC_LEN];
+    uint8_t yi;
+    uint8_t reserved;
+} dhcps_store_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t base_ip;
+    uint8_t max_ip;
+    uint16_t count;
+    dhcps_store_entry_t entry[DHCPS_MAX_IP];
+} dhcps_store_t;
+
+#define DHCPS_STORE_SIZE ((sizeof(dhcps_store_t) + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1))
+
+_Static_assert(DHCPS_STORE_SIZE <= FLASH_SECTOR_SIZE, "DHCP lease store does not fit in a sector");
+
+static void dhcps_store_write(void *param) {
+    flash_range_erase(FLASH_DHCP_LEASES_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(FLASH_DHCP_LEASES_OFFSET, param, DHCPS_STORE_SIZE);
+}
+
+static void dhcps_store_load(dhcp_server_t *d) {
+    const dhcps_store_t *store = (const dhcps_store_t *)FLASH_XIP_PTR(FLASH_DHCP_LEASES_OFFSET);
+    if (store->magic != DHCPS_STORE_MAGIC || store->base_ip != DHCPS_BASE_IP || store->count > DHCPS_MAX_IP) {
+        return;
+    }
+    for (int i = 0; i < store->count; ++i) {
+        const dhcps_store_entry_t *e = &store->entry[i];
+        if (e->yi < DHCPS_MAX_IP) {
+            // Restored bindings start out expired: the owner gets its address straight back,
+            // but the slot can still be reclaimed if the pool runs dry
+            lease_bind(d, e->yi, e->mac);
+            lease_set_expiry(&d->lease[e->yi], 0);
+        }
+    }
+}
+
+void dhcp_server_persist(dhcp_server_t *d) {
+    if (!d->dirty || cyw43_hal_ticks_ms() - d->dirty_ms < DHCPS_PERSIST_DELAY_MS) {
+        return;
+    }
+    static union {
+        dhcps_store_t store;
+        uint8_t bytes[DHCPS_STORE_SIZE];
+    } buf;
+    memset(&buf, 0xff, sizeof(buf));
+    buf.store.magic = DHCPS_STORE_MAGIC;
+    buf.store.base_ip = DHCPS_BASE_IP;
+    buf.store.max_ip = DHCPS_MAX_IP;
+    buf.store.count = 0;
+    for (uint8_t i = 0; i < DHCPS_MAX_IP; ++i) {
+        if (!lease_is_free(&d->lease[i])) {
+            dhcps_store_entry_t *e = &buf.store.entry[buf.store.count++];
+            memcpy(e->mac, d->lease[i].mac, MAC_LEN);
+            e->yi = i;
+        }
+    }
+    if (flash_safe_execute(dhcps_store_write, buf.bytes, 100) == PICO_OK) {
+        d->dirty = false;
+    }
+}
+
+#else
+
+void dhcp_server_persist(dhcp_server_t *d) {
+    d->dirty = false;
+}
+
+#endif
+
 static void dhcp_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *src_addr, u16_t src_port) {
     dhcp_server_t *d = arg;
     (void)upcb;
@@ -211,81 +381,107 @@ static void dhcp_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p,
         goto ignore_request;
     }
 
+    uint8_t reply;
+    uint8_t yi = DHCPS_NO_LEASE;
+    bool rapid_commit = false;
+
     switch (msgtype[2]) {
         case DHCPDISCOVER: {
-            int yi = DHCPS_MAX_IP;
-            for (int i = 0; i < DHCPS_MAX_IP; ++i) {
-                if (memcmp(d->lease[i].mac, dhcp_msg.chaddr, MAC_LEN) == 0) {
-                    // MAC match, use this IP address
-                    yi = i;
-                    break;
-                }
-                if (yi == DHCPS_MAX_IP) {
-                    // Look for a free IP address
-                    if (memcmp(d->lease[i].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                        // IP available
-                        yi = i;
-                    }
-                    uint32_t expiry = d->lease[i].expiry << 16 | 0xffff;
-                    if ((int32_t)(expiry - cyw43_hal_ticks_ms()) < 0) {
-                        // IP expired, reuse it
-                        memset(d->lease[i].mac, 0, MAC_LEN);
-                        yi = i;
-                    }
-                }
+            yi = lease_find(d, dhcp_msg.chaddr);
+            if (yi == DHCPS_NO_LEASE) {
+                yi = lease_alloc(d);
             }
-            if (yi == DHCPS_MAX_IP) {
+            if (yi == DHCPS_NO_LEASE) {
                 // No more IP addresses left
                 goto ignore_request;
             }
-            dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
-            opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPOFFER);
+            if (opt_find(opt, DHCP_OPT_RAPID_COMMIT) != NULL) {
+                // Two-message exchange: commit the lease and ACK straight away
+                rapid_commit = true;
+                lease_commit(d, yi, dhcp_msg.chaddr);
+                reply = DHCPACK;
+            } else {
+                // Hold the address so a concurrent DISCOVER is not offered the same one
+                lease_bind(d, yi, dhcp_msg.chaddr);
+                lease_set_expiry(&d->lease[yi], OFFER_HOLD_TIME_S);
+                reply = DHCPOFFER;
+            }
             break;
         }
 
         case DHCPREQUEST: {
-            uint8_t *o = opt_find(opt, DHCP_OPT_REQUESTED_IP);
-            if (o == NULL) {
-                // Should be NACK
+            uint8_t *o = opt_find(opt, DHCP_OPT_SERVER_ID);
+            if (o != NULL && memcmp(o + 2, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 4) != 0) {
+                // Client accepted an offer from another server
                 goto ignore_request;
             }
-            if (memcmp(o + 2, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3) != 0) {
-                // Should be NACK
-                goto ignore_request;
+            const uint8_t *req_ip;
+            o = opt_find(opt, DHCP_OPT_REQUESTED_IP);
+            if (o != NULL) {
+                req_ip = o + 2;
+            } else {
+                // RENEWING/REBINDING clients put their address in ciaddr instead
+                req_ip = dhcp_msg.ciaddr;
             }
-            uint8_t yi = o[5] - DHCPS_BASE_IP;
-            if (yi >= DHCPS_MAX_IP) {
-                // Should be NACK
-                goto ignore_request;
+            reply = DHCPNACK;
+            if (memcmp(req_ip, &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 3) != 0) {
+                // Wrong subnet, e.g. a lease from another network
+                break;
             }
-            if (memcmp(d->lease[yi].mac, dhcp_msg.chaddr, MAC_LEN) == 0) {
-                // MAC match, ok to use this IP address
-            } else if (memcmp(d->lease[yi].mac, "\x00\x00\x00\x00\x00\x00", MAC_LEN) == 0) {
-                // IP unused, ok to use this IP address
-                memcpy(d->lease[yi].mac, dhcp_msg.chaddr, MAC_LEN);
-            } else {
+            if (req_ip[3] < DHCPS_BASE_IP || req_ip[3] - DHCPS_BASE_IP >= DHCPS_MAX_IP) {
+                break;
+            }
+            uint8_t req = req_ip[3] - DHCPS_BASE_IP;
+            dhcp_server_lease_t *lease = &d->lease[req];
+            if (memcmp(lease->mac, dhcp_msg.chaddr, MAC_LEN) != 0 && !lease_is_free(lease) && !lease_is_expired(lease)) {
                 // IP already in use
-                // Should be NACK
-                goto ignore_request;
+                break;
             }
-            d->lease[yi].expiry = (cyw43_hal_ticks_ms() + DEFAULT_LEASE_TIME_S * 1000) >> 16;
-            dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
-            opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPACK);
-            printf("DHCPS: client connected: MAC=%02x:%02x:%02x:%02x:%02x:%02x IP=%u.%u.%u.%u\n",
-                dhcp_msg.chaddr[0], dhcp_msg.chaddr[1], dhcp_msg.chaddr[2], dhcp_msg.chaddr[3], dhcp_msg.chaddr[4], dhcp_msg.chaddr[5],
-                dhcp_msg.yiaddr[0], dhcp_msg.yiaddr[1], dhcp_msg.yiaddr[2], dhcp_msg.yiaddr[3]);
+            uint8_t prev = lease_find(d, dhcp_msg.chaddr);
+            if (prev != DHCPS_NO_LEASE && prev != req) {
+                lease_unbind(d, prev);
+            }
+            yi = req;
+            lease_commit(d, yi, dhcp_msg.chaddr);
+            reply = DHCPACK;
             break;
         }
 
+        case DHCPRELEASE: {
+            yi = lease_find(d, dhcp_msg.chaddr);
+            if (yi != DHCPS_NO_LEASE) {
+                lease_set_expiry(&d->lease[yi], 0);
+            }
+            goto ignore_request;
+        }
+
         default:
             goto ignore_request;
     }
 
-    opt_write_n(&opt, DHCP_OPT_SERVER_ID, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip)));
-    opt_write_n(&opt, DHCP_OPT_SUBNET_MASK, 4, &ip4_addr_get_u32(ip_2_ip4(&d->nm)));
-    opt_write_n(&opt, DHCP_OPT_ROUTER, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // aka gateway; can have multiple addresses
-    opt_write_n(&opt, DHCP_OPT_DNS, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // this server is the dns
-    opt_write_u32(&opt, DHCP_OPT_IP_LEASE_TIME, DEFAULT_LEASE_TIME_S);
+    if (reply == DHCPNACK) {
+        // A NAK carries no address or configuration, only who refused
+        memset(&dhcp_msg.yiaddr, 0, 4);
+        opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, DHCPNACK);
+        opt_write_n(&opt, DHCP_OPT_SERVER_ID, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip)));
+    } else {
+        dhcp_msg.yiaddr[3] = DHCPS_BASE_IP + yi;
+        opt_write_u8(&opt, DHCP_OPT_MSG_TYPE, reply);
+        if (rapid_commit) {
+            *opt++ = DHCP_OPT_RAPID_COMMIT;
+            *opt++ = 0;
+        }
+        if (reply == DHCPACK) {
+            printf("DHCPS: client connected: MAC=%02x:%02x:%02x:%02x:%02x:%02x IP=%u.%u.%u.%u\n",
+                dhcp_msg.chaddr[0], dhcp_msg.chaddr[1], dhcp_msg.chaddr[2], dhcp_msg.chaddr[3], dhcp_msg.chaddr[4], dhcp_msg.chaddr[5],
+                dhcp_msg.yiaddr[0], dhcp_msg.yiaddr[1], dhcp_msg.yiaddr[2], dhcp_msg.yiaddr[3]);
+        }
+        opt_write_n(&opt, DHCP_OPT_SERVER_ID, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip)));
+        opt_write_n(&opt, DHCP_OPT_SUBNET_MASK, 4, &ip4_addr_get_u32(ip_2_ip4(&d->nm)));
+        opt_write_n(&opt, DHCP_OPT_ROUTER, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // aka gateway; can have multiple addresses
+        opt_write_n(&opt, DHCP_OPT_DNS, 4, &ip4_addr_get_u32(ip_2_ip4(&d->ip))); // this server is the dns
+        opt_write_u32(&opt, DHCP_OPT_IP_LEASE_TIME, DEFAULT_LEASE_TIME_S);
+    }
     *opt++ = DHCP_OPT_END;
     struct netif *nif = ip_current_input_netif();
     dhcp_socket_sendto(&d->udp, nif, &dhcp_msg, opt - (uint8_t *)&dhcp_msg, 0xffffffff, PORT_DHCP_CLIENT);
@@ -298,6 +494,14 @@ void dhcp_server_init(dhcp_server_t *d, ip_addr_t *ip, ip_addr_t *nm) {
     ip_addr_copy(d->ip, *ip);
     ip_addr_copy(d->nm, *nm);
     memset(d->lease, 0, sizeof(d->lease));
+    memset(d->bucket, DHCPS_NO_LEASE, sizeof(d->bucket));
+    for (int i = 0; i < DHCPS_MAX_IP; ++i) {
+        d->lease[i].next = DHCPS_NO_LEASE;
+    }
+    d->dirty = false;
+#if DHCPS_PERSIST_LEASES
+    dhcps_store_load(d);
+#endif
     if (dhcp_socket_new_dgram(&d->udp, d, dhcp_server_process) != 0) {
         return;
     }
@@ -29,21 +29,51 @@
 #include "lwip/ip_addr.h"
 
 #define DHCPS_BASE_IP (16)
-#define DHCPS_MAX_IP (8)
+
+// Size of the address pool; addresses are handed out from DHCPS_BASE_IP upwards
+#ifndef DHCPS_MAX_IP
+#define DHCPS_MAX_IP (32)
+#endif
+
+// Buckets for the MAC -> lease hash; must be a power of two
+#ifndef DHCPS_HASH_SIZE
+#define DHCPS_HASH_SIZE (64)
+#endif
+
+// Save lease bindings to flash so clients get the same address after a reboot
+#ifndef DHCPS_PERSIST_LEASES
+#define DHCPS_PERSIST_LEASES (1)
+#endif
+
+// Batch binding changes for this long before writing them to flash
+#define DHCPS_PERSIST_DELAY_MS (10 * 1000)
+
+#define DHCPS_NO_LEASE (0xff)
+
+_Static_assert(DHCPS_BASE_IP + DHCPS_MAX_IP <= 255, "DHCP pool does not fit in the subnet");
+_Static_assert((DHCPS_HASH_SIZE & (DHCPS_HASH_SIZE - 1)) == 0, "DHCPS_HASH_SIZE must be a power of two");
 
 typedef struct _dhcp_server_lease_t {
     uint8_t mac[6];
     uint16_t expiry;
+    uint8_t next; // next lease in the same hash bucket
 } dhcp_server_lease_t;
 
 typedef struct _dhcp_server_t {
     ip_addr_t ip;
     ip_addr_t nm;
     dhcp_server_lease_t lease[DHCPS_MAX_IP];
+    uint8_t bucket[DHCPS_HASH_SIZE];
+    bool dirty;
+    uint32_t dirty_ms;
     struct udp_pcb *udp;
 } dhcp_server_t;
 
 void dhcp_server_init(dhcp_server_t *d, ip_addr_t *ip, ip_addr_t *nm);
 void dhcp_server_deinit(dhcp_server_t *d);
 
+// Writes changed lease bindings to flash once they have settled; call periodically, from
+// wherever a flash erase is safe
+void dhcp_server_persist(dhcp_server_t *d);
+
 #endif // MICROPY_INCLUDED_LIB_NETUTILS_DHCPSERVER_H
\ No newline at end of file
@@ -14,22 +14,15 @@
 #include "lwip/udp.h"
 
 #define PORT_DNS_SERVER 53
-#define DUMP_DATA 0
+#define DNS_HEADER_SIZE 12
+#define DNS_TYPE_A      1
+#define DNS_TYPE_ANY    255
+#define DNS_CLASS_IN    1
+#define DNS_TTL_S       60
 
 #define DEBUG_printf(...)
 #define ERROR_printf printf
 
-typedef struct dns_header_t_ {
-    uint16_t id;
-    uint16_t flags;
-    uint16_t question_count;
-    uint16_t answer_record_count;
-    uint16_t authority_record_count;
-    uint16_t additional_record_count;
-} dns_header_t;
-
-#define MAX_DNS_MSG_SIZE 300
-
 static int dns_socket_new_dgram(struct udp_pcb **udp, void *cb_data, udp_recv_fn cb_udp_recv) {
     *udp = udp_new();
     if (*udp == NULL) {
@@ -57,167 +50,147 @@ static int dns_socket_bind(struct udp_pcb **udp, uint32_t ip, uint16_t port) {
     return err;
 }
 
-#if DUMP_DATA
-static void dump_bytes(const uint8_t *bptr, uint32_t len) {
-    unsigned int i = 0;
+static inline uint16_t dns_read_u16(const uint8_t *ptr) {
+    return (uint16_t)(ptr[0] << 8 | ptr[1]);
+}
+
+static inline void dns_write_u16(uint8_t *ptr, uint16_t val) {
+    ptr[0] = val >> 8;
+    ptr[1] = val;
+}
 
-    for (i = 0; i < len;) {
-        if ((i & 0x0f) == 0) {
-            printf("\n");
-        } else if ((i & 0x07) == 0) {
-            printf(" ");
+// Returns the question length if it matches a cached one
+static size_t dns_cache_lookup(dns_server_t *d, const uint8_t *question, size_t avail, uint8_t *answer_count) {
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        dns_cache_entry_t *e = &d->cache[i];
+        if (e->question_len && e->question_len <= avail && memcmp(e->question, question, e->question_len) == 0) {
+            *answer_count = e->answer_count;
+            d->cache_hits++;
+            return e->question_len;
         }
-        printf("%02x ", bptr[i++]);
     }
-    printf("\n");
+    d->cache_misses++;
+    return 0;
 }
-#endif
 
-static int dns_socket_sendto(struct udp_pcb **udp, const void *buf, size_t len, const ip_addr_t *dest, uint16_t port) {
-    if (len > 0xffff) {
-        len = 0xffff;
+static void dns_cache_insert(dns_server_t *d, const uint8_t *question, size_t question_len, uint8_t answer_count) {
+    if (question_len > DNS_CACHE_QUESTION_MAX) {
+        return;
     }
+    dns_cache_entry_t *e = &d->cache[d->cache_next];
+    d->cache_next = (d->cache_next + 1) % DNS_CACHE_ENTRIES;
+    memcpy(e->question, question, question_len);
+    e->question_len = question_len;
+    e->answer_count = answer_count;
+}
 
-    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-    if (p == NULL) {
-        ERROR_printf("DNS: Failed to send message out of memory\n");
-        return -ENOMEM;
+// Walks QNAME and returns the length of the first question including QTYPE and QCLASS, or 0 if malformed
+static size_t dns_parse_question(const uint8_t *question, const uint8_t *end, uint8_t *answer_count) {
+    const uint8_t *ptr = question;
+    while (ptr < end && *ptr != 0) {
+        if (*ptr > 63) {
+            // Label too long, or a compression pointer which is not valid in a query
+            return 0;
+        }
+        ptr += *ptr + 1;
     }
+    if (ptr >= end) {
+        return 0;
+    }
+    ptr++; // root label
 
-    memcpy(p->payload, buf, len);
-    err_t err = udp_sendto(*udp, p, dest, port);
-
-    pbuf_free(p);
-
-    if (err != ERR_OK) {
-        ERROR_printf("DNS: Failed to send message %d\n", err);
-        return err;
+    if (ptr - question > 255 || end - ptr < 4) {
+        return 0;
     }
 
-#if DUMP_DATA
-    dump_bytes(buf, len);
-#endif
-    return len;
+    // Only A (and ANY) gets an address; AAAA, HTTPS etc. get an empty NOERROR so clients
+    // fall back to IPv4 straight away instead of retrying
+    uint16_t qtype = dns_read_u16(ptr);
+    uint16_t qclass = dns_read_u16(ptr + 2);
+    *answer_count = (qtype == DNS_TYPE_A || qtype == DNS_TYPE_ANY) && qclass == DNS_CLASS_IN;
+    return ptr + 4 - question;
 }
 
+// The reply is built inside the received pbuf: the header is rewritten, anything after the
+// first question is trimmed off and the fixed A record is chained on by reference.
 static void dns_server_process(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *src_addr, u16_t src_port) {
     dns_server_t *d = arg;
-    DEBUG_printf("dns_server_process %u\n", p->tot_len);
-
-    uint8_t dns_msg[MAX_DNS_MSG_SIZE];
-    dns_header_t *dns_hdr = (dns_header_t*)dns_msg;
 
-    size_t msg_len = pbuf_copy_partial(p, dns_msg, sizeof(dns_msg), 0);
-    if (msg_len < sizeof(dns_header_t)) {
+    if (p->len != p->tot_len || p->len < DNS_HEADER_SIZE) {
         goto ignore_request;
     }
 
-#if DUMP_DATA
-    dump_bytes(dns_msg, msg_len);
-#endif
-
-    uint16_t flags = lwip_ntohs(dns_hdr->flags);
-    uint16_t question_count = lwip_ntohs(dns_hdr->question_count);
-
-    DEBUG_printf("len %d\n", msg_len);
-    DEBUG_printf("dns flags 0x%x\n", flags);
-    DEBUG_printf("dns question count 0x%x\n", question_count);
+    uint8_t *dns_msg = p->payload;
+    uint16_t flags = dns_read_u16(dns_msg + 2);
+    uint16_t question_count = dns_read_u16(dns_msg + 4);
 
     // flags from rfc1035
     // +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
     // |QR|   Opcode  |AA|TC|RD|RA|   Z    |   RCODE   |
     // +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
 
-    // Check QR indicates a query
-    if (((flags >> 15) & 0x1) != 0) {
-        DEBUG_printf("Ignoring non-query\n");
-        goto ignore_request;
-    }
-
-    // Check for standard query
-    if (((flags >> 11) & 0xf) != 0) {
-        DEBUG_printf("Ignoring non-standard query\n");
-        goto ignore_request;
-    }
-
-    // Check question count
-    if (question_count < 1) {
-        DEBUG_printf("Invalid question count\n");
+    // Only standard queries with at least one question
+    if ((flags & 0xf800) != 0 || question_count < 1) {
         goto ignore_request;
     }
 
-    // Print the question
-    DEBUG_printf("question: ");
-    const uint8_t *question_ptr_start = dns_msg + sizeof(dns_header_t);
-    const uint8_t *question_ptr_end = dns_msg + msg_len;
-    const uint8_t *question_ptr = question_ptr_start;
-    while(question_ptr < question_ptr_end) {
-        if (*question_ptr == 0) {
-            question_ptr++;
-            break;
-        } else {
-            if (question_ptr > question_ptr_start) {
-                DEBUG_printf(".");
-            }
-            int label_len = *question_ptr++;
-            if (label_len > 63) {
-                DEBUG_printf("Invalid label\n");
-                goto ignore_request;
-            }
-            DEBUG_printf("%.*s", label_len, question_ptr);
-            question_ptr += label_len;
+    const uint8_t *question = dns_msg + DNS_HEADER_SIZE;
+    const uint8_t *end = dns_msg + p->len;
+    uint8_t answer_count;
+    size_t question_len = dns_cache_lookup(d, question, end - question, &answer_count);
+    if (question_len == 0) {
+        question_len = dns_parse_question(question, end, &answer_count);
+        if (question_len == 0) {
+            goto ignore_request;
         }
+        dns_cache_insert(d, question, question_len, answer_count);
     }
-    DEBUG_printf("\n");
 
-    // Check question length
-    if (question_ptr - question_ptr_start > 255) {
-        DEBUG_printf("Invalid question length\n");
-        goto ignore_request;
+    pbuf_realloc(p, DNS_HEADER_SIZE + question_len);
+
+    dns_write_u16(dns_msg + 2,
+                0x1 << 15 |       // QR = response
+                0x1 << 10 |       // AA = authoritative
+                (flags & 0x0100) | // RD copied from the query
+                0x1 << 7);        // RA = recursion available
+    dns_write_u16(dns_msg + 4, 1);
+    dns_write_u16(dns_msg + 6, answer_count);
+    dns_write_u16(dns_msg + 8, 0);
+    dns_write_u16(dns_msg + 10, 0);
+
+    if (answer_count) {
+        struct pbuf *answer = pbuf_alloc(PBUF_RAW, sizeof(d->answer), PBUF_REF);
+        if (answer == NULL) {
+            goto ignore_request;
+        }
+        answer->payload = d->answer;
+        pbuf_cat(p, answer);
     }
 
-    // Skip QNAME and QTYPE
-    question_ptr += 4;
-
-    // Generate answer
-    uint8_t *answer_ptr = dns_msg + (question_ptr - dns_msg);
-    *answer_ptr++ = 0xc0; // pointer
-    *answer_ptr++ = question_ptr_start - dns_msg; // pointer to question
-    
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 1; // host address
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 1; // Internet class
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 60; // ttl 60s
-
-    *answer_ptr++ = 0;
-    *answer_ptr++ = 4; // length
-    memcpy(answer_ptr, &d->ip.addr, 4); // use our address
-    answer_ptr += 4;
-
-    dns_hdr->flags = lwip_htons(
-                0x1 << 15 | // QR = response
-                0x1 << 10 | // AA = authoritative
-                0x1 << 7);   // RA = authenticated
-    dns_hdr->question_count = lwip_htons(1);
-    dns_hdr->answer_record_count = lwip_htons(1);
-    dns_hdr->authority_record_count = 0;
-    dns_hdr->additional_record_count = 0;
-
-    // Send the reply
-    DEBUG_printf("Sending %d byte reply to %s:%d\n", answer_ptr - dns_msg, ipaddr_ntoa(src_addr), src_port);
-    dns_socket_sendto(&d->udp, &dns_msg, answer_ptr - dns_msg, src_addr, src_port);
+    udp_sendto(upcb, p, src_addr, src_port);
 
 ignore_request:
     pbuf_free(p);
 }
 
 void dns_server_init(dns_server_t *d, ip_addr_t *ip) {
+    ip_addr_copy(d->ip, *ip);
+
+    // Every A answer is the same record: name pointer to the first question, our address
+    static const uint8_t answer_hdr[] = {
+        0xc0, DNS_HEADER_SIZE,          // pointer to question
+        0, DNS_TYPE_A,                  // host address
+        0, DNS_CLASS_IN,                // Internet class
+        0, 0, 0, DNS_TTL_S,             // ttl
+        0, 4,                           // length
+    };
+    memcpy(d->answer, answer_hdr, sizeof(answer_hdr));
+    memcpy(d->answer + sizeof(answer_hdr), &ip4_addr_get_u32(ip_2_ip4(&d->ip)), 4);
+    memset(d->cache, 0, sizeof(d->cache));
+    d->cache_next = 0;
+    d->cache_hits = 0;
+    d->cache_misses = 0;
+
     if (dns_socket_new_dgram(&d->udp, d, dns_server_process) != ERR_OK) {
         DEBUG_printf("dns server failed to start\n");
         return;
@@ -226,7 +199,6 @@ void dns_server_init(dns_server_t *d, ip_addr_t *ip) {
         DEBUG_printf("dns server failed to bind\n");
         return;
     }
-    ip_addr_copy(d->ip, *ip);
     DEBUG_printf("dns server listening on port %d\n", PORT_DNS_SERVER);
 }
 
@@ -9,12 +9,31 @@
 
 #include "lwip/ip_addr.h"
 
+// Number of recently seen questions remembered so repeat lookups skip parsing
+#ifndef DNS_CACHE_ENTRIES
+#define DNS_CACHE_ENTRIES 4
+#endif
+
+// Longest question (QNAME + QTYPE + QCLASS) that fits in a cache entry
+#define DNS_CACHE_QUESTION_MAX 64
+
+typedef struct dns_cache_entry_t_ {
+    uint8_t question_len;     // 0 = unused
+    uint8_t answer_count;     // 1 for A queries, 0 for NODATA
+    uint8_t question[DNS_CACHE_QUESTION_MAX];
+} dns_cache_entry_t;
+
 typedef struct dns_server_t_ {
     struct udp_pcb *udp;
      ip_addr_t ip;
+    uint8_t answer[16];       // A record pointing back at us, appended by reference
+    uint8_t cache_next;
+    dns_cache_entry_t cache[DNS_CACHE_ENTRIES];
+    uint32_t cache_hits;
+    uint32_t cache_misses;
 } dns_server_t;
 
 void dns_server_init(dns_server_t *d, ip_addr_t *ip);
 void dns_server_deinit(dns_server_t *d);
 
-#endif
\ No newline at end of file
+#endif
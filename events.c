@@ -0,0 +1,245 @@
+#include "events.h"
+#include <stdio.h>
+#include <string.h>
+
+// Idle connections get an SSE comment this often so proxies and phones keep them open
+#define EVENTS_KEEPALIVE_S 15
+
+static const char events_headers[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static const char events_keepalive[] = ":\n\n";
+
+// Stream positions are free-running byte counts; ring offset = position % EVENTS_RING_SIZE.
+// Ring bytes are handed to lwIP without copying, so they must stay put until acked.
+typedef struct {
+    struct tcp_pcb *pcb;
+    uint32_t sent;              // next ring position to hand to lwIP
+    uint32_t until;             // end of the last event started; sent only rests here
+    uint32_t acked;             // ring position acknowledged by the client
+    uint16_t static_inflight;   // unacked headers/keepalives, always queued ahead of ring data
+    uint8_t idle_polls;
+} events_client_t;
+
+static char ring[EVENTS_RING_SIZE];
+static uint32_t ring_head;
+static events_client_t clients[EVENTS_MAX_CLIENTS];
+
+static uint32_t events_dropped;
+static uint32_t events_coalesced;
+
+static void client_free(events_client_t *c) {
+    if (c->pcb) {
+        tcp_arg(c->pcb, NULL);
+        tcp_sent(c->pcb, NULL);
+        tcp_recv(c->pcb, NULL);
+        tcp_err(c->pcb, NULL);
+        tcp_poll(c->pcb, NULL, 0);
+        c->pcb = NULL;
+    }
+}
+
+static void client_abort(events_client_t *c) {
+    struct tcp_pcb *pcb = c->pcb;
+    client_free(c);
+    tcp_abort(pcb);
+}
+
+// End of the last event in (from, to], or from if none ends there. Every event ends with the
+// blank line SSE requires and holds no other, and the bytes from from on are all current.
+static uint32_t last_event_end(uint32_t from, uint32_t to) {
+    for (uint32_t p = to; p - from >= 2; p--) {
+        if (ring[(p - 1) % EVENTS_RING_SIZE] == '\n' && ring[(p - 2) % EVENTS_RING_SIZE] == '\n') {
+            return p;
+        }
+    }
+    return from;
+}
+
+// Queue as many whole pending events as the send buffer takes. Never starting one that does
+// not fit keeps sent on an event boundary, so ring_reserve() can skip the client ahead
+// without handing it half an event glued to the next.
+static void client_pump(events_client_t *c) {
+    bool queued = false;
+    for (;;) {
+        if (c->sent == c->until) {
+            uint32_t len = ring_head - c->sent;
+            uint16_t space = tcp_sndbuf(c->pcb);
+            c->until = last_event_end(c->sent, c->sent + (len < space ? len : space));
+            if (c->until == c->sent) {
+                break;
+            }
+        }
+        uint32_t offset = c->sent % EVENTS_RING_SIZE;
+        uint32_t len = c->until - c->sent;
+        if (len > EVENTS_RING_SIZE - offset) {
+            len = EVENTS_RING_SIZE - offset; // up to the wrap, the rest goes next time round
+        }
+        uint16_t space = tcp_sndbuf(c->pcb);
+        if (len > space) {
+            len = space;
+        }
+        if (len == 0 || tcp_sndqueuelen(c->pcb) >= TCP_SND_QUEUELEN ||
+            tcp_write(c->pcb, &ring[offset], len, 0) != ERR_OK) {
+            break;
+        }
+        c->sent += len;
+        queued = true;
+    }
+    if (queued) {
+        tcp_output(c->pcb);
+    }
+}
+
+static err_t events_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    events_client_t *c = arg;
+    uint16_t fixed = len < c->static_inflight ? len : c->static_inflight;
+    c->static_inflight -= fixed;
+    c->acked += len - fixed;
+    c->idle_polls = 0;
+    client_pump(c);
+    return ERR_OK;
+}
+
+static err_t events_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    events_client_t *c = arg;
+    if (!p) {
+        // Viewer went away
+        client_free(c);
+        tcp_close(pcb);
+        return ERR_OK;
+    }
+    // Nothing more is expected from the client
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static void events_err(void *arg, err_t err) {
+    events_client_t *c = arg;
+    // The pcb is already gone
+    c->pcb = NULL;
+}
+
+static err_t events_poll(void *arg, struct tcp_pcb *pcb) {
+    events_client_t *c = arg;
+    // Poll interval is 2 s (4 coarse timer ticks)
+    if (++c->idle_polls * 2 >= EVENTS_KEEPALIVE_S && c->sent == c->acked && c->sent == ring_head) {
+        if (tcp_write(pcb, events_keepalive, sizeof(events_keepalive) - 1, 0) == ERR_OK) {
+            c->static_inflight += sizeof(events_keepalive) - 1;
+            tcp_output(pcb);
+        }
+        c->idle_polls = 0;
+    }
+    return ERR_OK;
+}
+
+err_t events_attach(struct tcp_pcb *pcb) {
+    events_client_t *c = NULL;
+    for (int i = 0; i < EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].pcb == NULL) {
+            c = &clients[i];
+            break;
+        }
+    }
+    if (c == NULL) {
+        return ERR_MEM;
+    }
+
+    // New viewers only see events from now on
+    c->pcb = pcb;
+    c->sent = ring_head;
+    c->until = ring_head;
+    c->acked = ring_head;
+    c->static_inflight = sizeof(events_headers) - 1;
+    c->idle_polls = 0;
+
+    tcp_arg(pcb, c);
+    tcp_sent(pcb, events_sent);
+    tcp_recv(pcb, events_recv);
+    tcp_err(pcb, events_err);
+    tcp_poll(pcb, events_poll, 4);
+
+    if (tcp_write(pcb, events_headers, sizeof(events_headers) - 1, 0) != ERR_OK) {
+        client_abort(c);
+        return ERR_ABRT;
+    }
+    tcp_output(pcb);
+    return ERR_OK;
+}
+
+// Make room for len bytes. Clients whose unsent backlog would be overwritten skip ahead to the
+// new event; clients still waiting on acks for that region, or part way through queueing an
+// event (a wrapped one whose second piece did not fit), are too slow and get dropped.
+static void ring_reserve(uint32_t len) {
+    uint32_t oldest = ring_head + len - EVENTS_RING_SIZE;
+    for (int i = 0; i < EVENTS_MAX_CLIENTS; i++) {
+        events_client_t *c = &clients[i];
+        if (c->pcb == NULL || (int32_t)(c->acked - oldest) >= 0) {
+            continue;
+        }
+        if (c->sent != c->acked || c->sent != c->until) {
+            client_abort(c);
+            events_dropped++;
+        } else {
+            c->sent = ring_head;
+            c->until = ring_head;
+            c->acked = ring_head;
+            events_coalesced++;
+        }
+    }
+}
+
+static void publish(const char *event, size_t len) {
+    if (len >= EVENTS_RING_SIZE) {
+        return;
+    }
+    ring_reserve(len);
+    for (size_t i = 0; i < len; i++) {
+        ring[(ring_head + i) % EVENTS_RING_SIZE] = event[i];
+    }
+    ring_head += len;
+    for (int i = 0; i < EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].pcb) {
+            client_pump(&clients[i]);
+        }
+    }
+}
+
+static bool have_clients(void) {
+    for (int i = 0; i < EVENTS_MAX_CLIENTS; i++) {
+        if (clients[i].pcb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void events_publish_fix(const gps_fix_t *fix) {
+    if (!have_clients()) {
+        return;
+    }
+    char event[128];
+    int len = snprintf(event, sizeof(event),
+        "event: fix\ndata: {\"t\":%lu,\"lat\":%ld,\"lon\":%ld,\"q\":%u,\"s\":%u}\n\n",
+        (unsigned long)fix->time, (long)fix->lat_e7, (long)fix->lon_e7, fix->quality, fix->satellites);
+    if (len > 0 && len < sizeof(event)) {
+        publish(event, len);
+    }
+}
+
+void events_publish_cell(const Heatmap *cell) {
+    if (!have_clients()) {
+        return;
+    }
+    char event[64];
+    int len = snprintf(event, sizeof(event), "event: cell\ndata: {\"k\":%lu,\"c\":%u}\n\n",
+        (unsigned long)cell->loc_id, cell->count);
+    if (len > 0 && len < sizeof(event)) {
+        publish(event, len);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include "lwip/tcp.h"
+#include "gps_fix.h"
+#include "heatmap.h"
+
+// Live push of fixes and heatmap changes to browsers over Server-Sent Events (/events).
+// Events are serialized once into a shared ring that every client streams from.
+
+#ifndef EVENTS_MAX_CLIENTS
+#define EVENTS_MAX_CLIENTS 4
+#endif
+
+// Must be a power of two
+#ifndef EVENTS_RING_SIZE
+#define EVENTS_RING_SIZE 4096
+#endif
+
+// Hand a connection that asked for /events over to the event stream. The request has
+// already been consumed. Returns ERR_MEM if all client slots are taken (the caller still
+// owns the pcb) or ERR_ABRT if the pcb had to be aborted.
+err_t events_attach(struct tcp_pcb *pcb);
+
+void events_publish_fix(const gps_fix_t *fix);
+void events_publish_cell(const Heatmap *cell);
+
+#endif
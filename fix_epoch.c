@@ -0,0 +1,157 @@
+#include "fix_epoch.h"
+#include <string.h>
+#include "utc.h"
+
+static struct {
+    struct minmea_time time;
+    struct minmea_date date;
+    uint8_t have;           // FIX_EPOCH_* parts merged so far
+    bool open;
+    bool emitted;
+    bool position;
+    gps_fix_t fix;
+} epoch;
+
+// Used for epochs without a date of their own
+static struct minmea_date last_date;
+
+static uint8_t expected;
+static fix_epoch_cb_t emit_fix;
+static fix_epoch_stats_t stats;
+
+void fix_epoch_init(uint8_t parts, fix_epoch_cb_t emit) {
+    memset(&epoch, 0, sizeof(epoch));
+    memset(&stats, 0, sizeof(stats));
+    last_date.year = -1;
+    expected = parts;
+    emit_fix = emit;
+}
+
+const fix_epoch_stats_t *fix_epoch_get_stats(void) {
+    return &stats;
+}
+
+static bool same_time(const struct minmea_time *a, const struct minmea_time *b) {
+    return a->hours == b->hours && a->minutes == b->minutes && a->seconds == b->seconds &&
+        a->microseconds == b->microseconds;
+}
+
+static uint16_t clamp16(int64_t v) {
+    return v < 0 ? GPS_UNKNOWN16 : v >= GPS_UNKNOWN16 ? GPS_UNKNOWN16 - 1 : v;
+}
+
+static void epoch_emit(void) {
+    if (epoch.date.year >= 0) {
+        last_date = epoch.date;
+    }
+    epoch.fix.time = utc_from_nmea(&last_date, &epoch.time);
+    epoch.emitted = true;
+    emit_fix(&epoch.fix);
+}
+
+// Hand on an epoch that never completed, then start assembling the one at t
+static void epoch_open(const struct minmea_time *t) {
+    if (epoch.open && !epoch.emitted) {
+        if (epoch.position) {
+            stats.partial++;
+            epoch_emit();
+        } else {
+            stats.no_position++;
+        }
+    }
+
+    memset(&epoch, 0, sizeof(epoch));
+    epoch.open = true;
+    epoch.time = *t;
+    epoch.date.year = -1;
+    epoch.fix.speed_cm_s = GPS_UNKNOWN16;
+    epoch.fix.course_cdeg = GPS_UNKNOWN16;
+    epoch.fix.hdop_d = GPS_UNKNOWN8;
+}
+
+// Find the epoch a sentence stamped t belongs to; false if that epoch is already done with
+// or this part of it has been merged before (the same sentence from a second talker)
+static bool epoch_enter(const struct minmea_time *t, uint8_t part) {
+    if (!epoch.open || !same_time(&epoch.time, t)) {
+        epoch_open(t);
+    }
+    if (epoch.emitted || (epoch.have & part)) {
+        stats.late++;
+        return false;
+    }
+    epoch.have |= part;
+    return true;
+}
+
+static void epoch_check(void) {
+    if (epoch.position && (epoch.have & expected) == expected) {
+        stats.complete++;
+        epoch_emit();
+    }
+}
+
+static bool set_position(const struct minmea_float *lat, const struct minmea_float *lon) {
+    if (!gps_coord_valid(lat, 90) || !gps_coord_valid(lon, 180)) {
+        return false;
+    }
+    epoch.fix.lat_e7 = gps_coord_e7(lat);
+    epoch.fix.lon_e7 = gps_coord_e7(lon);
+    epoch.position = true;
+    return true;
+}
+
+static void set_motion(int64_t speed_cm_s, const struct minmea_float *course) {
+    if (epoch.fix.speed_cm_s == GPS_UNKNOWN16) {
+        epoch.fix.speed_cm_s = clamp16(speed_cm_s);
+    }
+    int64_t cdeg = gps_float_scale(course, 100, 1);
+    if (epoch.fix.course_cdeg == GPS_UNKNOWN16 && cdeg >= 0) {
+        epoch.fix.course_cdeg = cdeg % 36000;
+    }
+}
+
+void fix_epoch_gga(const struct minmea_sentence_gga *frame) {
+    if (frame->time.hours < 0 || !epoch_enter(&frame->time, FIX_EPOCH_GGA)) {
+        return;
+    }
+    // GGA is the better position source, so it replaces one taken from RMC
+    if (frame->fix_quality > 0 && set_position(&frame->latitude, &frame->longitude)) {
+        epoch.fix.quality = frame->fix_quality > UINT8_MAX ? UINT8_MAX : frame->fix_quality;
+        epoch.fix.satellites = frame->satellites_tracked < 0 ? 0 :
+            frame->satellites_tracked > UINT8_MAX ? UINT8_MAX : frame->satellites_tracked;
+        int64_t hdop = gps_float_scale(&frame->hdop, 10, 1);
+        epoch.fix.hdop_d = hdop < 0 ? GPS_UNKNOWN8 : hdop >= GPS_UNKNOWN8 ? GPS_UNKNOWN8 - 1 : hdop;
+    }
+    epoch_check();
+}
+
+void fix_epoch_rmc(const struct minmea_sentence_rmc *frame) {
+    if (frame->time.hours < 0 || !epoch_enter(&frame->time, FIX_EPOCH_RMC)) {
+        return;
+    }
+    epoch.date = frame->date;
+    if (frame->valid) {
+        if (!epoch.position && set_position(&frame->latitude, &frame->longitude)) {
+            epoch.fix.quality = 1;
+        }
+        // knots to cm/s is * 185200 / 3600
+        set_motion(gps_float_scale(&frame->speed, 463, 9), &frame->course);
+    }
+    epoch_check();
+}
+
+void fix_epoch_vtg(const struct minmea_sentence_vtg *frame) {
+    if (!epoch.open || epoch.emitted || (epoch.have & FIX_EPOCH_VTG)) {
+        stats.late++;
+        return;
+    }
+    epoch.have |= FIX_EPOCH_VTG;
+    int64_t speed = gps_float_scale(&frame->speed_knots, 463, 9);
+    if (speed < 0) {
+        speed = gps_float_scale(&frame->speed_kph, 250, 9);
+    }
+    if (frame->faa_mode != MINMEA_FAA_MODE_NOT_VALID) {
+        set_motion(speed, &frame->true_track_degrees);
+    }
+    epoch_check();
+}
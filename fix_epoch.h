@@ -0,0 +1,36 @@
+#ifndef _FIX_EPOCH_H_
+#define _FIX_EPOCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "minmea.h"
+#include "gps_fix.h"
+
+// The receiver reports each epoch in several sentences (and, on multi-GNSS units, under
+// more than one talker). They are merged by UTC time into one gps_fix_t, which is handed
+// on exactly once: when every expected part has arrived, or when the next epoch starts.
+
+#define FIX_EPOCH_GGA 0x01
+#define FIX_EPOCH_RMC 0x02
+#define FIX_EPOCH_VTG 0x04
+
+typedef void (*fix_epoch_cb_t)(const gps_fix_t *fix);
+
+typedef struct {
+    uint32_t complete;      // emitted with every expected part
+    uint32_t partial;       // emitted when the next epoch started
+    uint32_t no_position;   // dropped without a valid position
+    uint32_t late;          // arrived after their epoch was emitted, or repeated under another talker
+} fix_epoch_stats_t;
+
+// parts: the FIX_EPOCH_* sentences expected every epoch
+void fix_epoch_init(uint8_t parts, fix_epoch_cb_t emit);
+
+void fix_epoch_gga(const struct minmea_sentence_gga *frame);
+void fix_epoch_rmc(const struct minmea_sentence_rmc *frame);
+// VTG carries no time and belongs to the epoch being assembled
+void fix_epoch_vtg(const struct minmea_sentence_vtg *frame);
+
+const fix_epoch_stats_t *fix_epoch_get_stats(void);
+
+#endif
@@ -0,0 +1,228 @@
+#include "fix_log.h"
+#include <string.h>
+#include "pico/stdlib.h"
+
+#define LOG_MAGIC "FLOG"
+
+// Head of every block; the block holding sequence number s is (s / per_block) % blocks
+typedef struct {
+    char magic[4];
+    uint16_t fix_size;
+    uint16_t count;
+    uint32_t first;
+} log_block_t;
+
+static block_store_t *store;
+static uint32_t blocks;
+static uint32_t per_block;
+static uint32_t log_end;
+static bool dirty;          // the block being filled has fixes not yet written out
+static bool full;           // ...and it is full, waiting for fix_log_step()
+static uint64_t dirty_us;   // when the oldest of them arrived
+static fix_log_stats_t stats;
+
+// The block being filled; flash can only be programmed from RAM
+static union {
+    log_block_t head;
+    uint8_t bytes[BLOCK_STORE_MAX_BLOCK];
+} buf;
+
+// Fixes that arrived after it filled
+static gps_fix_t backlog[FIX_LOG_BACKLOG];
+static uint32_t backlog_len;
+
+static gps_fix_t *buf_fixes(void) {
+    return (gps_fix_t *)(buf.bytes + sizeof(log_block_t));
+}
+
+static uint32_t block_of(uint32_t seq) {
+    return seq / per_block % blocks;
+}
+
+static bool read_head(uint32_t block, log_block_t *head) {
+    stats.resume_reads++;
+    return block_store_read(store, block * store->block_size, head, sizeof(*head)) &&
+        memcmp(head->magic, LOG_MAGIC, sizeof(head->magic)) == 0 && head->fix_size == sizeof(gps_fix_t) &&
+        head->count >= 1 && head->count <= per_block && head->first % per_block == 0 &&
+        block_of(head->first) == block;
+}
+
+static void start_block(uint32_t first) {
+    memset(buf.bytes, 0xff, store->block_size);
+    memcpy(buf.head.magic, LOG_MAGIC, sizeof(buf.head.magic));
+    buf.head.fix_size = sizeof(gps_fix_t);
+    buf.head.count = 0;
+    buf.head.first = first;
+}
+
+// Blocks are written in order, so from block 0 the firsts rise until the newest block and
+// then fall back to older data or blocks never written; binary search for the newest
+static bool find_newest(log_block_t *newest, uint32_t *at) {
+    log_block_t head0, head;
+    if (!read_head(0, &head0)) {
+        // A write of block 0 cut short, once the log has wrapped, leaves the last block newest
+        if (read_head(blocks - 1, &head) && head.count == per_block) {
+            *newest = head;
+            *at = blocks - 1;
+            return true;
+        }
+        return false;
+    }
+    uint32_t lo = 0, hi = blocks;
+    *newest = head0;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (read_head(mid, &head) && head.first >= head0.first) {
+            lo = mid;
+            *newest = head;
+        } else {
+            hi = mid;
+        }
+    }
+    *at = lo;
+    return true;
+}
+
+bool fix_log_init(block_store_t *s) {
+    memset(&stats, 0, sizeof(stats));
+    store = NULL;
+    log_end = 0;
+    dirty = false;
+    full = false;
+    backlog_len = 0;
+    if (!s) {
+        return true;
+    }
+    if (s->block_size > BLOCK_STORE_MAX_BLOCK || s->block_size < sizeof(log_block_t) + sizeof(gps_fix_t) ||
+            s->size / s->block_size < 2) {
+        return false;
+    }
+    store = s;
+    blocks = s->size / s->block_size;
+    per_block = (s->block_size - sizeof(log_block_t)) / sizeof(gps_fix_t);
+
+    log_block_t newest;
+    uint32_t at;
+    if (!find_newest(&newest, &at)) {
+        start_block(0);
+        return true;
+    }
+    log_end = newest.first + newest.count;
+    stats.resumed = log_end;
+    if (newest.count < per_block &&
+            block_store_read(store, at * store->block_size, buf.bytes, store->block_size)) {
+        // Carry on filling the block that was flushed part-full
+        return true;
+    }
+    log_end = newest.first + per_block;
+    start_block(log_end);
+    return true;
+}
+
+static bool write_block(void) {
+    return block_store_program(store, block_of(buf.head.first) * store->block_size, buf.bytes, store->block_size);
+}
+
+// Write the full block and carry on in the next with the backlog
+static void write_full(void) {
+    if (write_block()) {
+        stats.blocks++;
+    } else {
+        stats.dropped += per_block;
+    }
+    start_block(buf.head.first + per_block);
+    memcpy(buf_fixes(), backlog, backlog_len * sizeof(gps_fix_t));
+    buf.head.count = backlog_len;
+    full = false;
+    dirty = backlog_len > 0;
+    dirty_us = time_us_64();
+    backlog_len = 0;
+}
+
+void fix_log_append(const gps_fix_t *fix) {
+    if (!store) {
+        return;
+    }
+    if (full) {
+        if (backlog_len == FIX_LOG_BACKLOG) {
+            stats.dropped++;
+            return;
+        }
+        backlog[backlog_len++] = *fix;
+        log_end++;
+        return;
+    }
+    if (!dirty) {
+        dirty = true;
+        dirty_us = time_us_64();
+    }
+    buf_fixes()[buf.head.count++] = *fix;
+    log_end++;
+    full = buf.head.count == per_block;
+}
+
+bool fix_log_flush(void) {
+    if (!store) {
+        return true;
+    }
+    if (full) {
+        write_full();
+    }
+    if (!dirty) {
+        return true;
+    }
+    if (!write_block()) {
+        return false;
+    }
+    dirty = false;
+    stats.flushes++;
+    return true;
+}
+
+void fix_log_step(void) {
+    if (full) {
+        write_full();
+    } else if (dirty && time_us_64() - dirty_us >= FIX_LOG_FLUSH_S * 1000000ull) {
+        if (!fix_log_flush()) {
+            // Try again at the next interval rather than on every call
+            dirty_us = time_us_64();
+        }
+    }
+}
+
+uint32_t fix_log_begin(void) {
+    if (!store) {
+        return 0;
+    }
+    // The block being filled has overwritten the oldest one
+    uint32_t filling = log_end / per_block;
+    return filling >= blocks ? (filling - blocks + 1) * per_block : 0;
+}
+
+uint32_t fix_log_end(void) {
+    return log_end;
+}
+
+bool fix_log_read(uint32_t seq, gps_fix_t *fix) {
+    if (!store || seq < fix_log_begin() || seq >= log_end) {
+        return false;
+    }
+    if (seq >= buf.head.first + buf.head.count) {
+        *fix = backlog[seq - buf.head.first - buf.head.count];
+        return true;
+    }
+    if (seq >= buf.head.first) {
+        *fix = buf_fixes()[seq - buf.head.first];
+        return true;
+    }
+    uint32_t block = block_of(seq);
+    log_block_t head;
+    uint32_t offset = block * store->block_size + sizeof(log_block_t) + (seq % per_block) * sizeof(gps_fix_t);
+    return block_store_read(store, block * store->block_size, &head, sizeof(head)) &&
+        head.first == seq - seq % per_block && seq - head.first < head.count &&
+        block_store_read(store, offset, fix, sizeof(*fix));
+}
+
+const fix_log_stats_t *fix_log_get_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,59 @@
+#ifndef _FIX_LOG_H_
+#define _FIX_LOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gps_fix.h"
+#include "block_store.h"
+
+// Fixes kept in a block store for the long term, beyond what the RAM track holds. Fixes are
+// gathered into whole blocks of the store, each headed by the sequence number of its first
+// fix, and the blocks are written round the store in turn, overwriting the oldest. After a
+// reboot the log carries on from its last block, so sequence numbers count every fix ever
+// logged (unlike the track's, which restart at boot).
+
+// A part-filled block is written out once its oldest fix has waited this long, so a power cut
+// loses at most this much; the block is written again when it fills
+#ifndef FIX_LOG_FLUSH_S
+#define FIX_LOG_FLUSH_S 60
+#endif
+
+// Fixes held in RAM while a full block waits for fix_log_step() to write it; the NEO-6's
+// 5 Hz top rate fills this in 6 s, longer than the flash worker waits for a quiet UART
+#ifndef FIX_LOG_BACKLOG
+#define FIX_LOG_BACKLOG 32
+#endif
+
+typedef struct {
+    uint32_t resumed;       // fixes found in the store at init
+    uint32_t resume_reads;  // block headers read to find them
+    uint32_t blocks;        // full blocks written
+    uint32_t flushes;       // part-filled blocks written
+    uint32_t dropped;       // fixes lost to write errors or a full backlog
+} fix_log_stats_t;
+
+// Log to store, picking up after the newest block already in it; NULL turns the log off.
+// False if the store is too small to hold two blocks.
+bool fix_log_init(block_store_t *store);
+
+// Only gathers in RAM, so it is safe between NMEA sentences: a block that fills is left for
+// fix_log_step() to write
+void fix_log_append(const gps_fix_t *fix);
+
+// Write out a full block, or a part-filled block that is due; at most one block a call.
+// Call periodically, from wherever flash writes are safe.
+void fix_log_step(void);
+
+// Write out everything gathered now
+bool fix_log_flush(void);
+
+// Oldest sequence number still logged, and one past the newest
+uint32_t fix_log_begin(void);
+uint32_t fix_log_end(void);
+
+// False if the fix has been overwritten, does not exist yet or could not be read
+bool fix_log_read(uint32_t seq, gps_fix_t *fix);
+
+const fix_log_stats_t *fix_log_get_stats(void);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _FLASH_LAYOUT_H_
+#define _FLASH_LAYOUT_H_
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "heatmap_store.h"
+
+// Persistent data lives in sectors carved from the top of flash, well away from the
+// program image. Offsets are relative to the start of flash (not XIP_BASE).
+
+// DHCP lease bindings, so returning clients keep their address across reboots
+#define FLASH_DHCP_LEASES_OFFSET    (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+// Heatmap snapshots: two slots written in turn, so one is always whole; see heatmap_store.h
+#define FLASH_HEATMAP_SIZE          HEATMAP_STORE_SIZE(FLASH_SECTOR_SIZE)
+#define FLASH_HEATMAP_OFFSET        (FLASH_DHCP_LEASES_OFFSET - FLASH_HEATMAP_SIZE)
+
+// Fix log, when kept in internal flash rather than on an SD card
+#define FLASH_FIX_LOG_SIZE          (1024 * 1024)
+#define FLASH_FIX_LOG_OFFSET        (FLASH_HEATMAP_OFFSET - FLASH_FIX_LOG_SIZE)
+
+// Address of a flash offset in the XIP window, for reading persisted data in place
+#define FLASH_XIP_PTR(offset)       ((const uint8_t *)(XIP_BASE + (offset)))
+
+#endif
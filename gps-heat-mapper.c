@@ -3,12 +3,26 @@
 #include "pico/cyw43_arch.h"
 #include "hardware/i2c.h"
 #include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "hardware/clocks.h"
+#include "pico/async_context.h"
 #include "minmea.h"
 #include "lwip/tcp.h"
 #include "lwip/ip4_addr.h"
 #include "lwip/timeouts.h"
 #include "dhcpserver.h"
+#include "dnsserver.h"
 #include "http_server.h"
+#include "power.h"
+#include "heatmap.h"
+#include "heatmap_render.h"
+#include "heatmap_store.h"
+#include "block_store.h"
+#include "fix_log.h"
+#include "flash_layout.h"
+#include "track.h"
+#include "trips.h"
+#include "ingest.h"
 
 // I2C defines for OLED display
 #define I2C_PORT i2c0
@@ -20,25 +34,89 @@
 #define UART_TX_PIN 4
 #define UART_RX_PIN 5
 #define BAUD_RATE 9600 // Note: Default baudrate for NEO6MV2 is 9600, but this can be increased.
+#define UART_IRQ UART1_IRQ
+
+// SPI pins for the SD card the fix log can be kept on
+#define SD_SPI spi0
+#define SD_MISO_PIN 16
+#define SD_CS_PIN 17
+#define SD_SCK_PIN 18
+#define SD_MOSI_PIN 19
+
+// Where fixes are logged beyond the RAM track
+#define FIX_LOG_NONE 0
+#define FIX_LOG_FLASH 1     // FLASH_FIX_LOG_SIZE of internal flash; a sector erase every ~200 fixes
+#define FIX_LOG_SD 2        // the whole card, raw; untested on hardware
+#ifndef FIX_LOG_STORE
+#define FIX_LOG_STORE FIX_LOG_NONE
+#endif
+
+// The SD driver is only built with -DFIX_LOG_SD=ON; see CMakeLists.txt
+#if FIX_LOG_STORE == FIX_LOG_SD
+#include "sd_card.h"
+#endif
+
+// Bytes buffered between the UART IRQ and the parser; a burst of NMEA at 9600 baud is ~1 KB/s
+#define UART_RING_SIZE 1024
+// Line ends whose arrival time is kept for the latency statistics
+#define EOL_RING_SIZE 16
+
+// A flash erase stalls the UART IRQ for longer than its 32-byte FIFO lasts at 9600 baud, so
+// flash is written only once the receiver has been silent this long: a pause that only comes
+// between the bursts of one epoch and the next
+#define UART_QUIET_MS 20
+// ...or once it has waited this long for one, so a receiver that never pauses still gets
+// its heatmap saved
+#define FLASH_WAIT_MAX_MS 3000
+
+// How often a power mode switch tops up the UART TX FIFO; 32 bytes last ~33 ms at 9600 baud
+#define POWER_TX_POLL_MS 30
+
+// How often housekeeping (flash writes, latency report) runs
+#define HOUSEKEEPING_INTERVAL_MS 1000
+#define REPORT_INTERVAL_S 60
 
 bool led_state = false;
 
-char buf[3];
-char data[MINMEA_MAX_SENTENCE_LENGTH];
-char line[MINMEA_MAX_SENTENCE_LENGTH];
+char html_page[512]; // large enough buffer
 
-int coor_ind = 0;
+// Filled by the UART IRQ, drained by uart_worker
+static char uart_ring[UART_RING_SIZE];
+static volatile uint32_t uart_head;
+static volatile uint32_t uart_tail;
+static volatile uint32_t uart_overruns;
+static volatile uint32_t uart_fifo_overruns;   // bytes lost in hardware before the IRQ ran
+static volatile uint32_t uart_rx_us;           // time_us_32() of the last IRQ with data
+static uint32_t uart_long_lines;
+
+// Flash writes waiting for a pause in the NMEA
+static bool flash_waiting;
+static uint32_t flash_wait_us;
+static uint32_t flash_waits;        // retries because the receiver was mid-burst
+static uint32_t flash_forced;       // writes that gave up waiting
+
+// UBX commands of a power mode switch are going out
+static bool power_sending;
+
+// time_us_32() at the IRQ that received each '\n'
+static uint32_t eol_ring[EOL_RING_SIZE];
+static volatile uint32_t eol_head;
+static uint32_t eol_tail;
+
+// Wake-up latency from UART IRQ to parsed fix
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+} latency_stats_t;
 
-char lat[10000][15];
-char lon[10000][15];
-char tst[10000][10];
+static latency_stats_t fix_latency = { .min_us = UINT32_MAX };
 
-char html_page[512]; // large enough buffer
+static async_context_t *context;
+static dhcp_server_t dhcp;
 
-typedef struct {
-    uint32_t loc_id;
-    uint16_t count;
-} Heatmap;
+static block_store_t heatmap_flash;
 
 static const char body[] =
     "<!DOCTYPE html><html><head><title>Pico 2W</title></head>"
@@ -54,70 +132,214 @@ void blink_once(int ms) {
     sleep_ms(ms);
 }
 
-bool parse_gga(const char *sentence, char *type) {
-    
-    int ind = 3;
-    for (ind; ind <= 5; ind++) type[ind - 3] = sentence[ind];
-    if (type[0] == 'G' && type[1] == 'G' && type[2] == 'A') {
-        printf("NMEA: %s\n", sentence);
-
-        ind++;
-        int dind = 0;
-        for (int i = 0; i < MINMEA_MAX_SENTENCE_LENGTH; i++) data[i] = '\0';
-
-        while (sentence[ind] != ',') {
-            tst[coor_ind][dind] = sentence[ind];
-            data[dind++] = sentence[ind++];
-        }
-
-        ind++;
-        dind = 0;
-        for (int i = 0; i < MINMEA_MAX_SENTENCE_LENGTH; i++) data[i] = '\0';
+static void uart_worker_func(async_context_t *context, async_when_pending_worker_t *worker);
+static bool uart_quiet(void) {
+    return uart_tail == uart_head && time_us_32() - uart_rx_us >= UART_QUIET_MS * 1000;
+}
 
-        if (sentence[ind] == ',') {
-            printf("No data\n");
-            return false;
+// One block of a heatmap snapshot, any due fix log block and settled DHCP leases, between
+// NMEA bursts
+static void flash_worker_func(async_context_t *context, async_at_time_worker_t *worker) {
+    if (!uart_quiet()) {
+        if (time_us_32() - flash_wait_us < FLASH_WAIT_MAX_MS * 1000) {
+            flash_waits++;
+            async_context_add_at_time_worker_in_ms(context, worker, UART_QUIET_MS);
+            return;
         }
+        flash_forced++;
+    }
+    flash_waiting = false;
+    heatmap_store_step();
+    fix_log_step();
+    dhcp_server_persist(&dhcp);
+}
 
-        while (sentence[ind] != ',') {
-            lat[coor_ind][dind] = sentence[ind];
-            data[dind++] = sentence[ind++];
+static void housekeeping_worker_func(async_context_t *context, async_at_time_worker_t *worker);
+static void density_worker_func(async_context_t *context, async_when_pending_worker_t *worker);
+static void flash_worker_func(async_context_t *context, async_at_time_worker_t *worker);
+static void power_worker_func(async_context_t *context, async_at_time_worker_t *worker);
+
+static async_when_pending_worker_t uart_worker = { .do_work = uart_worker_func };
+static async_at_time_worker_t housekeeping_worker = { .do_work = housekeeping_worker_func };
+static async_when_pending_worker_t density_worker = { .do_work = density_worker_func };
+static async_at_time_worker_t flash_worker = { .do_work = flash_worker_func };
+static async_at_time_worker_t power_worker = { .do_work = power_worker_func };
+
+// Runs in IRQ context: move the FIFO into the ring and hand the rest to uart_worker
+static void on_uart_rx(void) {
+    uint32_t head = uart_head;
+    while (uart_is_readable(UART_ID)) {
+        // Read the data register whole: its overrun flag says bytes were lost before this one
+        uint32_t dr = uart_get_hw(UART_ID)->dr;
+        if (dr & UART_UARTDR_OE_BITS) {
+            uart_fifo_overruns++;
+        }
+        char c = (char)dr;
+        if (head - uart_tail >= UART_RING_SIZE) {
+            uart_overruns++;
+            continue;
         }
+        uart_ring[head++ % UART_RING_SIZE] = c;
+        if (c == '\n') {
+            eol_ring[eol_head++ % EOL_RING_SIZE] = time_us_32();
+        }
+    }
+    uart_head = head;
+    uart_rx_us = time_us_32();
+    async_context_set_work_pending(context, &uart_worker);
+}
 
+static void record_latency(latency_stats_t *stats, uint32_t us) {
+    stats->count++;
+    stats->total_us += us;
+    if (us < stats->min_us) stats->min_us = us;
+    if (us > stats->max_us) stats->max_us = us;
+}
 
-        ind++;
-        while (sentence[ind] != ',') {
-            lat[coor_ind][dind] = sentence[ind];
-            data[dind++] = sentence[ind++];
+static void uart_worker_func(async_context_t *context, async_when_pending_worker_t *worker) {
+    static char line[MINMEA_MAX_SENTENCE_LENGTH];
+    static int idx = 0;
+    static bool too_long = false;
+
+    uint32_t head = uart_head;
+    while (uart_tail != head) {
+        char c = uart_ring[uart_tail++ % UART_RING_SIZE];
+        if (c == '\n') {
+            line[idx] = '\0';
+            idx = 0;
+
+            // An over-long line has lost its tail, checksum included; drop it
+            bool fix = !too_long && ingest_sentence(line);
+            uart_long_lines += too_long;
+            too_long = false;
+
+            // Timestamps can only be missing if the ring overflowed mid-line
+            if (eol_tail != eol_head) {
+                uint32_t eol_us = eol_ring[eol_tail++ % EOL_RING_SIZE];
+                if (fix) {
+                    record_latency(&fix_latency, time_us_32() - eol_us);
+                }
+            }
+        } else if (idx < sizeof(line) - 1) {
+            line[idx++] = c;
+        } else {
+            too_long = true;
         }
-        printf("Latitude: %s\n", data);
+    }
+}
 
-        ind++;
-        dind = 0;
-        for (int i = 0; i < MINMEA_MAX_SENTENCE_LENGTH; i++) data[i] = '\0';
+static void report_latency(const latency_stats_t *stats) {
+    if (stats->count) {
+        printf("Fix latency: n=%lu min=%luus avg=%luus max=%luus overruns=%lu\n",
+            (unsigned long)stats->count, (unsigned long)stats->min_us,
+            (unsigned long)(stats->total_us / stats->count), (unsigned long)stats->max_us,
+            (unsigned long)uart_overruns);
+    }
+}
 
-        while (sentence[ind] != ',') {
-            lon[coor_ind][dind] = sentence[ind];
-            data[dind++] = sentence[ind++];
-        }
+static void report_views(void) {
+    // Sentences lost or mangled on the way in, flash stalls being the usual cause
+    const ingest_stats_t *in = ingest_get_stats();
+    printf("NMEA: lines=%lu invalid=%lu long=%lu overruns=%lu fifo_overruns=%lu flash_waits=%lu flash_forced=%lu\n",
+        (unsigned long)in->lines, (unsigned long)in->invalid, (unsigned long)uart_long_lines,
+        (unsigned long)uart_overruns, (unsigned long)uart_fifo_overruns, (unsigned long)flash_waits,
+        (unsigned long)flash_forced);
+    const heatmap_view_stats_t *v = heatmap_view_get_stats();
+    printf("Heatmap views: n=%lu stale=%lu publishes=%lu blocks=%lu retries=%lu\n",
+        (unsigned long)v->views, (unsigned long)v->stale, (unsigned long)v->publishes,
+        (unsigned long)v->blocks_copied, (unsigned long)v->retries);
+    const heatmap_store_stats_t *st = heatmap_store_get_stats();
+    printf("Heatmap store: overlay=%lu compactions=%lu blocks=%lu deferred=%lu failed=%lu\n",
+        (unsigned long)heatmap_overlay_size(), (unsigned long)st->compactions,
+        (unsigned long)st->blocks, (unsigned long)st->deferred, (unsigned long)st->failed);
+}
 
-        ind++;
-        while (sentence[ind] != ',') {
-            lon[coor_ind][dind] = sentence[ind];
-            data[dind++] = sentence[ind++];
-        }
-        printf("Longitude: %s\n", data);
+// Render cost in CPU cycles per pixel, to compare builds with and without the DSP kernels
+static void report_render(void) {
+    const heatmap_render_stats_t *r = heatmap_render_get_stats();
+    if (r->pixels) {
+        uint64_t centi = r->us * (clock_get_hz(clk_sys) / 10000) / r->pixels;
+        printf("Heatmap render: rows=%lu pixels=%llu cycles/pixel=%lu.%02lu%s\n", (unsigned long)r->rows,
+            (unsigned long long)r->pixels, (unsigned long)(centi / 100), (unsigned long)(centi % 100),
+#if defined(__ARM_FEATURE_DSP)
+            " (dsp)"
+#else
+            ""
+#endif
+            );
+    }
+}
 
-        // char msg[100];
-        // snprintf(msg, 100, "Time: %s\nLatitude: %s\nLongitude: %s\n", tst[coor_ind], lat[coor_ind], lon[coor_ind]);
-        build_http_page(data);
-        coor_ind++;
+static void report_fix_log(void) {
+    const fix_log_stats_t *l = fix_log_get_stats();
+    printf("Fix log: %lu-%lu blocks=%lu flushes=%lu dropped=%lu\n",
+        (unsigned long)fix_log_begin(), (unsigned long)fix_log_end(), (unsigned long)l->blocks,
+        (unsigned long)l->flushes, (unsigned long)l->dropped);
+}
 
-        return true;
+static block_store_t *open_fix_log(void) {
+#if FIX_LOG_STORE == FIX_LOG_FLASH
+    static block_store_t fix_log_store;
+    block_store_flash_init(&fix_log_store, FLASH_FIX_LOG_OFFSET, FLASH_FIX_LOG_SIZE);
+    return &fix_log_store;
+#elif FIX_LOG_STORE == FIX_LOG_SD
+    static block_store_t fix_log_store;
+    if (!sd_card_init(&fix_log_store, SD_SPI, SD_SCK_PIN, SD_MOSI_PIN, SD_MISO_PIN, SD_CS_PIN)) {
+        printf("No SD card; fixes are not logged\n");
+        return NULL;
     }
+    return &fix_log_store;
+#else
+    return NULL;
+#endif
+}
 
-    else if (type[0] == 'G' && type[1] == 'S' && type[2] == 'V') printf("NMEA: %s\n", sentence);
-    return false;
+// Rebuilds the heatmap density layer a slice at a time, so UART and lwIP work interleave
+static void density_worker_func(async_context_t *context, async_when_pending_worker_t *worker) {
+    if (heatmap_density_step()) {
+        async_context_set_work_pending(context, worker);
+    }
+}
+
+// Sends a power mode switch asked for over HTTP a FIFO at a time; all of it at once would
+// hold up lwIP, which runs on this context, for ~80 ms
+static void power_worker_func(async_context_t *context, async_at_time_worker_t *worker) {
+    power_sending = power_step();
+    if (power_sending) {
+        async_context_add_at_time_worker_in_ms(context, worker, POWER_TX_POLL_MS);
+    }
+}
+
+static void housekeeping_worker_func(async_context_t *context, async_at_time_worker_t *worker) {
+    static uint32_t ticks = 0;
+
+    // One block of a heatmap snapshot a tick, so a compaction never holds off flash for long
+    if (!flash_waiting) {
+        flash_waiting = true;
+        flash_wait_us = time_us_32();
+        async_context_add_at_time_worker_in_ms(context, &flash_worker, 0);
+    }
+
+    if (!power_sending && power_pending()) {
+        power_sending = true;
+        async_context_add_at_time_worker_in_ms(context, &power_worker, 0);
+    }
+
+    // Picks up a mode switch or a fix that outgrew the layer
+    if (heatmap_density_pending()) {
+        async_context_set_work_pending(context, &density_worker);
+    }
+
+    if (++ticks % (REPORT_INTERVAL_S * 1000 / HOUSEKEEPING_INTERVAL_MS) == 0) {
+        power_report();
+        report_latency(&fix_latency);
+        report_views();
+        report_fix_log();
+        report_render();
+        http_report();
+    }
+
+    async_context_add_at_time_worker_in_ms(context, worker, HOUSEKEEPING_INTERVAL_MS);
 }
 
 void main(){
@@ -134,11 +356,28 @@ void main(){
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
 
+    // Put the receiver into its cyclic power save mode before the first fix
+    power_init(UART_ID, POWER_DEFAULT_MODE);
+
+    heatmap_init();
+    block_store_flash_init(&heatmap_flash, FLASH_HEATMAP_OFFSET, FLASH_HEATMAP_SIZE);
+    heatmap_store_init(&heatmap_flash);
+    printf("Heatmap restored: %lu cells in %luus\n", (unsigned long)heatmap_store_get_stats()->restored,
+        (unsigned long)heatmap_store_get_stats()->restore_us);
+    track_init();
+    fix_log_init(open_fix_log());
+    printf("Fix log: %lu fixes resumed\n", (unsigned long)fix_log_get_stats()->resumed);
+    trips_init();
+    ingest_init();
+
     if (cyw43_arch_init()) {
         blink_once(100);
         return;
     }
 
+    // Wi-Fi, lwIP and our workers all run from the cyw43 background context
+    context = cyw43_arch_async_context();
+
     // Enable AP mode
     cyw43_arch_enable_ap_mode("GPS-Heatmapper", "12345678", CYW43_AUTH_WPA2_AES_PSK);
 
@@ -147,37 +386,37 @@ void main(){
     IP4_ADDR(&ipaddr, 192,168,4,1);
     IP4_ADDR(&netmask, 255,255,255,0);
     IP4_ADDR(&gw, 192,168,4,1);
+
+    cyw43_arch_lwip_begin();
     netif_set_addr(&cyw43_state.netif[CYW43_ITF_AP], &ipaddr, &netmask, &gw);
 
     build_http_page(body);
     
     // DHCP Initialization
-    static dhcp_server_t dhcp;
     dhcp_server_init(&dhcp, &ipaddr, &netmask);
 
+    // DNS Initialization: every name resolves to us so phones raise the captive portal
+    static dns_server_t dns;
+    dns_server_init(&dns, &ipaddr);
+
     // Setup TCP server on port 80
     struct tcp_pcb *pcb = tcp_new();
     tcp_bind(pcb, IP_ADDR_ANY, 80);
     pcb = tcp_listen(pcb);
     tcp_accept(pcb, http_accept);
-    
-    int idx = 0;
+    cyw43_arch_lwip_end();
+
+    async_context_add_when_pending_worker(context, &uart_worker);
+    async_context_add_when_pending_worker(context, &density_worker);
+    async_context_add_at_time_worker_in_ms(context, &housekeeping_worker, HOUSEKEEPING_INTERVAL_MS);
+
+    // GPS bytes arrive by interrupt; everything else is scheduled on the async context
+    irq_set_exclusive_handler(UART_IRQ, on_uart_rx);
+    irq_set_enabled(UART_IRQ, true);
+    uart_set_irq_enables(UART_ID, true, false);
 
     while (true) {
-        cyw43_arch_poll(); // keep Wi-Fi + lwIP alive
-        sys_check_timeouts();
-
-        if (uart_is_readable(UART_ID)) {
-            char c = uart_getc(UART_ID);
-            if (c == '\n') {
-                line[idx] = '\0';
-                idx = 0;
-                
-                parse_gga(line, buf);
-
-            } else if (idx < sizeof(line) - 1) {
-                line[idx++] = c;
-            }
-        }
+        // Nothing to do in the foreground; sleep until an interrupt
+        power_idle();
     }
-}
\ No newline at end of file
+}
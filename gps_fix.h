@@ -0,0 +1,55 @@
+#ifndef _GPS_FIX_H_
+#define _GPS_FIX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "minmea.h"
+
+// A position fix in integer form, as stored and sent to clients
+typedef struct {
+    uint32_t time;          // UTC seconds since 1970, see utc.h; the day is 1970-01-01 until a date is received
+    int32_t lat_e7;         // degrees * 1e7, north positive
+    int32_t lon_e7;         // degrees * 1e7, east positive
+    uint16_t speed_cm_s;    // ground speed, GPS_UNKNOWN16 if unknown
+    uint16_t course_cdeg;   // true course over ground in 0.01 degree, GPS_UNKNOWN16 if unknown
+    uint8_t quality;        // GGA fix quality, 0 = invalid
+    uint8_t satellites;
+    uint8_t hdop_d;         // horizontal dilution of precision * 10, GPS_UNKNOWN8 if unknown
+} gps_fix_t;
+
+#define GPS_UNKNOWN16 0xffff
+#define GPS_UNKNOWN8 0xff
+
+// f * num / den rounded to nearest, without going through float; -1 if the field is empty
+static inline int64_t gps_float_scale(const struct minmea_float *f, int64_t num, int64_t den) {
+    if (f->scale <= 0) {
+        return -1;
+    }
+    int64_t d = (int64_t)f->scale * den;
+    int64_t n = (int64_t)f->value * num;
+    return (n < 0 ? n - d / 2 : n + d / 2) / d;
+}
+
+// Convert an NMEA DDDMM.MMMM coordinate to degrees * 1e7 without going through float.
+// The scale can be up to 1e9, so the arithmetic is 64 bit.
+static inline int32_t gps_coord_e7(const struct minmea_float *f) {
+    if (f->scale <= 0) {
+        return 0;
+    }
+    int64_t unit = (int64_t)f->scale * 100;
+    int64_t degrees = f->value / unit;
+    int64_t minutes = f->value % unit;
+    return (int32_t)(degrees * 10000000 + minutes * 10000000 / (60 * (int64_t)f->scale));
+}
+
+// True if the coordinate is present, has valid minutes and is within +-max_degrees
+static inline bool gps_coord_valid(const struct minmea_float *f, int32_t max_degrees) {
+    if (f->scale <= 0) {
+        return false;
+    }
+    int64_t unit = (int64_t)f->scale * 100;
+    int64_t a = f->value < 0 ? -(int64_t)f->value : f->value;
+    return a % unit < 60 * (int64_t)f->scale && a <= max_degrees * unit;
+}
+
+#endif
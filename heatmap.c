@@ -0,0 +1,603 @@
+#include "heatmap.h"
+#include <string.h>
+
+#define VIEW_BLOCKS ((HEATMAP_OVERLAY_CELLS + HEATMAP_VIEW_BLOCK - 1) / HEATMAP_VIEW_BLOCK)
+#define DIRTY_WORDS ((VIEW_BLOCKS + 31) / 32)
+
+// Cells as of the last snapshot, read where they lie (flash, through XIP) and never written
+static const Heatmap *base;
+static size_t base_count;
+// Visits since then, sorted by loc_id like the base; count is the increment
+static Heatmap overlay[HEATMAP_OVERLAY_CELLS];
+static size_t overlay_count;
+// Distinct cells in the two together
+static size_t total_count;
+static uint32_t generation;
+
+// What heatmap_add hands back: the cell with its base and overlay counts combined
+static Heatmap added;
+
+// Odd while the cells are being changed, so a copy that overlapped a change is taken again
+static uint32_t seq;
+// Blocks of the overlay changed since they were last copied to the view
+static uint32_t dirty[DIRTY_WORDS];
+
+// The copy readers see, and how many of them are using it. The base is shared, not copied.
+static const Heatmap *view_base;
+static size_t view_base_count;
+static Heatmap view_overlay[HEATMAP_OVERLAY_CELLS];
+static size_t view_count;
+static size_t view_total;
+static uint32_t view_generation;
+static uint32_t view_readers;
+static heatmap_view_stats_t view_stats;
+
+static bool have_origin;
+static int32_t origin_lat_e7;
+static int32_t origin_lon_e7;
+
+static struct {
+    const void *owner;
+    uint8_t stage[sizeof(heatmap_grid_header_t)];   // a header or cell split across pieces
+    uint8_t staged;
+    bool header_done;
+    bool failed;
+    bool waiting;               // the staged cell waits for room in the overlay
+    bool drop_excess;           // ...or is dropped if there is none
+    int32_t lat_e7;             // their origin
+    int32_t lon_e7;
+    int32_t drow;               // their row and column plus these is ours
+    int32_t dcol;
+    int64_t last;               // their last loc_id, to check the order
+    uint32_t resume;            // our loc_id the join continues from
+    size_t pending_count;
+    heatmap_merge_stats_t stats;
+} merge;
+
+// New overlay cells in loc_id order, spliced in together so the overlay is shifted once per
+// batch. reserved marks cells the base already has, worked out as they are spliced in since a
+// compaction may have moved cells into the base meanwhile.
+static Heatmap pending[HEATMAP_MERGE_PENDING];
+
+#define CELL_POW2 ((HEATMAP_CELL_E7 & (HEATMAP_CELL_E7 - 1)) == 0)
+#define GRID_HALF (1 << (HEATMAP_GRID_BITS - 1))
+
+static inline int32_t floor_div(int32_t a, int32_t b) {
+    int32_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// Cells from the origin to e7 degrees off it, rounding down. The edge is a constant, so
+// the compiler makes this a shift when it is a power of two (relying on >> of a negative
+// being arithmetic, as it is in GCC and Clang) and a multiply by its reciprocal otherwise.
+static inline int32_t cell_offset(int32_t e7) {
+    return CELL_POW2 ? e7 >> __builtin_ctz(HEATMAP_CELL_E7) : floor_div(e7, HEATMAP_CELL_E7);
+}
+
+// South-west corner of the cell holding e7
+static inline int32_t cell_corner(int32_t e7) {
+    return CELL_POW2 ? e7 & -HEATMAP_CELL_E7 : floor_div(e7, HEATMAP_CELL_E7) * HEATMAP_CELL_E7;
+}
+
+// loc_id of the cell row and col cells from the origin; false if that is off the grid. Both
+// signs and both ends are checked at once.
+static inline bool grid_loc(int32_t row, int32_t col, uint32_t *loc_id) {
+    uint32_t r = (uint32_t)row + GRID_HALF;
+    uint32_t c = (uint32_t)col + GRID_HALF;
+    if ((r | c) >> HEATMAP_GRID_BITS) {
+        return false;
+    }
+    *loc_id = (r + HEATMAP_INDEX_BIAS - GRID_HALF) << 16 | (c + HEATMAP_INDEX_BIAS - GRID_HALF);
+    return true;
+}
+
+static void write_begin(void) {
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(void) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+}
+
+// Overlay cells [first, last) have changed
+static void mark_dirty(size_t first, size_t last) {
+    for (size_t b = first / HEATMAP_VIEW_BLOCK; b < (last + HEATMAP_VIEW_BLOCK - 1) / HEATMAP_VIEW_BLOCK; b++) {
+        __atomic_fetch_or(&dirty[b / 32], 1u << (b % 32), __ATOMIC_RELAXED);
+    }
+}
+
+void heatmap_init(void) {
+    write_begin();
+    base = NULL;
+    base_count = 0;
+    overlay_count = 0;
+    total_count = 0;
+    generation = 0;
+    have_origin = false;
+    write_end();
+    memset(dirty, 0, sizeof(dirty));
+    view_base = NULL;
+    view_base_count = 0;
+    view_count = 0;
+    view_total = 0;
+    view_generation = 0;
+}
+
+void heatmap_set_base(const Heatmap *cells, size_t n, int32_t lat_e7, int32_t lon_e7) {
+    write_begin();
+    base = cells;
+    base_count = n;
+    total_count = n;
+    origin_lat_e7 = lat_e7;
+    origin_lon_e7 = lon_e7;
+    have_origin = true;
+    generation++;
+    write_end();
+}
+
+// Index of the first of n cells with loc_id >= the one given
+static size_t lower_bound(const Heatmap *cells, size_t n, uint32_t loc_id) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cells[mid].loc_id < loc_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const Heatmap *base_find(uint32_t loc_id) {
+    size_t i = lower_bound(base, base_count, loc_id);
+    return i < base_count && base[i].loc_id == loc_id ? &base[i] : NULL;
+}
+
+static void add_count(Heatmap *cell, uint32_t count) {
+    cell->count = cell->count + count > UINT16_MAX ? UINT16_MAX : cell->count + count;
+}
+
+const Heatmap *heatmap_add(int32_t lat_e7, int32_t lon_e7) {
+    if (!have_origin) {
+        // The first fix anchors the grid, snapped to a cell corner
+        origin_lat_e7 = cell_corner(lat_e7);
+        origin_lon_e7 = cell_corner(lon_e7);
+        have_origin = true;
+    }
+
+    uint32_t loc_id;
+    if (!grid_loc(cell_offset(lat_e7 - origin_lat_e7), cell_offset(lon_e7 - origin_lon_e7), &loc_id)) {
+        return NULL;
+    }
+
+    size_t i = lower_bound(overlay, overlay_count, loc_id);
+    bool insert = i == overlay_count || overlay[i].loc_id != loc_id;
+    const Heatmap *old = base_find(loc_id);
+    if (insert && (overlay_count == HEATMAP_OVERLAY_CELLS || (!old && total_count == HEATMAP_MAX_CELLS))) {
+        return NULL;
+    }
+    write_begin();
+    if (insert) {
+        memmove(&overlay[i + 1], &overlay[i], (overlay_count - i) * sizeof(overlay[0]));
+        overlay[i].loc_id = loc_id;
+        overlay[i].count = 0;
+        overlay[i].reserved = 0;
+        overlay_count++;
+        total_count += !old;
+    }
+    if (overlay[i].count < UINT16_MAX) {
+        overlay[i].count++;
+    }
+    generation++;
+    mark_dirty(i, insert ? overlay_count : i + 1);
+    write_end();
+
+    added = overlay[i];
+    if (old) {
+        add_count(&added, old->count);
+    }
+    return &added;
+}
+
+size_t heatmap_size(void) {
+    return total_count;
+}
+
+size_t heatmap_overlay_size(void) {
+    return overlay_count;
+}
+
+uint32_t heatmap_generation(void) {
+    return generation;
+}
+
+void heatmap_grid_header(heatmap_grid_header_t *hdr) {
+    memcpy(hdr->magic, HEATMAP_GRID_MAGIC, sizeof(hdr->magic));
+    hdr->version = HEATMAP_GRID_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->origin_lat_e7 = origin_lat_e7;
+    hdr->origin_lon_e7 = origin_lon_e7;
+    hdr->cell_e7 = HEATMAP_CELL_E7;
+    hdr->generation = generation;
+}
+
+// Base and overlay cells with loc_id >= *cursor, joined, into buf. Resuming by key rather
+// than index keeps the stream sorted and duplicate free even if cells are inserted between
+// calls.
+static size_t read_joined(const Heatmap *b, size_t bn, const Heatmap *o, size_t on,
+                          uint64_t *cursor, void *buf, size_t len) {
+    if (*cursor > UINT32_MAX) {
+        return 0;
+    }
+    size_t bi = lower_bound(b, bn, *cursor);
+    size_t oi = lower_bound(o, on, *cursor);
+    size_t n = 0;
+    Heatmap cell;
+    while (n < len / sizeof(Heatmap) && (bi < bn || oi < on)) {
+        if (oi == on || (bi < bn && b[bi].loc_id < o[oi].loc_id)) {
+            cell = b[bi++];
+        } else if (bi == bn || o[oi].loc_id < b[bi].loc_id) {
+            cell = o[oi++];
+        } else {
+            cell = b[bi++];
+            add_count(&cell, o[oi++].count);
+        }
+        memcpy((uint8_t *)buf + n++ * sizeof(Heatmap), &cell, sizeof(cell));
+    }
+    if (n) {
+        *cursor = (uint64_t)cell.loc_id + 1;
+    }
+    return n * sizeof(Heatmap);
+}
+
+size_t heatmap_read_cells(uint64_t *cursor, void *buf, size_t len) {
+    return read_joined(base, base_count, overlay, overlay_count, cursor, buf, len);
+}
+
+// Splice the pending cells into the overlay with one pass from the top down, so each cell
+// moves at most once. Fixes may have created some of them since they were queued; those are
+// summed.
+static void merge_flush(void) {
+    write_begin();
+    size_t fresh = 0, fresh_new = 0;
+    for (size_t i = 0; i < merge.pending_count; i++) {
+        pending[i].reserved = base_find(pending[i].loc_id) != NULL;
+        size_t j = lower_bound(overlay, overlay_count, pending[i].loc_id);
+        if (j < overlay_count && overlay[j].loc_id == pending[i].loc_id) {
+            add_count(&overlay[j], pending[i].count);
+            mark_dirty(j, j + 1);
+            pending[i].count = 0;
+            merge.stats.merged++;
+        } else {
+            fresh++;
+            fresh_new += !pending[i].reserved;
+        }
+    }
+    // Keep the lowest cells that fit
+    for (size_t i = merge.pending_count; i > 0 && (fresh > HEATMAP_OVERLAY_CELLS - overlay_count ||
+         fresh_new > HEATMAP_MAX_CELLS - total_count); i--) {
+        if (pending[i - 1].count) {
+            pending[i - 1].count = 0;
+            merge.stats.dropped++;
+            fresh--;
+            fresh_new -= !pending[i - 1].reserved;
+        }
+    }
+
+    size_t src = overlay_count, dst = overlay_count + fresh, i = merge.pending_count;
+    while (i > 0) {
+        if (pending[i - 1].count == 0) {
+            i--;
+        } else if (src > 0 && overlay[src - 1].loc_id > pending[i - 1].loc_id) {
+            overlay[--dst] = overlay[--src];
+        } else {
+            overlay[--dst] = pending[--i];
+            overlay[dst].reserved = 0;
+        }
+    }
+    overlay_count += fresh;
+    total_count += fresh_new;
+    mark_dirty(dst, overlay_count);
+    merge.stats.merged += fresh - fresh_new;
+    merge.stats.added += fresh_new;
+    merge.pending_count = 0;
+    generation++;
+    write_end();
+}
+
+static bool merge_header(const heatmap_grid_header_t *hdr) {
+    merge.lat_e7 = hdr->origin_lat_e7;
+    merge.lon_e7 = hdr->origin_lon_e7;
+    return memcmp(hdr->magic, HEATMAP_GRID_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == HEATMAP_GRID_VERSION && hdr->header_size == sizeof(*hdr) &&
+        hdr->cell_e7 == HEATMAP_CELL_E7;
+}
+
+// Line their grid up with ours once they have a cell; a unit without fixes has no origin
+static bool merge_shift(void) {
+    if (!have_origin) {
+        origin_lat_e7 = merge.lat_e7;
+        origin_lon_e7 = merge.lon_e7;
+        have_origin = true;
+    }
+    // Origins sit on cell corners, so the grids differ by whole cells
+    int64_t dlat = (int64_t)merge.lat_e7 - origin_lat_e7;
+    int64_t dlon = (int64_t)merge.lon_e7 - origin_lon_e7;
+    if (dlat % HEATMAP_CELL_E7 || dlon % HEATMAP_CELL_E7) {
+        return false;
+    }
+    merge.drow = dlat / HEATMAP_CELL_E7;
+    merge.dcol = dlon / HEATMAP_CELL_E7;
+    return true;
+}
+
+static size_t overlay_free(void) {
+    return overlay_count < HEATMAP_OVERLAY_CELLS ? HEATMAP_OVERLAY_CELLS - overlay_count : 0;
+}
+
+// One of their cells; *next is where the join has got to in the overlay. Sets merge.waiting,
+// and leaves the cell alone, if there is no overlay slot to keep for it.
+static bool merge_cell(const Heatmap *cell, size_t *next) {
+    // Every pending cell has a free overlay slot kept for it, so none is dropped for want of
+    // one when they are spliced in (unless fixes take the slots first)
+    if (!merge.drop_excess && merge.pending_count >= overlay_free()) {
+        if (merge.pending_count) {
+            merge_flush();
+            *next = lower_bound(overlay, overlay_count, merge.resume);
+        }
+        if (overlay_free() == 0) {
+            merge.waiting = true;
+            return true;
+        }
+    }
+    if ((int64_t)cell->loc_id <= merge.last || (merge.last < 0 && !merge_shift())) {
+        return false;
+    }
+    merge.last = cell->loc_id;
+    int32_t row = (int32_t)(cell->loc_id >> 16) - HEATMAP_INDEX_BIAS + merge.drow;
+    int32_t col = (int32_t)(cell->loc_id & 0xffff) - HEATMAP_INDEX_BIAS + merge.dcol;
+    // Shifting every cell by the same rows and columns keeps them in loc_id order
+    uint32_t loc_id;
+    if (!grid_loc(row, col, &loc_id)) {
+        merge.stats.dropped++;
+        return true;
+    }
+    if (cell->count == 0) {
+        return true;
+    }
+    merge.resume = loc_id;
+    while (*next < overlay_count && overlay[*next].loc_id < loc_id) {
+        (*next)++;
+    }
+    if (*next < overlay_count && overlay[*next].loc_id == loc_id) {
+        write_begin();
+        add_count(&overlay[*next], cell->count);
+        mark_dirty(*next, *next + 1);
+        generation++;
+        write_end();
+        merge.stats.merged++;
+        return true;
+    }
+    if (merge.pending_count == HEATMAP_MERGE_PENDING) {
+        merge_flush();
+        *next = lower_bound(overlay, overlay_count, loc_id);
+    }
+    pending[merge.pending_count].loc_id = loc_id;
+    pending[merge.pending_count].count = cell->count;
+    merge.pending_count++;
+    return true;
+}
+
+bool heatmap_merge_begin(const void *owner) {
+    if (merge.owner && merge.owner != owner) {
+        return false;
+    }
+    memset(&merge, 0, sizeof(merge));
+    merge.last = -1;
+    merge.owner = owner;
+    return true;
+}
+
+bool heatmap_merge_feed(const void *owner, const void *data, size_t len, size_t *taken) {
+    *taken = 0;
+    if (merge.owner != owner || merge.failed) {
+        return false;
+    }
+    // Fixes and compactions may have moved the overlay since the last piece
+    size_t next = lower_bound(overlay, overlay_count, merge.resume);
+    const uint8_t *in = data;
+    merge.waiting = false;
+    while (!merge.failed) {
+        // A cell left staged while waiting for room goes first
+        size_t need = merge.header_done ? sizeof(Heatmap) : sizeof(heatmap_grid_header_t);
+        if (merge.staged < need) {
+            if (len == 0) {
+                break;
+            }
+            size_t take = need - merge.staged < len ? need - merge.staged : len;
+            memcpy(merge.stage + merge.staged, in, take);
+            merge.staged += take;
+            in += take;
+            len -= take;
+            *taken += take;
+            if (merge.staged < need) {
+                break;
+            }
+        }
+        if (!merge.header_done) {
+            heatmap_grid_header_t hdr;
+            memcpy(&hdr, merge.stage, sizeof(hdr));
+            merge.failed = !merge_header(&hdr);
+            merge.header_done = true;
+        } else {
+            Heatmap cell;
+            memcpy(&cell, merge.stage, sizeof(cell));
+            merge.failed = !merge_cell(&cell, &next);
+            if (merge.waiting) {
+                break;
+            }
+        }
+        merge.staged = 0;
+    }
+    return !merge.failed;
+}
+
+bool heatmap_merge_waiting(const void *owner) {
+    return merge.owner == owner && merge.waiting;
+}
+
+void heatmap_merge_drop_excess(const void *owner) {
+    if (merge.owner == owner) {
+        merge.drop_excess = true;
+    }
+}
+
+bool heatmap_merge_end(const void *owner, heatmap_merge_stats_t *stats) {
+    if (merge.owner != owner) {
+        return false;
+    }
+    if (merge.pending_count) {
+        merge_flush();
+    }
+    if (stats) {
+        *stats = merge.stats;
+    }
+    merge.owner = NULL;
+    return merge.header_done && merge.staged == 0 && !merge.failed;
+}
+
+// Bring the view up to date with the cells. Only changed overlay blocks are copied; a copy
+// that a writer on the other core overlapped is taken again.
+static void view_publish(void) {
+    for (;;) {
+        uint32_t start = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+        if (start & 1) {
+            view_stats.retries++;
+            continue;
+        }
+        uint32_t taken[DIRTY_WORDS];
+        for (size_t w = 0; w < DIRTY_WORDS; w++) {
+            taken[w] = __atomic_exchange_n(&dirty[w], 0, __ATOMIC_ACQUIRE);
+        }
+        uint32_t copied = 0;
+        for (size_t b = 0; b < VIEW_BLOCKS; b++) {
+            if (taken[b / 32] & 1u << (b % 32)) {
+                size_t first = b * HEATMAP_VIEW_BLOCK;
+                size_t n = HEATMAP_OVERLAY_CELLS - first < HEATMAP_VIEW_BLOCK ? HEATMAP_OVERLAY_CELLS - first : HEATMAP_VIEW_BLOCK;
+                memcpy(&view_overlay[first], &overlay[first], n * sizeof(overlay[0]));
+                copied++;
+            }
+        }
+        view_base = base;
+        view_base_count = base_count;
+        view_count = overlay_count;
+        view_total = total_count;
+        view_generation = generation;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seq, __ATOMIC_RELAXED) == start) {
+            view_stats.publishes++;
+            view_stats.blocks_copied += copied;
+            return;
+        }
+        for (size_t w = 0; w < DIRTY_WORDS; w++) {
+            __atomic_fetch_or(&dirty[w], taken[w], __ATOMIC_RELAXED);
+        }
+        view_stats.retries++;
+    }
+}
+
+void heatmap_view_begin(heatmap_view_t *view) {
+    if (view->pinned) {
+        return;
+    }
+    // The copy can only move while nobody is reading it
+    bool behind = view_generation != generation || view_base != base;
+    if (view_readers == 0 && behind) {
+        view_publish();
+    } else if (behind) {
+        view_stats.stale++;
+    }
+    view_readers++;
+    view_stats.views++;
+    view->version = view_generation;
+    view->pinned = true;
+}
+
+void heatmap_view_end(heatmap_view_t *view) {
+    if (view->pinned) {
+        view->pinned = false;
+        view_readers--;
+    }
+}
+
+size_t heatmap_view_size(const heatmap_view_t *view) {
+    return view->pinned ? view_total : 0;
+}
+
+size_t heatmap_view_read(const heatmap_view_t *view, uint64_t *cursor, void *buf, size_t len) {
+    if (!view->pinned) {
+        return 0;
+    }
+    return read_joined(view_base, view_base_count, view_overlay, view_count, cursor, buf, len);
+}
+
+const heatmap_view_stats_t *heatmap_view_get_stats(void) {
+    return &view_stats;
+}
+
+bool heatmap_compact_begin(heatmap_compact_t *compact) {
+    heatmap_view_begin(&compact->view);
+    // Another reader may still hold a view over an older base, whose storage the new
+    // snapshot could be about to reuse
+    if (view_base != base || view_count == 0) {
+        heatmap_view_end(&compact->view);
+        return false;
+    }
+    compact->cursor = 0;
+    return true;
+}
+
+size_t heatmap_compact_read(heatmap_compact_t *compact, void *buf, size_t len) {
+    return heatmap_view_read(&compact->view, &compact->cursor, buf, len);
+}
+
+void heatmap_compact_commit(heatmap_compact_t *compact, const Heatmap *cells, size_t n) {
+    if (!compact->view.pinned) {
+        return;
+    }
+    // The new base holds the view; take what it showed out of the overlay, keeping the
+    // visits since
+    write_begin();
+    base = cells;
+    base_count = n;
+    size_t kept = 0, vi = 0;
+    for (size_t i = 0; i < overlay_count; i++) {
+        Heatmap cell = overlay[i];
+        while (vi < view_count && view_overlay[vi].loc_id < cell.loc_id) {
+            vi++;
+        }
+        if (vi < view_count && view_overlay[vi].loc_id == cell.loc_id) {
+            cell.count -= view_overlay[vi].count < cell.count ? view_overlay[vi].count : cell.count;
+        }
+        if (cell.count) {
+            overlay[kept++] = cell;
+        }
+    }
+    mark_dirty(0, overlay_count);
+    overlay_count = kept;
+    write_end();
+    heatmap_view_end(&compact->view);
+}
+
+void heatmap_compact_abort(heatmap_compact_t *compact) {
+    heatmap_view_end(&compact->view);
+}
+
+bool heatmap_origin(int32_t *lat_e7, int32_t *lon_e7) {
+    *lat_e7 = origin_lat_e7;
+    *lon_e7 = origin_lon_e7;
+    return have_origin;
+}
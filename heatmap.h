@@ -0,0 +1,168 @@
+#ifndef _HEATMAP_H_
+#define _HEATMAP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Maximum number of occupied cells
+#ifndef HEATMAP_MAX_CELLS
+#define HEATMAP_MAX_CELLS 4096
+#endif
+
+// Cells visited since the last snapshot that RAM can hold; the snapshot itself is read in
+// place and costs no RAM
+#ifndef HEATMAP_OVERLAY_CELLS
+#define HEATMAP_OVERLAY_CELLS 1024
+#endif
+
+// Cell edge in 1e-7 degrees (~22 m of latitude). With a power of two, such as 2048, finding
+// a fix's cell is a shift and snapping to a cell corner a mask, rather than divisions.
+#ifndef HEATMAP_CELL_E7
+#define HEATMAP_CELL_E7 2000
+#endif
+
+_Static_assert(HEATMAP_CELL_E7 > 0 && HEATMAP_CELL_E7 <= 0x1000000, "HEATMAP_CELL_E7 out of range");
+
+// Cell indices are 16 bit, centred on the origin
+#define HEATMAP_INDEX_BIAS 0x8000
+
+// The grid spans 2^HEATMAP_GRID_BITS cells each way, centred on the origin (16, the most,
+// is ~1450 km at the default cell size); fixes and merged cells beyond it are dropped
+#ifndef HEATMAP_GRID_BITS
+#define HEATMAP_GRID_BITS 16
+#endif
+
+_Static_assert(HEATMAP_GRID_BITS >= 1 && HEATMAP_GRID_BITS <= 16, "HEATMAP_GRID_BITS must be 1 to 16");
+
+// One occupied cell; loc_id packs the row (high half) and column (low half).
+// The in-memory layout is also the little-endian wire format of /api/grid.bin.
+typedef struct {
+    uint32_t loc_id;
+    uint16_t count;
+    uint16_t reserved;
+} Heatmap;
+
+_Static_assert(sizeof(Heatmap) == 8, "Heatmap cells must pack to 8 bytes");
+
+#define HEATMAP_GRID_MAGIC "HMAP"
+#define HEATMAP_GRID_VERSION 1
+
+// Header of the binary grid dump, followed by the cells in loc_id order
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    int32_t origin_lat_e7;
+    int32_t origin_lon_e7;
+    uint32_t cell_e7;
+    uint32_t generation;    // bumped on every change, lets clients skip refetching
+} heatmap_grid_header_t;
+
+_Static_assert(sizeof(heatmap_grid_header_t) == 24, "grid header must pack to 24 bytes");
+
+void heatmap_init(void);
+
+// Take cells restored from a snapshot as the base the overlay counts on from. They are read
+// where they are, so must stay put and unchanged; call before the first fix.
+void heatmap_set_base(const Heatmap *cells, size_t n, int32_t origin_lat_e7, int32_t origin_lon_e7);
+
+// Count a visit to the cell containing the position. Returns the updated cell, valid until
+// the next call, or NULL if the position is off the grid or the table or overlay is full.
+const Heatmap *heatmap_add(int32_t lat_e7, int32_t lon_e7);
+
+size_t heatmap_size(void);
+size_t heatmap_overlay_size(void);
+
+uint32_t heatmap_generation(void);
+void heatmap_grid_header(heatmap_grid_header_t *hdr);
+
+// Copy whole cells with loc_id >= *cursor into buf and advance the cursor past them.
+// Returns the bytes copied; 0 once there are no more cells.
+size_t heatmap_read_cells(uint64_t *cursor, void *buf, size_t len);
+
+// Cells per block the reader view copies overlay changes in
+#ifndef HEATMAP_VIEW_BLOCK
+#define HEATMAP_VIEW_BLOCK 64
+#endif
+
+// A stable copy of the cells for readers that span several callbacks, such as a streamed
+// dump or a render. Writers only note which overlay blocks they change; the copy catches up
+// when a view is taken and nobody is reading the old one, so ingest never waits on a reader
+// but a reader may be handed a version that is a little behind. The base is shared.
+typedef struct {
+    uint32_t version;       // generation the view shows
+    bool pinned;
+} heatmap_view_t;
+
+typedef struct {
+    uint32_t views;
+    uint32_t stale;         // views handed an older version because another reader held it
+    uint32_t publishes;     // times the copy caught up
+    uint32_t blocks_copied;
+    uint32_t retries;       // copies taken again because a write overlapped them
+} heatmap_view_stats_t;
+
+// Views start zeroed; ending one twice, or one never begun, does nothing
+void heatmap_view_begin(heatmap_view_t *view);
+void heatmap_view_end(heatmap_view_t *view);
+
+// As heatmap_size() and heatmap_read_cells(), as of view->version
+size_t heatmap_view_size(const heatmap_view_t *view);
+size_t heatmap_view_read(const heatmap_view_t *view, uint64_t *cursor, void *buf, size_t len);
+
+const heatmap_view_stats_t *heatmap_view_get_stats(void);
+
+// Folding the overlay into a new base: read the cells out through a view, write them
+// somewhere that stays put, then commit them as the base. Visits made meanwhile stay in the
+// overlay. Begin is false if there is nothing to fold in, or a reader still holds a view
+// over an older base.
+typedef struct {
+    heatmap_view_t view;
+    uint64_t cursor;
+} heatmap_compact_t;
+
+bool heatmap_compact_begin(heatmap_compact_t *compact);
+size_t heatmap_compact_read(heatmap_compact_t *compact, void *buf, size_t len);
+void heatmap_compact_commit(heatmap_compact_t *compact, const Heatmap *cells, size_t n);
+void heatmap_compact_abort(heatmap_compact_t *compact);
+
+// Pending new cells held by a merge before they are spliced into the overlay in one pass
+#ifndef HEATMAP_MERGE_PENDING
+#define HEATMAP_MERGE_PENDING 128
+#endif
+
+typedef struct {
+    uint32_t merged;        // summed into a cell that was already here
+    uint32_t added;         // new cells
+    uint32_t dropped;       // off this grid, or no room left in the table
+} heatmap_merge_stats_t;
+
+// Sum another unit's grid dump (as served by /api/grid.bin) into the cells, fed in pieces of
+// any size as it arrives. Both dumps are sorted by loc_id, so it is a merge join; memory is
+// fixed whatever the dump size. One merge runs at a time: begin is false if another owner has
+// it. An empty table adopts the dump's origin; otherwise its cells are shifted onto ours.
+bool heatmap_merge_begin(const void *owner);
+
+// False once the data is not a valid dump (wrong magic, version or cell size, or cells out
+// of order); nothing more is merged after that. New cells need a free overlay slot each, so
+// when the overlay fills the merge waits for a compaction to empty it: *taken then falls short
+// of len, or heatmap_merge_waiting() is true with all of it taken, and the rest is fed again
+// later (an empty piece just retries).
+bool heatmap_merge_feed(const void *owner, const void *data, size_t len, size_t *taken);
+
+// The last feed stopped for want of room in the overlay
+bool heatmap_merge_waiting(const void *owner);
+
+// Stop waiting for room, e.g. when no compaction is coming: new cells that do not fit are
+// dropped from now on
+void heatmap_merge_drop_excess(const void *owner);
+
+// Apply any pending cells and release the merge. True if everything fed was a whole, valid
+// dump. Cells merged before an error or an early end stay merged. stats may be NULL.
+bool heatmap_merge_end(const void *owner, heatmap_merge_stats_t *stats);
+
+// South-west corner of the origin cell (row and column HEATMAP_INDEX_BIAS); false until the first fix
+bool heatmap_origin(int32_t *lat_e7, int32_t *lon_e7);
+
+#endif
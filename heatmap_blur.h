@@ -0,0 +1,93 @@
+#ifndef _HEATMAP_BLUR_H_
+#define _HEATMAP_BLUR_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "heatmap_render.h"
+
+// The horizontal blur pass of heatmap_render.c and its splat, in plain C and for the M33's DSP
+// extension, which multiplies and accumulates two signed halfwords at once (SMLAD) and
+// saturates in one instruction (SSAT). Both must give the same bytes; the host test
+// test_blur builds the two side by side with plain-C stand-ins for the intrinsics.
+
+#ifndef HEATMAP_BLUR_DSP
+#if defined(__ARM_FEATURE_DSP)
+#define HEATMAP_BLUR_DSP 1
+#else
+#define HEATMAP_BLUR_DSP 0
+#endif
+#endif
+
+#if HEATMAP_BLUR_DSP
+#include <arm_acle.h>
+#endif
+
+// Gaussian with sigma = radius / 2, weights in Q8 from the centre out
+static const uint16_t blur_kernel[HEATMAP_RENDER_RADIUS + 1] = { 256, 205, 105, 35 };
+
+// Splatted counts are capped at 15 bits so they multiply as signed halfwords; a blurred
+// value then stays below 2^31 however the kernel is weighted
+#define SPLAT_MAX INT16_MAX
+
+static inline int16_t splat_add_scalar(int16_t s, uint16_t count) {
+    return s + count > SPLAT_MAX ? SPLAT_MAX : s + count;
+}
+
+// Pixel x weighs s[x - 3] to s[x + 3]; s has the radius readable on either side
+static inline void blur_h_scalar(const int16_t *s, uint32_t *dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; x++) {
+        const int16_t *c = s + x;
+        int32_t acc = c[0] * blur_kernel[0];
+        for (int j = 1; j <= HEATMAP_RENDER_RADIUS; j++) {
+            acc += (c[-j] + c[j]) * blur_kernel[j];
+        }
+        dst[x] = (uint32_t)acc >> 4;
+    }
+}
+
+#if HEATMAP_BLUR_DSP
+_Static_assert(HEATMAP_RENDER_RADIUS == 3, "the paired blur is unrolled for a radius of 3");
+_Static_assert(HEATMAP_RENDER_MAX % 2 == 0, "the paired blur writes pixels in pairs");
+
+// Two halfwords of weights, the first in the low half
+#define WEIGHTS(lo, hi) ((uint32_t)(lo) | (uint32_t)(hi) << 16)
+
+static inline uint32_t load_pair(const int16_t *p) {
+    uint32_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static inline int16_t splat_add_dsp(int16_t s, uint16_t count) {
+    return __ssat(s + count, 16);
+}
+
+// Pixels x and x + 1 together: the eight from x - 3 to x + 4 are loaded as four word-aligned
+// pairs, and each output weights all four with one SMLAD apiece. An odd width writes one
+// pixel past it, and reads one more past the radius.
+static inline void blur_h_dsp(const int16_t *s, uint32_t *dst, uint32_t width) {
+    const uint32_t k0 = blur_kernel[0], k1 = blur_kernel[1], k2 = blur_kernel[2], k3 = blur_kernel[3];
+    for (uint32_t x = 0; x < width; x += 2) {
+        const int16_t *c = s + x - HEATMAP_RENDER_RADIUS;
+        uint32_t a = load_pair(c), b = load_pair(c + 2), d = load_pair(c + 4), e = load_pair(c + 6);
+        int32_t even = __smlad(a, WEIGHTS(k3, k2), 0);
+        even = __smlad(b, WEIGHTS(k1, k0), even);
+        even = __smlad(d, WEIGHTS(k1, k2), even);
+        even = __smlad(e, WEIGHTS(k3, 0), even);
+        int32_t odd = __smlad(a, WEIGHTS(0, k3), 0);
+        odd = __smlad(b, WEIGHTS(k2, k1), odd);
+        odd = __smlad(d, WEIGHTS(k0, k1), odd);
+        odd = __smlad(e, WEIGHTS(k2, k3), odd);
+        dst[x] = (uint32_t)even >> 4;
+        dst[x + 1] = (uint32_t)odd >> 4;
+    }
+}
+
+#define splat_add splat_add_dsp
+#define blur_h blur_h_dsp
+#else
+#define splat_add splat_add_scalar
+#define blur_h blur_h_scalar
+#endif
+
+#endif
@@ -0,0 +1,569 @@
+#include "heatmap_render.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "heatmap.h"
+#include "heatmap_blur.h"
+
+#define RING_ROWS (2 * HEATMAP_RENDER_RADIUS + 1)
+
+// Normalisation table resolution; blurred values are scaled onto it before lookup
+#define NORM_STEPS 1024
+
+#define LEN_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Blurred values carry this many fraction bits: Q8 kernel squared, less 4 after the first pass
+#define DENSITY_SHIFT 12
+
+_Static_assert(HEATMAP_RENDER_MAX <= UINT16_MAX, "image size must fit in 16 bits");
+
+_Static_assert(HEATMAP_DENSITY_MAX > 4 * HEATMAP_RENDER_RADIUS, "density layer is too small to hold the blur");
+
+static const char *const density_names[HEATMAP_DENSITY_COUNT] = {
+    [HEATMAP_DENSITY_RENDER] = "render",
+    [HEATMAP_DENSITY_INGEST] = "ingest",
+};
+
+static const char *const norm_names[HEATMAP_NORM_COUNT] = {
+    [HEATMAP_NORM_LINEAR] = "linear",
+    [HEATMAP_NORM_SQRT] = "sqrt",
+    [HEATMAP_NORM_LOG] = "log",
+};
+
+static struct {
+    const void *owner;
+    uint16_t width;
+    uint16_t height;
+    uint16_t next;              // next row to render
+    uint32_t scale;             // cells per pixel along each edge
+    uint32_t row0;              // grid row and column of pixel (0, 0)
+    uint32_t col0;
+    uint32_t recip;             // blurred value to NORM_STEPS, Q32
+    heatmap_norm_t norm;        // mode the table below was built for
+    bool norm_built;
+    heatmap_view_t view;        // the cells being drawn, held still for the whole image
+    bool from_layer;            // rows are read straight out of the density layer
+    uint16_t lx0;               // layer pixel of image pixel (0, 0)
+    uint16_t ly0;
+} render;
+
+typedef enum {
+    LAYER_STALE,
+    LAYER_BUILDING,
+    LAYER_READY
+} layer_state_t;
+
+static heatmap_density_t density_mode;
+
+// Pre-blurred density in the same Q12 units as the render path's vertical pass
+static struct {
+    layer_state_t state;
+    uint32_t scale;             // cells per pixel along each edge
+    uint32_t row0;              // grid row and column of pixel (0, 0)
+    uint32_t col0;
+    uint64_t cursor;            // rebuild position, a heatmap_read_cells() cursor
+} layer;
+// HEATMAP_DENSITY_MAX^2 * 4 bytes, reserved in every density mode; see heatmap_render.h
+static uint32_t density[HEATMAP_DENSITY_MAX][HEATMAP_DENSITY_MAX];
+
+// Visits that arrived while a render was reading the layer, spread once it has finished so
+// the image is the layer as it stood at heatmap_render_begin(). More than this and the layer
+// is rebuilt instead.
+#define DENSITY_QUEUE 64
+static uint32_t density_queue[DENSITY_QUEUE];
+static uint32_t density_queued;
+
+// Splatted counts, with a zero border so the horizontal pass needs no edge tests, and one
+// more zero for the pass to read pixels in pairs
+static int16_t splat[HEATMAP_RENDER_MAX + 2 * HEATMAP_RENDER_RADIUS + 1] __attribute__((aligned(4)));
+// Horizontally blurred rows; pixel row p lives in slot p % RING_ROWS
+static uint32_t ring[RING_ROWS][HEATMAP_RENDER_MAX];
+static uint8_t out_row[HEATMAP_RENDER_MAX];
+
+static uint8_t norm_lut[NORM_STEPS];
+static heatmap_render_stats_t stats;
+static uint32_t palette[256];
+static bool palette_built;
+
+heatmap_norm_t heatmap_norm_from_name(const char *name, size_t len) {
+    for (int i = 0; i < HEATMAP_NORM_COUNT; i++) {
+        if (strlen(norm_names[i]) == len && strncmp(norm_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return HEATMAP_NORM_COUNT;
+}
+
+static uint32_t isqrt32(uint32_t v) {
+    uint32_t r = 0;
+    uint32_t bit = (uint32_t)1 << 30;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+// log2(x) in Q16 for x >= 1, by repeated squaring of the mantissa
+static uint32_t log2_q16(uint32_t x) {
+    uint32_t ip = 31 - __builtin_clz(x);
+    uint64_t y = ((uint64_t)x << 16) >> ip;
+    uint32_t frac = 0;
+    for (int bit = 15; bit >= 0; bit--) {
+        y = y * y >> 16;
+        if (y >= (2 << 16)) {
+            y >>= 1;
+            frac |= 1u << bit;
+        }
+    }
+    return ip << 16 | frac;
+}
+
+static void build_norm(heatmap_norm_t norm) {
+    // log maps 1 + 255x, so the faintest cells still show but the peak does not wash out
+    uint32_t log_base = log2_q16(NORM_STEPS - 1);
+    uint32_t log_span = log2_q16((NORM_STEPS - 1) * 256) - log_base;
+    for (uint32_t i = 0; i < NORM_STEPS; i++) {
+        uint32_t v;
+        switch (norm) {
+            case HEATMAP_NORM_SQRT:
+                v = isqrt32(i * 255 * 255 / (NORM_STEPS - 1));
+                break;
+            case HEATMAP_NORM_LOG:
+                v = (uint64_t)(log2_q16(NORM_STEPS - 1 + i * 255) - log_base) * 255 / log_span;
+                break;
+            default:
+                v = i * 255 / (NORM_STEPS - 1);
+                break;
+        }
+        // Anything at all must stay visible against empty ground
+        norm_lut[i] = i && v == 0 ? 1 : v;
+    }
+    render.norm = norm;
+    render.norm_built = true;
+}
+
+// The browser's ramp: transparent through blue, red and yellow to white, flattened onto black
+static void build_palette(void) {
+    for (int32_t i = 0; i < 256; i++) {
+        int32_t t512 = i * 512 / 255;
+        int32_t r = t512 > 255 ? 255 : t512;
+        int32_t g = t512 - 128 < 0 ? 0 : t512 - 128 > 255 ? 255 : t512 - 128;
+        int32_t quarter = t512 - 128 < 0 ? 128 - t512 : t512 - 128;
+        int32_t b = (255 - quarter < 0 ? 0 : 255 - quarter) + (i * 1020 / 255 - 765 < 0 ? 0 : i * 1020 / 255 - 765);
+        int32_t a = i * 768 / 255 > 255 ? 255 : i * 768 / 255;
+        b = b > 255 ? 255 : b;
+        palette[i] = (uint32_t)(r * a / 255) << 16 | (uint32_t)(g * a / 255) << 8 | (uint32_t)(b * a / 255);
+    }
+    palette_built = true;
+}
+
+const uint32_t *heatmap_render_palette(void) {
+    if (!palette_built) {
+        build_palette();
+    }
+    return palette;
+}
+
+// Cells are read out a few at a time, from a view or the live table
+#define READ_CELLS 32
+
+typedef size_t (*cell_reader_t)(const heatmap_view_t *view, uint64_t *cursor, void *buf, size_t len);
+
+typedef struct {
+    uint32_t row_min, row_max;
+    uint32_t col_min, col_max;
+    uint32_t count_max;
+} extent_t;
+
+static size_t read_live(const heatmap_view_t *view, uint64_t *cursor, void *buf, size_t len) {
+    (void)view;
+    return heatmap_read_cells(cursor, buf, len);
+}
+
+// Bounding box and busiest count of the cells; false if there are none. Cells are sorted by
+// row, so only the columns need comparing.
+static bool cells_extent(cell_reader_t read, const heatmap_view_t *view, extent_t *e) {
+    Heatmap cells[READ_CELLS];
+    uint64_t cursor = 0;
+    size_t n;
+    bool any = false;
+    e->col_min = UINT16_MAX;
+    e->col_max = 0;
+    e->count_max = 1;
+    while ((n = read(view, &cursor, cells, sizeof(cells)) / sizeof(cells[0])) > 0) {
+        if (!any) {
+            e->row_min = cells[0].loc_id >> 16;
+            any = true;
+        }
+        e->row_max = cells[n - 1].loc_id >> 16;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t col = cells[i].loc_id & 0xffff;
+            e->col_min = col < e->col_min ? col : e->col_min;
+            e->col_max = col > e->col_max ? col : e->col_max;
+            e->count_max = cells[i].count > e->count_max ? cells[i].count : e->count_max;
+        }
+    }
+    return any;
+}
+
+// Whether the layer holds the whole blur of every cell in e. A ready layer always should;
+// one that missed an invalidation is drawn around instead of read out of bounds.
+static bool layer_covers(const extent_t *e) {
+    uint32_t inner = HEATMAP_DENSITY_MAX - 2 * HEATMAP_RENDER_RADIUS;
+    return (e->row_min - layer.row0) / layer.scale - HEATMAP_RENDER_RADIUS < inner &&
+        (e->row_max - layer.row0) / layer.scale - HEATMAP_RENDER_RADIUS < inner &&
+        (e->col_min - layer.col0) / layer.scale - HEATMAP_RENDER_RADIUS < inner &&
+        (e->col_max - layer.col0) / layer.scale - HEATMAP_RENDER_RADIUS < inner;
+}
+
+bool heatmap_render_begin(const void *owner, heatmap_norm_t norm) {
+    if (render.owner && render.owner != owner) {
+        return false;
+    }
+    // Fixes keep arriving between rows; draw the cells as they were at the start
+    heatmap_view_end(&render.view);
+    heatmap_view_begin(&render.view);
+
+    // An empty map is drawn as a blank margin
+    extent_t e = { 0 };
+    bool any = cells_extent(heatmap_view_read, &render.view, &e);
+    if (!any) {
+        e.col_min = 0;
+    }
+    uint32_t row_min = e.row_min, row_max = e.row_max, col_min = e.col_min, col_max = e.col_max;
+    uint32_t count_max = e.count_max;
+    render.from_layer = any && density_mode == HEATMAP_DENSITY_INGEST && layer.state == LAYER_READY &&
+        layer_covers(&e);
+    if (render.from_layer) {
+        // Every cell is in the layer's view, so the crop stays clear of its edges
+        render.scale = layer.scale;
+        render.lx0 = (col_min - layer.col0) / layer.scale - HEATMAP_RENDER_RADIUS;
+        render.ly0 = (row_min - layer.row0) / layer.scale - HEATMAP_RENDER_RADIUS;
+        render.width = (col_max - layer.col0) / layer.scale + 1 + HEATMAP_RENDER_RADIUS - render.lx0;
+        render.height = (row_max - layer.row0) / layer.scale + 1 + HEATMAP_RENDER_RADIUS - render.ly0;
+    } else {
+        uint32_t span = row_max - row_min > col_max - col_min ? row_max - row_min + 1 : col_max - col_min + 1;
+        uint32_t inner = HEATMAP_RENDER_MAX - 2 * HEATMAP_RENDER_RADIUS;
+        render.scale = (span + inner - 1) / inner;
+        render.width = (col_max - col_min) / render.scale + 1 + 2 * HEATMAP_RENDER_RADIUS;
+        render.height = (row_max - row_min) / render.scale + 1 + 2 * HEATMAP_RENDER_RADIUS;
+        // Unsigned arithmetic wraps, so a margin reaching below index 0 still maps correctly
+        render.row0 = row_min - HEATMAP_RENDER_RADIUS * render.scale;
+        render.col0 = col_min - HEATMAP_RENDER_RADIUS * render.scale;
+    }
+    render.next = 0;
+
+    // A lone busiest cell blurs to its own count at the centre; scale that to full range
+    if (!render.from_layer && count_max > SPLAT_MAX) {
+        count_max = SPLAT_MAX;
+    }
+    render.recip = ((uint64_t)(NORM_STEPS - 1) << 32) / ((uint64_t)count_max << DENSITY_SHIFT);
+
+    if (!render.norm_built || render.norm != norm) {
+        build_norm(norm);
+    }
+    if (!palette_built) {
+        build_palette();
+    }
+    // Rows north and south of the image are empty
+    memset(ring, 0, sizeof(ring));
+    render.owner = owner;
+    return true;
+}
+
+static bool layer_splat(uint32_t loc_id, uint32_t count);
+
+void heatmap_render_end(const void *owner) {
+    if (render.owner == owner) {
+        heatmap_view_end(&render.view);
+        render.owner = NULL;
+        for (uint32_t i = 0; i < density_queued && layer.state != LAYER_STALE; i++) {
+            if (!layer_splat(density_queue[i], 1)) {
+                layer.state = LAYER_STALE;
+            }
+        }
+        density_queued = 0;
+    }
+}
+
+uint16_t heatmap_render_width(void) {
+    return render.width;
+}
+
+uint16_t heatmap_render_height(void) {
+    return render.height;
+}
+
+// Splat pixel row p and blur it horizontally into its ring slot
+static void blur_row(uint32_t p) {
+    uint32_t *dst = ring[p % RING_ROWS];
+    if (p >= render.height) {
+        memset(dst, 0, render.width * sizeof(dst[0]));
+        return;
+    }
+
+    int16_t *s = splat + HEATMAP_RENDER_RADIUS;
+    memset(splat, 0, (render.width + 2 * HEATMAP_RENDER_RADIUS + 1) * sizeof(splat[0]));
+    // The grid rows of this pixel row are contiguous in loc_id order
+    uint32_t first = render.row0 + p * render.scale;
+    uint64_t end = (uint64_t)(first + render.scale) << 16;
+    uint64_t cursor = (uint64_t)first << 16;
+    Heatmap cells[READ_CELLS];
+    size_t n;
+    while (first <= 0xffff && cursor < end &&
+           (n = heatmap_view_read(&render.view, &cursor, cells, sizeof(cells)) / sizeof(cells[0])) > 0) {
+        for (size_t i = 0; i < n && cells[i].loc_id < end; i++) {
+            uint32_t x = ((cells[i].loc_id & 0xffff) - render.col0) / render.scale;
+            if (x < render.width) {
+                s[x] = splat_add(s[x], cells[i].count);
+            }
+        }
+    }
+    blur_h(s, dst, render.width);
+}
+
+static const uint8_t *row_done(uint16_t y, uint64_t start_us) {
+    stats.rows++;
+    stats.pixels += render.width;
+    stats.us += time_us_64() - start_us;
+    render.next = y + 1;
+    return out_row;
+}
+
+const uint8_t *heatmap_render_row(uint16_t y) {
+    if (!render.owner || y >= render.height) {
+        return NULL;
+    }
+    if (y + 1 == render.next) {
+        return out_row;
+    }
+    if (y != render.next) {
+        return NULL;
+    }
+
+    uint64_t start = time_us_64();
+    if (render.from_layer) {
+        const uint32_t *src = density[render.ly0 + y] + render.lx0;
+        for (uint32_t x = 0; x < render.width; x++) {
+            uint64_t step = (uint64_t)src[x] * render.recip >> 32;
+            out_row[x] = norm_lut[step >= NORM_STEPS ? NORM_STEPS - 1 : step];
+        }
+        return row_done(y, start);
+    }
+
+    if (y == 0) {
+        for (uint32_t p = 0; p < HEATMAP_RENDER_RADIUS; p++) {
+            blur_row(p);
+        }
+    }
+    blur_row(y + HEATMAP_RENDER_RADIUS);
+
+    const uint32_t *rows[RING_ROWS];
+    for (int j = 0; j < RING_ROWS; j++) {
+        rows[j] = ring[(y + j + RING_ROWS - HEATMAP_RENDER_RADIUS) % RING_ROWS];
+    }
+    for (uint32_t x = 0; x < render.width; x++) {
+        uint32_t acc = rows[HEATMAP_RENDER_RADIUS][x] * blur_kernel[0];
+        for (int j = 1; j <= HEATMAP_RENDER_RADIUS; j++) {
+            acc += (rows[HEATMAP_RENDER_RADIUS - j][x] + rows[HEATMAP_RENDER_RADIUS + j][x]) * blur_kernel[j];
+        }
+        uint64_t step = (uint64_t)acc * render.recip >> 32;
+        out_row[x] = norm_lut[step >= NORM_STEPS ? NORM_STEPS - 1 : step];
+    }
+    return row_done(y, start);
+}
+
+const heatmap_render_stats_t *heatmap_render_get_stats(void) {
+    return &stats;
+}
+
+heatmap_density_t heatmap_density_from_name(const char *name, size_t len) {
+    for (int i = 0; i < HEATMAP_DENSITY_COUNT; i++) {
+        if (strlen(density_names[i]) == len && strncmp(density_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return HEATMAP_DENSITY_COUNT;
+}
+
+void heatmap_set_density(heatmap_density_t mode) {
+    if (mode < HEATMAP_DENSITY_COUNT && mode != density_mode) {
+        density_mode = mode;
+        layer.state = LAYER_STALE;
+    }
+}
+
+heatmap_density_t heatmap_get_density(void) {
+    return density_mode;
+}
+
+void heatmap_density_invalidate(void) {
+    layer.state = LAYER_STALE;
+}
+
+bool heatmap_density_pending(void) {
+    return density_mode == HEATMAP_DENSITY_INGEST && layer.state != LAYER_READY;
+}
+
+// Add count visits to cell, blurred, to the layer; false if the blur would cross its edge
+static bool layer_splat(uint32_t loc_id, uint32_t count) {
+    uint32_t px = ((loc_id & 0xffff) - layer.col0) / layer.scale;
+    uint32_t py = ((loc_id >> 16) - layer.row0) / layer.scale;
+    if (px - HEATMAP_RENDER_RADIUS >= HEATMAP_DENSITY_MAX - 2 * HEATMAP_RENDER_RADIUS ||
+        py - HEATMAP_RENDER_RADIUS >= HEATMAP_DENSITY_MAX - 2 * HEATMAP_RENDER_RADIUS) {
+        return false;
+    }
+    for (int j = -HEATMAP_RENDER_RADIUS; j <= HEATMAP_RENDER_RADIUS; j++) {
+        uint32_t *row = density[py + j] + px;
+        uint32_t wy = count * blur_kernel[j < 0 ? -j : j];
+        for (int i = -HEATMAP_RENDER_RADIUS; i <= HEATMAP_RENDER_RADIUS; i++) {
+            uint32_t add = wy * blur_kernel[i < 0 ? -i : i] >> 4;
+            row[i] = row[i] + add < row[i] ? UINT32_MAX : row[i] + add;
+        }
+    }
+    return true;
+}
+
+void heatmap_density_add(const Heatmap *cell) {
+    if (density_mode != HEATMAP_DENSITY_INGEST || !cell || layer.state == LAYER_STALE) {
+        return;
+    }
+    // Mid-rebuild, cells the rebuild has yet to reach will be read with this visit counted
+    if (layer.state == LAYER_BUILDING && cell->loc_id >= layer.cursor) {
+        return;
+    }
+    // A render reading the layer sees it held still; the rebuild an overflow asks for waits
+    // for the render to end
+    if (render.owner && render.from_layer) {
+        if (density_queued < DENSITY_QUEUE) {
+            density_queue[density_queued++] = cell->loc_id;
+        } else {
+            layer.state = LAYER_STALE;
+        }
+        return;
+    }
+    if (!layer_splat(cell->loc_id, 1)) {
+        layer.state = LAYER_STALE;
+    }
+}
+
+// Size the layer to the cells with half their extent again as room to grow, centred
+static void layer_start(void) {
+    extent_t e;
+    if (!cells_extent(read_live, NULL, &e)) {
+        // The first fix lands in the origin cell
+        e.row_min = e.row_max = e.col_min = e.col_max = HEATMAP_INDEX_BIAS;
+    }
+    uint32_t row_min = e.row_min, row_max = e.row_max, col_min = e.col_min, col_max = e.col_max;
+    uint32_t span = row_max - row_min > col_max - col_min ? row_max - row_min + 1 : col_max - col_min + 1;
+    span += span / 2;
+    uint32_t inner = HEATMAP_DENSITY_MAX - 2 * HEATMAP_RENDER_RADIUS;
+    layer.scale = (span + inner - 1) / inner;
+    layer.row0 = (row_min + row_max) / 2 - HEATMAP_DENSITY_MAX / 2 * layer.scale;
+    layer.col0 = (col_min + col_max) / 2 - HEATMAP_DENSITY_MAX / 2 * layer.scale;
+    layer.cursor = 0;
+    memset(density, 0, sizeof(density));
+    layer.state = LAYER_BUILDING;
+}
+
+bool heatmap_density_step(void) {
+    if (!heatmap_density_pending()) {
+        return false;
+    }
+    if (layer.state == LAYER_STALE) {
+        // A render reading the layer has it until it finishes
+        if (render.owner && render.from_layer) {
+            return false;
+        }
+        layer_start();
+    }
+    Heatmap cells[HEATMAP_DENSITY_STEP];
+    size_t n = heatmap_read_cells(&layer.cursor, cells, sizeof(cells)) / sizeof(cells[0]);
+    for (size_t i = 0; i < n; i++) {
+        if (!layer_splat(cells[i].loc_id, cells[i].count)) {
+            // Only cells added since the rebuild began can be out of view
+            layer.state = LAYER_STALE;
+            return true;
+        }
+    }
+    if (n == 0) {
+        layer.state = LAYER_READY;
+    }
+    return layer.state != LAYER_READY;
+}
+
+static inline void put_le(uint8_t *p, uint32_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = v >> (8 * i);
+    }
+}
+
+static uint32_t bmp_stride(void) {
+    return (render.width + 3u) & ~3u;
+}
+
+uint32_t heatmap_render_bmp_size(void) {
+    return HEATMAP_BMP_HEADER + bmp_stride() * render.height;
+}
+
+// BITMAPFILEHEADER and BITMAPINFOHEADER for a bottom-up 8-bit image, which matches the
+// south to north row order
+static void bmp_headers(uint8_t *h) {
+    memset(h, 0, 54);
+    h[0] = 'B';
+    h[1] = 'M';
+    put_le(h + 2, heatmap_render_bmp_size(), 4);
+    put_le(h + 10, HEATMAP_BMP_HEADER, 4);
+    put_le(h + 14, 40, 4);
+    put_le(h + 18, render.width, 4);
+    put_le(h + 22, render.height, 4);
+    put_le(h + 26, 1, 2);                   // planes
+    put_le(h + 28, 8, 2);                   // bits per pixel
+    put_le(h + 34, bmp_stride() * render.height, 4);
+    put_le(h + 38, 2835, 4);                // 72 dpi
+    put_le(h + 42, 2835, 4);
+    put_le(h + 46, 256, 4);                 // palette entries
+}
+
+size_t heatmap_render_bmp_read(uint32_t *pos, uint8_t *buf, size_t len) {
+    size_t used = 0;
+    if (*pos < 54) {
+        uint8_t h[54];
+        bmp_headers(h);
+        used = LEN_MIN(54 - *pos, len);
+        memcpy(buf, h + *pos, used);
+    }
+    // Palette entries are B, G, R, 0: 0x00RRGGBB little endian. Pieces always end on an
+    // entry boundary here, since the headers are only split when len is short of them.
+    while (*pos + used >= 54 && *pos + used < HEATMAP_BMP_HEADER && used + 4 <= len) {
+        put_le(buf + used, palette[(*pos + used - 54) / 4], 4);
+        used += 4;
+    }
+    if (*pos + used < HEATMAP_BMP_HEADER) {
+        *pos += used;
+        return used;
+    }
+
+    // At most one image row per call, so a retried piece never needs a row already passed
+    uint32_t offset = *pos + used - HEATMAP_BMP_HEADER;
+    uint32_t y = offset / bmp_stride();
+    uint32_t x = offset % bmp_stride();
+    const uint8_t *row = y < render.height ? heatmap_render_row(y) : NULL;
+    if (row) {
+        size_t n = LEN_MIN(bmp_stride() - x, len - used);
+        size_t pixels = x < render.width ? LEN_MIN(render.width - x, n) : 0;
+        memcpy(buf + used, row + x, pixels);
+        memset(buf + used + pixels, 0, n - pixels);
+        used += n;
+    }
+    *pos += used;
+    return used;
+}
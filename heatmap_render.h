@@ -0,0 +1,106 @@
+#ifndef _HEATMAP_RENDER_H_
+#define _HEATMAP_RENDER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "heatmap.h"
+
+// Renders the heatmap to 8-bit palette indices a row at a time, south to north: cell
+// counts are splatted onto pixels, blurred with a separable integer Gaussian, normalised
+// through a lookup table and mapped onto a 256-entry colour ramp. Memory is a few rows of
+// the output whatever the grid size, so one render runs at a time.
+
+// Longest image edge in pixels; larger grids are drawn several cells to a pixel
+#ifndef HEATMAP_RENDER_MAX
+#define HEATMAP_RENDER_MAX 256
+#endif
+
+// Blur radius in pixels, which is also the empty margin around the cells
+#define HEATMAP_RENDER_RADIUS 3
+
+typedef enum {
+    HEATMAP_NORM_LINEAR,
+    HEATMAP_NORM_SQRT,
+    HEATMAP_NORM_LOG,
+    HEATMAP_NORM_COUNT
+} heatmap_norm_t;
+
+heatmap_norm_t heatmap_norm_from_name(const char *name, size_t len);
+
+// Claim the renderer for owner and size the image to the current cells. False if another
+// owner has it.
+bool heatmap_render_begin(const void *owner, heatmap_norm_t norm);
+
+// Release the renderer if owner holds it
+void heatmap_render_end(const void *owner);
+
+uint16_t heatmap_render_width(void);
+uint16_t heatmap_render_height(void);
+
+// Where the kernel-density spread is paid for. RENDER splats and blurs the cells on every
+// render; INGEST keeps a pre-blurred layer up to date as fixes arrive, so a render is only
+// a table lookup per pixel, at the layer's coarser resolution.
+typedef enum {
+    HEATMAP_DENSITY_RENDER,
+    HEATMAP_DENSITY_INGEST,
+    HEATMAP_DENSITY_COUNT
+} heatmap_density_t;
+
+// Edge of the pre-blurred layer in pixels. It costs 4 bytes a pixel in static RAM, 64 KB of
+// the RP2350's 520 KB at the default, whether or not INGEST is ever chosen; a build that
+// never uses it can set a smaller edge, down to the blur's 4 * HEATMAP_RENDER_RADIUS + 1.
+#ifndef HEATMAP_DENSITY_MAX
+#define HEATMAP_DENSITY_MAX 128
+#endif
+
+// Cells splatted per heatmap_density_step() while the layer is rebuilt
+#ifndef HEATMAP_DENSITY_STEP
+#define HEATMAP_DENSITY_STEP 64
+#endif
+
+heatmap_density_t heatmap_density_from_name(const char *name, size_t len);
+
+// Switching to INGEST leaves the layer to be rebuilt by heatmap_density_step(); renders
+// fall back to the RENDER path until it is ready
+void heatmap_set_density(heatmap_density_t mode);
+heatmap_density_t heatmap_get_density(void);
+
+// Spread one more visit to cell, as just returned by heatmap_add(). A cell outside the
+// layer's extent marks the layer for a rebuild around the new extent. While a render reads
+// the layer, visits are held back until heatmap_render_end().
+void heatmap_density_add(const Heatmap *cell);
+
+// Drop the layer, e.g. after the cells were changed other than by heatmap_add()
+void heatmap_density_invalidate(void);
+
+// Do a slice of a pending rebuild; true while more work remains
+bool heatmap_density_step(void);
+bool heatmap_density_pending(void);
+
+// Palette index row y, 0 being the southern edge. Rows come in order, but the last one
+// may be asked for again; anything else gives NULL.
+const uint8_t *heatmap_render_row(uint16_t y);
+
+// Rows drawn since boot and the time they took, blur and lookups included
+typedef struct {
+    uint32_t rows;
+    uint64_t pixels;
+    uint64_t us;
+} heatmap_render_stats_t;
+
+const heatmap_render_stats_t *heatmap_render_get_stats(void);
+
+// 0x00RRGGBB, premultiplied onto black; index 0 is empty ground
+const uint32_t *heatmap_render_palette(void);
+
+// The image as an 8-bit BMP: headers and palette, then the rows
+#define HEATMAP_BMP_HEADER (54 + 256 * 4)
+
+uint32_t heatmap_render_bmp_size(void);
+
+// Copy the file from byte *pos on into buf and advance *pos. Returns 0 at the end of the
+// file, or if the renderer cannot go back to the row *pos is in.
+size_t heatmap_render_bmp_read(uint32_t *pos, uint8_t *buf, size_t len);
+
+#endif
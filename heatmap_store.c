@@ -0,0 +1,194 @@
+#include "heatmap_store.h"
+#include <string.h>
+#include "pico/stdlib.h"
+
+#define SNAPSHOT_MAGIC "HSNP"
+#define SNAPSHOT_VERSION 1
+
+// Last block of a slot; the cells fill the slot from its start, so the base can be read in
+// place. The header is blanked before a slot is rewritten and written last, so a slot whose
+// write was cut short has none.
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t sequence;      // the newer slot has the higher one
+    int32_t origin_lat_e7;
+    int32_t origin_lon_e7;
+    uint32_t cell_e7;
+    uint32_t count;
+} snapshot_header_t;
+
+_Static_assert(sizeof(snapshot_header_t) <= 256, "snapshot header must fit in the smallest block");
+
+static block_store_t *store;
+static const uint8_t *mapped;
+static uint32_t slot_size;
+static int current = -1;    // slot the base lives in
+static uint32_t sequence;
+static uint64_t folded_us;  // when the overlay was last empty or folded in
+static heatmap_store_stats_t stats;
+
+static struct {
+    bool active;
+    heatmap_compact_t compact;
+    int slot;
+    uint32_t block;         // next one to write; 0 blanks the header
+    uint32_t count;
+} job;
+
+// Block being written; flash can only be programmed from RAM
+static uint8_t block_buf[BLOCK_STORE_MAX_BLOCK];
+
+static uint32_t header_offset(int slot) {
+    return slot * slot_size + slot_size - store->block_size;
+}
+
+static const snapshot_header_t *slot_header(int slot) {
+    const snapshot_header_t *hdr = (const snapshot_header_t *)(mapped + header_offset(slot));
+    bool whole = memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == SNAPSHOT_VERSION && hdr->header_size == sizeof(*hdr) &&
+        hdr->cell_e7 == HEATMAP_CELL_E7 && hdr->count <= HEATMAP_MAX_CELLS;
+    return whole ? hdr : NULL;
+}
+
+static const Heatmap *slot_cells(int slot) {
+    return (const Heatmap *)(mapped + slot * slot_size);
+}
+
+bool heatmap_store_init(block_store_t *s) {
+    uint64_t start = time_us_64();
+    memset(&stats, 0, sizeof(stats));
+    memset(&job, 0, sizeof(job));
+    store = NULL;
+    current = -1;
+    sequence = 0;
+    folded_us = start;
+
+    // The base is read where it lies, so the store must be mappable
+    uint32_t block = s->block_size;
+    const uint8_t *map = block_store_map(s);
+    if (!map || block < sizeof(snapshot_header_t) || block > BLOCK_STORE_MAX_BLOCK ||
+            HEATMAP_STORE_SIZE(block) > s->size) {
+        return false;
+    }
+    store = s;
+    mapped = map;
+    slot_size = HEATMAP_STORE_SIZE(block) / 2;
+
+    const snapshot_header_t *newest = NULL;
+    for (int slot = 0; slot < 2; slot++) {
+        const snapshot_header_t *hdr = slot_header(slot);
+        if (hdr && (!newest || hdr->sequence > newest->sequence)) {
+            newest = hdr;
+            current = slot;
+        }
+    }
+    if (newest) {
+        sequence = newest->sequence;
+        heatmap_set_base(slot_cells(current), newest->count, newest->origin_lat_e7, newest->origin_lon_e7);
+        stats.restored = newest->count;
+    }
+    folded_us = time_us_64();
+    stats.restore_us = folded_us - start;
+    return true;
+}
+
+static bool due(void) {
+    size_t n = heatmap_overlay_size();
+    if (n == 0) {
+        folded_us = time_us_64();
+        return false;
+    }
+    return n >= HEATMAP_STORE_OVERLAY_HIGH || time_us_64() - folded_us >= HEATMAP_STORE_INTERVAL_S * 1000000ull;
+}
+
+static bool job_begin(void) {
+    if (!heatmap_compact_begin(&job.compact)) {
+        stats.deferred++;
+        return false;
+    }
+    job.active = true;
+    job.slot = current == 0 ? 1 : 0;
+    job.block = 0;
+    job.count = 0;
+    return true;
+}
+
+static void job_abort(void) {
+    heatmap_compact_abort(&job.compact);
+    job.active = false;
+    stats.failed++;
+}
+
+// Write the job's next block; false once it has finished or failed
+static bool job_step(void) {
+    uint32_t block = store->block_size;
+    memset(block_buf, 0xff, block);
+    if (job.block == 0) {
+        if (!block_store_program(store, header_offset(job.slot), block_buf, block)) {
+            job_abort();
+            return false;
+        }
+        job.block++;
+        return true;
+    }
+
+    size_t len = heatmap_compact_read(&job.compact, block_buf, block);
+    if (len) {
+        if (!block_store_program(store, job.slot * slot_size + (job.block - 1) * block, block_buf, block)) {
+            job_abort();
+            return false;
+        }
+        job.count += len / sizeof(Heatmap);
+        job.block++;
+        stats.blocks++;
+        // A full block may have more to come
+        if (len == block) {
+            return true;
+        }
+        memset(block_buf, 0xff, block);
+    }
+
+    snapshot_header_t *hdr = (snapshot_header_t *)block_buf;
+    memcpy(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic));
+    hdr->version = SNAPSHOT_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->sequence = sequence + 1;
+    heatmap_origin(&hdr->origin_lat_e7, &hdr->origin_lon_e7);
+    hdr->cell_e7 = HEATMAP_CELL_E7;
+    hdr->count = job.count;
+    if (!block_store_program(store, header_offset(job.slot), block_buf, block)) {
+        job_abort();
+        return false;
+    }
+
+    heatmap_compact_commit(&job.compact, slot_cells(job.slot), job.count);
+    current = job.slot;
+    sequence++;
+    folded_us = time_us_64();
+    job.active = false;
+    stats.compactions++;
+    return false;
+}
+
+bool heatmap_store_step(void) {
+    if (!store || (!job.active && (!due() || !job_begin()))) {
+        return false;
+    }
+    return job_step();
+}
+
+bool heatmap_store_flush(void) {
+    if (!store || (!job.active && heatmap_overlay_size() && !job_begin())) {
+        return false;
+    }
+    uint32_t done = stats.compactions;
+    while (job.active && job_step()) {
+    }
+    return stats.compactions != done || heatmap_overlay_size() == 0;
+}
+
+const heatmap_store_stats_t *heatmap_store_get_stats(void) {
+    return &stats;
+}
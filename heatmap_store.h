@@ -0,0 +1,52 @@
+#ifndef _HEATMAP_STORE_H_
+#define _HEATMAP_STORE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "heatmap.h"
+#include "block_store.h"
+
+// Heatmap snapshots in a block store that can be read in place, such as the internal flash
+// through XIP. The newest is used where it lies as the heatmap's base, so restoring it at
+// boot takes the same time whatever its size; visits since are counted in the RAM overlay
+// and folded into a fresh snapshot a block at a time in the background.
+
+// Fold the overlay in once it holds this many cells...
+#ifndef HEATMAP_STORE_OVERLAY_HIGH
+#define HEATMAP_STORE_OVERLAY_HIGH (HEATMAP_OVERLAY_CELLS / 2)
+#endif
+
+// ...or once it has held any for this long
+#ifndef HEATMAP_STORE_INTERVAL_S
+#define HEATMAP_STORE_INTERVAL_S 600
+#endif
+
+// Store bytes for two snapshot slots, each the cells rounded up to whole blocks and a header block
+#define HEATMAP_STORE_SIZE(block_size) \
+    (2 * ((HEATMAP_MAX_CELLS * 8 + (block_size) - 1) / (block_size) * (block_size) + (block_size)))
+
+typedef struct {
+    uint32_t restored;      // cells in the snapshot found at boot
+    uint32_t restore_us;    // time taken to find and adopt it
+    uint32_t compactions;
+    uint32_t blocks;        // of cells written by them
+    uint32_t deferred;      // put off because a reader still held a view over an older base
+    uint32_t failed;        // abandoned because flash could not be written
+} heatmap_store_stats_t;
+
+// Keep snapshots in store and adopt the newest whole one as the base; call after
+// heatmap_init(), before the first fix. False, and nothing is persisted, if the store cannot
+// be mapped or is smaller than HEATMAP_STORE_SIZE(store->block_size).
+bool heatmap_store_init(block_store_t *store);
+
+// Write the next block of a snapshot if one is due or under way; true while one is under
+// way. On internal flash each call stalls anything running from it for a sector erase.
+bool heatmap_store_step(void);
+
+// Fold the whole overlay in now, e.g. before a planned shutdown; false if that could not be
+// done because of a reader or a write error
+bool heatmap_store_flush(void);
+
+const heatmap_store_stats_t *heatmap_store_get_stats(void);
+
+#endif
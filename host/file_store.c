@@ -0,0 +1,63 @@
+#include "file_store.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+    int fd;
+    bool sync;
+    const uint8_t *map;
+} file_ctx_t;
+
+static bool file_read(block_store_t *store, uint32_t offset, void *buf, size_t len) {
+    file_ctx_t *f = store->ctx;
+    return pread(f->fd, buf, len, offset) == (ssize_t)len;
+}
+
+static bool file_program(block_store_t *store, uint32_t offset, const void *data, size_t len) {
+    file_ctx_t *f = store->ctx;
+    return pwrite(f->fd, data, len, offset) == (ssize_t)len && (!f->sync || fdatasync(f->fd) == 0);
+}
+
+// A shared mapping sees pwrite()s as soon as they return
+static const uint8_t *file_map(block_store_t *store) {
+    file_ctx_t *f = store->ctx;
+    return f->map;
+}
+
+static const block_store_ops_t file_ops = { file_read, file_program, file_map };
+
+bool file_store_open(block_store_t *store, const char *path, uint32_t size, uint32_t block_size, bool sync) {
+    size &= ~(block_size - 1);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (st.st_size < size && ftruncate(fd, size) != 0)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    file_ctx_t *f = malloc(sizeof(*f));
+    if (map == MAP_FAILED || !f) {
+        if (map != MAP_FAILED) {
+            munmap(map, size);
+        }
+        free(f);
+        close(fd);
+        return false;
+    }
+    *f = (file_ctx_t){ fd, sync, map };
+    *store = (block_store_t){ .ops = &file_ops, .name = "file", .size = size, .block_size = block_size, .ctx = f };
+    return true;
+}
+
+void file_store_close(block_store_t *store) {
+    file_ctx_t *f = store->ctx;
+    munmap((void *)f->map, store->size);
+    close(f->fd);
+    free(f);
+    store->ctx = NULL;
+}
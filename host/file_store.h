@@ -0,0 +1,16 @@
+#ifndef _FILE_STORE_H_
+#define _FILE_STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "block_store.h"
+
+// A block store in a file, for running and timing the persistence code on the host. The file
+// is grown to size if shorter; new space reads as zeros, which no log or snapshot takes for
+// data. It is mapped so snapshots can be read in place, and writes go through the page cache
+// unless sync is set, when each one waits for the disk as a flash or SD write would.
+bool file_store_open(block_store_t *store, const char *path, uint32_t size, uint32_t block_size, bool sync);
+
+void file_store_close(block_store_t *store);
+
+#endif
@@ -0,0 +1,172 @@
+// Stand-in for libFuzzer's main, for compilers without -fsanitize=fuzzer (GCC). Runs the
+// target over every seed given, then over mutations of them, so a sanitizer build still
+// shakes the parser out in ctest. Same command line as libFuzzer for the options it takes:
+//
+// usage: fuzz_TARGET [-runs=N] [-seed=S] [-max_len=N] FILE|DIR...
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define MAX_SEEDS 1024
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} input_t;
+
+static input_t seeds[MAX_SEEDS];
+static size_t seed_count;
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint32_t next_rand(void) {
+    // xorshift64*: the same seed always gives the same run
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (uint32_t)((rng * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+static void add_seed(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f || seed_count == MAX_SEEDS) {
+        if (f) {
+            fclose(f);
+        }
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(size > 0 ? size : 1);
+    if (data && fread(data, 1, size, f) == (size_t)size) {
+        seeds[seed_count++] = (input_t){ data, (size_t)size };
+    } else {
+        free(data);
+    }
+    fclose(f);
+}
+
+static void add_path(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        exit(1);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        add_seed(path);
+        return;
+    }
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            char child[4096];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            add_seed(child);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+}
+
+// Bytes that steer the NMEA parsers into their other branches
+static uint8_t interesting(void) {
+    static const char bytes[] = ",*$.-+0123456789ANSEWVTMKDR\r\n";
+    uint32_t r = next_rand();
+    return r & 0x100 ? (uint8_t)r : (uint8_t)bytes[r % (sizeof(bytes) - 1)];
+}
+
+// One to four random edits of a seed: overwrite, insert, delete, duplicate, truncate or
+// splice with another seed
+static size_t mutate(uint8_t *buf, size_t size, size_t max_len) {
+    int edits = 1 + next_rand() % 4;
+    for (int e = 0; e < edits; e++) {
+        size_t at = size ? next_rand() % size : 0;
+        switch (next_rand() % 6) {
+            case 0:
+                if (size) {
+                    buf[at] = interesting();
+                }
+                break;
+            case 1:
+                if (size < max_len) {
+                    memmove(buf + at + 1, buf + at, size - at);
+                    buf[at] = interesting();
+                    size++;
+                }
+                break;
+            case 2: {
+                size_t n = size - at ? 1 + next_rand() % (size - at) : 0;
+                n = n > 8 ? next_rand() % 8 : n;
+                memmove(buf + at, buf + at + n, size - at - n);
+                size -= n;
+            } break;
+            case 3: {
+                size_t n = size - at < 16 ? size - at : 16;
+                if (size + n <= max_len) {
+                    memmove(buf + at + n, buf + at, size - at);
+                    size += n;
+                }
+            } break;
+            case 4:
+                size = at;
+                break;
+            default: {
+                const input_t *other = &seeds[next_rand() % seed_count];
+                size_t from = other->size ? next_rand() % other->size : 0;
+                size_t n = other->size - from;
+                if (at + n > max_len) {
+                    n = max_len - at;
+                }
+                memcpy(buf + at, other->data + from, n);
+                size = at + n > size ? at + n : size;
+            } break;
+        }
+    }
+    return size;
+}
+
+static void run(const uint8_t *data, size_t size) {
+    // An exact-size copy, so ASan sees any read past the end
+    uint8_t *copy = malloc(size ? size : 1);
+    memcpy(copy, data, size);
+    LLVMFuzzerTestOneInput(copy, size);
+    free(copy);
+}
+
+int main(int argc, char **argv) {
+    long runs = 0;
+    size_t max_len = 256;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+        } else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            rng = strtoull(argv[i] + 6, NULL, 0) | 1;
+        } else if (strncmp(argv[i], "-max_len=", 9) == 0) {
+            max_len = strtoul(argv[i] + 9, NULL, 0);
+        } else if (argv[i][0] != '-') {
+            add_path(argv[i]);
+        }
+    }
+
+    for (size_t i = 0; i < seed_count; i++) {
+        run(seeds[i].data, seeds[i].size);
+    }
+    uint8_t *buf = malloc(max_len);
+    for (long r = 0; r < runs && seed_count; r++) {
+        const input_t *seed = &seeds[next_rand() % seed_count];
+        size_t size = seed->size < max_len ? seed->size : max_len;
+        memcpy(buf, seed->data, size);
+        run(buf, mutate(buf, size, max_len));
+    }
+    free(buf);
+    fprintf(stderr, "%zu seeds, %ld mutations: ok\n", seed_count, runs);
+    return 0;
+}
@@ -0,0 +1,86 @@
+// libFuzzer targets for the NMEA parser, which reads untrusted serial input. One source, one
+// target per entry point: FUZZ_TARGET_<NAME> picks which, see host/CMakeLists.txt.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minmea.h"
+
+// Field selections that leave gaps, so the skipping paths of the _fields parsers run too
+#define SPARSE_FIELDS UINT32_C(0x2aa)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // The parsers take NUL-terminated lines; an exact-size copy lets ASan see over-reads
+    char *line = malloc(size + 1);
+    memcpy(line, data, size);
+    line[size] = '\0';
+
+#if defined(FUZZ_TARGET_CHECK)
+    char talker[3];
+    minmea_check(line, false);
+    minmea_check(line, true);
+    minmea_sentence_id(line, false);
+    minmea_sentence_id(line, true);
+    minmea_sentence_type(line);
+    minmea_talker_id(talker, line);
+#elif defined(FUZZ_TARGET_SCAN)
+    // Every field type, mandatory then optional; strings can be as long as the line
+    char c1, c2, *s1 = malloc(size + 1), *s2 = malloc(size + 1);
+    int d1, d2, i1, i2;
+    struct minmea_float f1, f2;
+    struct minmea_type t;
+    struct minmea_date date1, date2;
+    struct minmea_time time1, time2;
+    minmea_scan(line, "tcdfiDTs_;cdfiDTs", &t, &c1, &d1, &f1, &i1, &date1, &time1, s1,
+        &c2, &d2, &f2, &i2, &date2, &time2, s2);
+    minmea_scan(line, "_;TDfdff", &time1, &date1, &f1, &d1, &f1, &f2);
+    minmea_scan_fields(line, SPARSE_FIELDS, "tcdfiDTs_;cdfiDTs", &t, &c1, &d1, &f1, &i1, &date1,
+        &time1, s1, &c2, &d2, &f2, &i2, &date2, &time2, s2);
+    free(s1);
+    free(s2);
+#elif defined(FUZZ_TARGET_GBS)
+    struct minmea_sentence_gbs frame;
+    minmea_parse_gbs(&frame, line);
+#elif defined(FUZZ_TARGET_RMC)
+    struct minmea_sentence_rmc frame;
+    struct timespec ts;
+    if (minmea_parse_rmc(&frame, line)) {
+        minmea_gettime(&ts, &frame.date, &frame.time);
+        minmea_tocoord(&frame.latitude);
+    }
+    minmea_parse_rmc_fields(&frame, line, SPARSE_FIELDS);
+#elif defined(FUZZ_TARGET_GGA)
+    struct minmea_sentence_gga frame;
+    if (minmea_parse_gga(&frame, line)) {
+        minmea_tocoord(&frame.latitude);
+    }
+    minmea_parse_gga_fields(&frame, line, SPARSE_FIELDS);
+#elif defined(FUZZ_TARGET_GSA)
+    struct minmea_sentence_gsa frame;
+    minmea_parse_gsa(&frame, line);
+#elif defined(FUZZ_TARGET_GLL)
+    struct minmea_sentence_gll frame;
+    minmea_parse_gll(&frame, line);
+#elif defined(FUZZ_TARGET_GST)
+    struct minmea_sentence_gst frame;
+    minmea_parse_gst(&frame, line);
+#elif defined(FUZZ_TARGET_GSV)
+    struct minmea_sentence_gsv frame;
+    minmea_parse_gsv(&frame, line);
+#elif defined(FUZZ_TARGET_VTG)
+    struct minmea_sentence_vtg frame;
+    minmea_parse_vtg(&frame, line);
+    minmea_parse_vtg_fields(&frame, line, SPARSE_FIELDS);
+#elif defined(FUZZ_TARGET_ZDA)
+    struct minmea_sentence_zda frame;
+    struct timespec ts;
+    if (minmea_parse_zda(&frame, line)) {
+        minmea_gettime(&ts, &frame.date, &frame.time);
+    }
+#else
+#error "define FUZZ_TARGET_<NAME>"
+#endif
+
+    free(line);
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef _HOST_HARDWARE_FLASH_H_
+#define _HOST_HARDWARE_FLASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Flash is a RAM array on the host (see lwip_shim.c), mapped at "XIP_BASE" so persisted
+// data can be read in place as on the device. It starts out all zeros, not erased.
+#define PICO_FLASH_SIZE_BYTES (4 * 1024 * 1024)
+#define FLASH_SECTOR_SIZE 4096u
+#define FLASH_PAGE_SIZE 256u
+
+extern uint8_t shim_flash[PICO_FLASH_SIZE_BYTES];
+
+#define XIP_BASE ((uintptr_t)shim_flash)
+
+static inline void flash_range_erase(uint32_t offset, size_t count) {
+    memset(shim_flash + offset, 0xff, count);
+}
+
+// Programming can only clear bits, as on the real part
+static inline void flash_range_program(uint32_t offset, const uint8_t *data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        shim_flash[offset + i] &= data[i];
+    }
+}
+
+#endif
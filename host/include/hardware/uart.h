@@ -0,0 +1,27 @@
+#ifndef _HOST_HARDWARE_UART_H_
+#define _HOST_HARDWARE_UART_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// There is no receiver to configure on the host; UBX commands go nowhere
+typedef struct uart_inst uart_inst_t;
+
+static inline void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len) {
+    (void)uart;
+    (void)src;
+    (void)len;
+}
+
+static inline bool uart_is_writable(uart_inst_t *uart) {
+    (void)uart;
+    return true;
+}
+
+static inline void uart_putc_raw(uart_inst_t *uart, char c) {
+    (void)uart;
+    (void)c;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _HOST_LWIP_PBUF_H_
+#define _HOST_LWIP_PBUF_H_
+
+#include <stdint.h>
+#include "lwip/err.h"
+
+typedef uint8_t u8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+
+// Received data is always delivered as one contiguous pbuf
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+};
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+u8_t pbuf_free(struct pbuf *p);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _HOST_PICO_CYW43_ARCH_H_
+#define _HOST_PICO_CYW43_ARCH_H_
+
+#include "pico/stdlib.h"
+
+#define CYW43_WL_GPIO_LED_PIN 0
+
+static inline void cyw43_arch_gpio_put(unsigned pin, bool value) {
+    (void)pin;
+    (void)value;
+}
+
+// The host loop is single threaded, like the lwIP callbacks on the device
+static inline void cyw43_arch_lwip_begin(void) {}
+static inline void cyw43_arch_lwip_end(void) {}
+
+#endif
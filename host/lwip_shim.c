@@ -0,0 +1,449 @@
+#include "lwip_shim.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+// The socket headers' TCP_MSS is the protocol minimum; ours is lwIP's setting
+#undef TCP_MSS
+#include "lwip/tcp.h"
+#include "hardware/flash.h"
+
+// The TCP slow timer, which drives tcp_poll, ticks every 500 ms in lwIP
+#define SHIM_TICK_US 500000
+
+// Sent data is queued per tcp_write so segment and heap use can be released as it drains
+typedef struct {
+    u16_t len;
+    u8_t segs;
+    bool copied;
+} shim_write_t;
+
+struct tcp_pcb {
+    int fd;
+    bool listening;
+    bool closing;           // tcp_close called, fd closed once the queue drains
+    bool dead;              // freed at the end of the loop iteration
+    void *arg;
+    tcp_accept_fn accept;
+    tcp_recv_fn recv;
+    tcp_sent_fn sent;
+    tcp_err_fn err;
+    tcp_poll_fn poll;
+    u8_t poll_interval;
+    u8_t poll_ticks;
+    uint8_t outq[TCP_SND_BUF];
+    size_t out_len;
+    shim_write_t writes[TCP_SND_QUEUELEN];
+    u16_t write_head;       // oldest queued write
+    u16_t write_count;
+    u16_t out_segs;
+    size_t head_sent;       // bytes of the oldest write already written
+    uint32_t acked;         // handed to the kernel since the last sent callback
+    struct pbuf *refused;   // data the recv callback turned away; nothing more is read meanwhile
+    struct tcp_pcb *next;
+};
+
+const ip_addr_t ip_addr_any = { 0 };
+
+// Backs hardware/flash.h
+uint8_t shim_flash[PICO_FLASH_SIZE_BYTES];
+
+static struct tcp_pcb *pcbs;
+static shim_stats_t stats;
+static uint64_t next_tick_us;
+
+const shim_stats_t *shim_stats(void) {
+    return &stats;
+}
+
+static struct tcp_pcb *pcb_alloc(int fd) {
+    struct tcp_pcb *pcb = calloc(1, sizeof(*pcb));
+    if (pcb == NULL) {
+        return NULL;
+    }
+    pcb->fd = fd;
+    pcb->next = pcbs;
+    pcbs = pcb;
+    return pcb;
+}
+
+static void pcb_kill(struct tcp_pcb *pcb, bool reset) {
+    if (pcb->dead) {
+        return;
+    }
+    if (reset) {
+        struct linger lin = { 1, 0 };
+        setsockopt(pcb->fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    }
+    close(pcb->fd);
+    pcb->dead = true;
+    // Release anything still queued
+    for (u16_t i = 0; i < pcb->write_count; i++) {
+        shim_write_t *w = &pcb->writes[(pcb->write_head + i) % TCP_SND_QUEUELEN];
+        stats.segs_used -= w->segs;
+        if (w->copied) {
+            stats.mem_used -= w->len;
+        }
+    }
+    pcb->write_count = 0;
+    free(pcb->refused);
+    pcb->refused = NULL;
+    if (!pcb->listening) {
+        stats.pcbs_used--;
+    }
+}
+
+static void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+struct tcp_pcb *tcp_new(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    set_nonblocking(fd);
+    struct tcp_pcb *pcb = pcb_alloc(fd);
+    pcb->listening = true; // only listening pcbs are created by the application
+    return pcb;
+}
+
+err_t tcp_bind(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = ipaddr->addr,
+    };
+    if (bind(pcb->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        return ERR_USE;
+    }
+    return ERR_OK;
+}
+
+struct tcp_pcb *tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog) {
+    if (listen(pcb->fd, backlog) != 0) {
+        perror("listen");
+        return NULL;
+    }
+    return pcb;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) { pcb->arg = arg; }
+void tcp_accept(struct tcp_pcb *pcb, tcp_accept_fn accept) { pcb->accept = accept; }
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) { pcb->recv = recv; }
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) { pcb->sent = sent; }
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) { pcb->err = err; }
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval) {
+    pcb->poll = poll;
+    pcb->poll_interval = interval;
+    pcb->poll_ticks = 0;
+}
+
+u16_t tcp_sndbuf(const struct tcp_pcb *pcb) {
+    return TCP_SND_BUF - pcb->out_len;
+}
+
+u16_t tcp_sndqueuelen(const struct tcp_pcb *pcb) {
+    return pcb->out_segs;
+}
+
+// Data is always copied into the queue here; for non-copied writes the device would only
+// reference it, which costs no heap and so is not charged against MEM_SIZE
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags) {
+    if (pcb->dead || pcb->closing || pcb->listening) {
+        return ERR_CONN;
+    }
+    u8_t segs = (len + TCP_MSS - 1) / TCP_MSS;
+    bool copy = apiflags & TCP_WRITE_FLAG_COPY;
+    if (len > tcp_sndbuf(pcb) || pcb->write_count == TCP_SND_QUEUELEN ||
+        pcb->out_segs + segs > TCP_SND_QUEUELEN || stats.segs_used + segs > MEMP_NUM_TCP_SEG ||
+        (copy && stats.mem_used + len > MEM_SIZE)) {
+        stats.err_mem++;
+        return ERR_MEM;
+    }
+    memcpy(pcb->outq + pcb->out_len, dataptr, len);
+    pcb->out_len += len;
+    pcb->writes[(pcb->write_head + pcb->write_count++) % TCP_SND_QUEUELEN] = (shim_write_t){ len, segs, copy };
+    pcb->out_segs += segs;
+    stats.segs_used += segs;
+    if (copy) {
+        stats.mem_used += len;
+        if (stats.mem_used > stats.mem_peak) {
+            stats.mem_peak = stats.mem_used;
+        }
+    }
+    return ERR_OK;
+}
+
+// Hand queued data to the kernel. What it takes counts as acknowledged.
+static void pcb_flush(struct tcp_pcb *pcb) {
+    while (pcb->out_len && !pcb->dead) {
+        ssize_t n = send(pcb->fd, pcb->outq, pcb->out_len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return;
+            }
+            // Reset by the peer: lwIP frees the pcb and reports through the err callback
+            tcp_err_fn err = pcb->err;
+            void *arg = pcb->arg;
+            pcb_kill(pcb, false);
+            if (err) {
+                err(arg, ERR_RST);
+            }
+            return;
+        }
+        memmove(pcb->outq, pcb->outq + n, pcb->out_len - n);
+        pcb->out_len -= n;
+        pcb->acked += n;
+        pcb->head_sent += n;
+        while (pcb->write_count && pcb->head_sent >= pcb->writes[pcb->write_head].len) {
+            shim_write_t *w = &pcb->writes[pcb->write_head];
+            pcb->head_sent -= w->len;
+            pcb->out_segs -= w->segs;
+            stats.segs_used -= w->segs;
+            if (w->copied) {
+                stats.mem_used -= w->len;
+            }
+            pcb->write_head = (pcb->write_head + 1) % TCP_SND_QUEUELEN;
+            pcb->write_count--;
+        }
+    }
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+    pcb_flush(pcb);
+    return ERR_OK;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len) {
+    // The kernel manages the receive window
+    (void)pcb;
+    (void)len;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+    pcb->recv = NULL;
+    pcb->sent = NULL;
+    pcb->poll = NULL;
+    pcb->err = NULL;
+    if (pcb->listening) {
+        pcb_kill(pcb, false);
+        return ERR_OK;
+    }
+    pcb->closing = true;
+    pcb_flush(pcb);
+    if (pcb->out_len == 0) {
+        shutdown(pcb->fd, SHUT_WR);
+        pcb_kill(pcb, false);
+    }
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+    tcp_err_fn err = pcb->err;
+    void *arg = pcb->arg;
+    pcb_kill(pcb, true);
+    if (err) {
+        err(arg, ERR_ABRT);
+    }
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+    if (offset >= p->len) {
+        return 0;
+    }
+    u16_t n = LWIP_MIN(len, p->len - offset);
+    memcpy(dataptr, (const uint8_t *)p->payload + offset, n);
+    return n;
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+    free(p);
+    return 1;
+}
+
+static void pcb_accept(struct tcp_pcb *listener) {
+    for (;;) {
+        int fd = accept(listener->fd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        if (stats.pcbs_used >= MEMP_NUM_TCP_PCB) {
+            // Out of pcbs: lwIP would drop the SYN; the closest we can do is refuse
+            stats.refused++;
+            close(fd);
+            continue;
+        }
+        set_nonblocking(fd);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct tcp_pcb *pcb = pcb_alloc(fd);
+        if (pcb == NULL) {
+            close(fd);
+            continue;
+        }
+        stats.accepted++;
+        if (++stats.pcbs_used > stats.pcbs_peak) {
+            stats.pcbs_peak = stats.pcbs_used;
+        }
+        pcb->arg = listener->arg;
+        err_t err = listener->accept(listener->arg, pcb, ERR_OK);
+        if (err != ERR_OK && err != ERR_ABRT) {
+            tcp_abort(pcb);
+        }
+    }
+}
+
+// As lwIP, data a recv callback refuses with ERR_MEM is kept and offered again each tick
+static void deliver(struct tcp_pcb *pcb, struct pbuf *p) {
+    err_t err = pcb->recv(pcb->arg, pcb, p, ERR_OK);
+    if (err == ERR_MEM && p && !pcb->dead) {
+        pcb->refused = p;
+    }
+}
+
+static void pcb_read(struct tcp_pcb *pcb) {
+    struct pbuf *p = malloc(sizeof(struct pbuf) + TCP_MSS);
+    if (p == NULL) {
+        return;
+    }
+    ssize_t n = recv(pcb->fd, p + 1, TCP_MSS, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        free(p);
+        return;
+    }
+    if (n < 0) {
+        free(p);
+        tcp_err_fn err = pcb->err;
+        void *arg = pcb->arg;
+        pcb_kill(pcb, false);
+        if (err) {
+            err(arg, ERR_RST);
+        }
+        return;
+    }
+    if (n == 0) {
+        free(p);
+        p = NULL;
+    } else {
+        *p = (struct pbuf){ .payload = p + 1, .tot_len = n, .len = n };
+    }
+    if (pcb->closing) {
+        // Data after tcp_close is discarded
+        free(p);
+        return;
+    }
+    if (pcb->recv) {
+        deliver(pcb, p);
+    } else if (p) {
+        pbuf_free(p);
+    } else {
+        tcp_close(pcb);
+    }
+}
+
+void shim_run_once(int timeout_ms, int extra_fd, bool *extra_ready) {
+    struct pcb_poll { struct pollfd fds[MEMP_NUM_TCP_PCB + 8]; struct tcp_pcb *pcb[MEMP_NUM_TCP_PCB + 8]; };
+    static struct pcb_poll pp;
+    nfds_t n = 0;
+
+    for (struct tcp_pcb *pcb = pcbs; pcb; pcb = pcb->next) {
+        if (pcb->dead || n == count_of(pp.fds) - 1) {
+            continue;
+        }
+        if (pcb->acked) {
+            timeout_ms = 0; // sent callbacks still to deliver
+        }
+        pp.pcb[n] = pcb;
+        pp.fds[n++] = (struct pollfd){ pcb->fd, (pcb->refused ? 0 : POLLIN) | (pcb->out_len ? POLLOUT : 0), 0 };
+    }
+    nfds_t extra = n;
+    if (extra_fd >= 0) {
+        pp.fds[n++] = (struct pollfd){ extra_fd, POLLIN, 0 };
+    }
+
+    uint64_t now = time_us_64();
+    if (next_tick_us == 0) {
+        next_tick_us = now + SHIM_TICK_US;
+    }
+    int until_tick = next_tick_us > now ? (int)((next_tick_us - now + 999) / 1000) : 0;
+    if (timeout_ms < 0 || until_tick < timeout_ms) {
+        timeout_ms = until_tick;
+    }
+
+    int ready = poll(pp.fds, n, timeout_ms);
+    if (extra_ready) {
+        *extra_ready = ready > 0 && extra_fd >= 0 && (pp.fds[extra].revents & (POLLIN | POLLHUP));
+    }
+
+    for (nfds_t i = 0; ready > 0 && i < extra; i++) {
+        struct tcp_pcb *pcb = pp.pcb[i];
+        short revents = pp.fds[i].revents;
+        if (pcb->dead || revents == 0) {
+            continue;
+        }
+        if (pcb->listening) {
+            pcb_accept(pcb);
+            continue;
+        }
+        if (revents & POLLOUT) {
+            pcb_flush(pcb);
+        }
+        if (!pcb->dead && !pcb->refused && (revents & (POLLIN | POLLHUP | POLLERR))) {
+            pcb_read(pcb);
+        }
+    }
+
+    // Acknowledge what the kernel took, as lwIP does when ACKs arrive
+    for (struct tcp_pcb *pcb = pcbs; pcb; pcb = pcb->next) {
+        while (!pcb->dead && pcb->acked) {
+            u16_t len = LWIP_MIN(pcb->acked, 0xffff);
+            pcb->acked -= len;
+            if (pcb->sent && !pcb->closing) {
+                pcb->sent(pcb->arg, pcb, len);
+            }
+        }
+    }
+
+    now = time_us_64();
+    if (now >= next_tick_us) {
+        next_tick_us += SHIM_TICK_US;
+        for (struct tcp_pcb *pcb = pcbs; pcb; pcb = pcb->next) {
+            if (!pcb->dead && pcb->poll && ++pcb->poll_ticks >= pcb->poll_interval) {
+                pcb->poll_ticks = 0;
+                pcb->poll(pcb->arg, pcb);
+            }
+            if (!pcb->dead && pcb->refused && pcb->recv) {
+                struct pbuf *p = pcb->refused;
+                pcb->refused = NULL;
+                deliver(pcb, p);
+            }
+        }
+    }
+
+    // Finish closes whose data has drained, then free dead pcbs
+    for (struct tcp_pcb **link = &pcbs; *link;) {
+        struct tcp_pcb *pcb = *link;
+        if (pcb->closing && !pcb->dead && pcb->out_len == 0) {
+            shutdown(pcb->fd, SHUT_WR);
+            pcb_kill(pcb, false);
+        }
+        if (pcb->dead) {
+            *link = pcb->next;
+            free(pcb);
+        } else {
+            link = &pcb->next;
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef _LWIP_SHIM_H_
+#define _LWIP_SHIM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+// Host stand-in for lwIP's raw TCP API. Each pcb is a non-blocking socket and all
+// callbacks run from shim_run_once on one thread, as they do from the cyw43 context on
+// the device. Pool and buffer limits follow lwipopts.h.
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t refused;       // connections turned away for lack of a pcb
+    uint32_t pcbs_used;
+    uint32_t pcbs_peak;
+    uint32_t err_mem;       // tcp_write calls that failed for buffer, segment or heap space
+    size_t mem_used;        // heap held by copied writes, limited to MEM_SIZE
+    size_t mem_peak;
+    uint32_t segs_used;     // limited to MEMP_NUM_TCP_SEG
+} shim_stats_t;
+
+// Wait up to timeout_ms for socket activity and run the callbacks it causes, including
+// the 500 ms poll timer. extra_fd (or -1) is watched too; extra_ready says if it is readable.
+void shim_run_once(int timeout_ms, int extra_fd, bool *extra_ready);
+
+const shim_stats_t *shim_stats(void);
+
+#endif
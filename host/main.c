@@ -0,0 +1,593 @@
+// Host build of the web server: the firmware's HTTP, event stream, storage and ingest
+// code on top of host/lwip_shim.c, serving on localhost for load testing.
+//
+// usage: gps-heat-mapper-host [-p PORT] [-n NMEA_FILE|-] [-m MAP_FILE] [-l LOG_FILE] [-b FRAMES]
+//   e.g. tools/nmea_sim.py --rate 10 --realtime --route drive:3600 | gps-heat-mapper-host -n - >/dev/null
+//
+// -b ingests the whole NMEA input, times the NMEA parser on the fuzz seed corpus
+// (host/fuzz/corpus), counting fixes into the heatmap grid the binary was built for (see the
+// variants in CMakeLists.txt) and FRAMES heatmap renders in each normalisation mode, then
+// replays the track into the heatmap under each density mode to find the render rate at
+// which spreading at ingest pays off, times the fix log and heatmap snapshots over each kind
+// of block store, and exits instead of serving.
+//
+// -m and -l keep the heatmap snapshots and the fix log in files, so they survive a restart as
+// on the device; by default they go to a RAM stand-in for the internal flash and a RAM store.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lwip/tcp.h"
+#include "lwip_shim.h"
+#include "http_server.h"
+#include "power.h"
+#include "heatmap.h"
+#include "heatmap_render.h"
+#include "heatmap_store.h"
+#include "block_store.h"
+#include "file_store.h"
+#include "fix_log.h"
+#include "flash_layout.h"
+#include "track.h"
+#include "trips.h"
+#include "ingest.h"
+#include "minmea.h"
+
+#define STATS_INTERVAL_US 10000000
+
+// Fix log kept in RAM when no file is given, and by the benchmark, which wraps it
+#define RAM_LOG_SIZE (64 * 1024)
+#define RAM_LOG_BLOCK 512
+
+bool led_state = false;
+
+char html_page[512];
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static void print_stats(void) {
+    const shim_stats_t *s = shim_stats();
+    fprintf(stderr, "pcbs %lu/%d (peak %lu) accepted %lu refused %lu err_mem %lu heap %lu/%d (peak %lu) fixes %lu\n",
+        (unsigned long)s->pcbs_used, MEMP_NUM_TCP_PCB, (unsigned long)s->pcbs_peak,
+        (unsigned long)s->accepted, (unsigned long)s->refused, (unsigned long)s->err_mem,
+        (unsigned long)s->mem_used, MEM_SIZE, (unsigned long)s->mem_peak,
+        (unsigned long)track_end());
+    const http_stats_t *h = http_get_stats();
+    fprintf(stderr, "http accepted %lu evicted %lu timed_out %lu refused %lu\n",
+        (unsigned long)h->accepted, (unsigned long)h->evicted, (unsigned long)h->timed_out,
+        (unsigned long)h->refused);
+    const heatmap_view_stats_t *v = heatmap_view_get_stats();
+    fprintf(stderr, "heatmap views %lu stale %lu publishes %lu blocks_copied %lu retries %lu\n",
+        (unsigned long)v->views, (unsigned long)v->stale, (unsigned long)v->publishes,
+        (unsigned long)v->blocks_copied, (unsigned long)v->retries);
+    const heatmap_store_stats_t *st = heatmap_store_get_stats();
+    fprintf(stderr, "heatmap overlay %lu compactions %lu blocks %lu deferred %lu failed %lu\n",
+        (unsigned long)heatmap_overlay_size(), (unsigned long)st->compactions,
+        (unsigned long)st->blocks, (unsigned long)st->deferred, (unsigned long)st->failed);
+    const fix_log_stats_t *l = fix_log_get_stats();
+    fprintf(stderr, "fix log %lu-%lu blocks %lu flushes %lu dropped %lu\n",
+        (unsigned long)fix_log_begin(), (unsigned long)fix_log_end(), (unsigned long)l->blocks,
+        (unsigned long)l->flushes, (unsigned long)l->dropped);
+    const heatmap_render_stats_t *r = heatmap_render_get_stats();
+    fprintf(stderr, "render rows %lu pixels %llu us %llu\n", (unsigned long)r->rows,
+        (unsigned long long)r->pixels, (unsigned long long)r->us);
+}
+
+// Split whatever is readable into lines and feed them to the parser; false at end of input
+static bool read_nmea(int fd) {
+    static char line[MINMEA_MAX_SENTENCE_LENGTH];
+    static size_t idx = 0;
+    static bool too_long = false;
+    char buf[4096];
+
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        char c = buf[i];
+        if (c == '\n') {
+            line[idx] = '\0';
+            if (!too_long) {
+                ingest_sentence(line);
+            }
+            idx = 0;
+            too_long = false;
+        } else if (c == '\r') {
+            continue;
+        } else if (idx < sizeof(line) - 1) {
+            line[idx++] = c;
+        } else {
+            too_long = true;
+        }
+    }
+    return n > 0;
+}
+
+static void bench_render(int frames) {
+    static const char *const names[HEATMAP_NORM_COUNT] = { "linear", "sqrt", "log" };
+    for (int norm = 0; norm < HEATMAP_NORM_COUNT; norm++) {
+        uint64_t start = time_us_64();
+        uint64_t pixels = 0;
+        uint32_t checksum = 0;
+        for (int f = 0; f < frames; f++) {
+            heatmap_render_begin(names, norm);
+            for (uint16_t y = 0; y < heatmap_render_height(); y++) {
+                const uint8_t *row = heatmap_render_row(y);
+                checksum += row[heatmap_render_width() / 2];
+            }
+            pixels += (uint64_t)heatmap_render_width() * heatmap_render_height();
+            heatmap_render_end(names);
+        }
+        uint64_t us = time_us_64() - start;
+        fprintf(stderr, "render %s %ux%u from %lu cells: %.0f px/s (checksum %lu)\n", names[norm],
+            heatmap_render_width(), heatmap_render_height(), (unsigned long)heatmap_size(),
+            us ? pixels * 1e6 / us : 0.0, (unsigned long)checksum);
+    }
+}
+
+static double render_us(int frames) {
+    uint64_t start = time_us_64();
+    for (int f = 0; f < frames; f++) {
+        heatmap_render_begin(render_us, HEATMAP_NORM_SQRT);
+        for (uint16_t y = 0; y < heatmap_render_height(); y++) {
+            heatmap_render_row(y);
+        }
+        heatmap_render_end(render_us);
+    }
+    return (double)(time_us_64() - start) / frames;
+}
+
+// Decode a sentence of a known type, in full or only the given fields; false if it did not
+// parse or the type has no field-masked parser
+static bool parse_sentence(enum minmea_sentence_id id, const char *line, uint32_t fields) {
+    union {
+        struct minmea_sentence_gbs gbs;
+        struct minmea_sentence_gga gga;
+        struct minmea_sentence_gll gll;
+        struct minmea_sentence_gsa gsa;
+        struct minmea_sentence_gst gst;
+        struct minmea_sentence_gsv gsv;
+        struct minmea_sentence_rmc rmc;
+        struct minmea_sentence_vtg vtg;
+        struct minmea_sentence_zda zda;
+    } frame;
+    bool all = fields == MINMEA_FIELDS_ALL;
+    switch (id) {
+        case MINMEA_SENTENCE_GBS: return all && minmea_parse_gbs(&frame.gbs, line);
+        case MINMEA_SENTENCE_GGA: return minmea_parse_gga_fields(&frame.gga, line, fields);
+        case MINMEA_SENTENCE_GLL: return all && minmea_parse_gll(&frame.gll, line);
+        case MINMEA_SENTENCE_GSA: return all && minmea_parse_gsa(&frame.gsa, line);
+        case MINMEA_SENTENCE_GST: return all && minmea_parse_gst(&frame.gst, line);
+        case MINMEA_SENTENCE_GSV: return all && minmea_parse_gsv(&frame.gsv, line);
+        case MINMEA_SENTENCE_RMC: return minmea_parse_rmc_fields(&frame.rmc, line, fields);
+        case MINMEA_SENTENCE_VTG: return minmea_parse_vtg_fields(&frame.vtg, line, fields);
+        case MINMEA_SENTENCE_ZDA: return all && minmea_parse_zda(&frame.zda, line);
+        default: return false;
+    }
+}
+
+// Nanoseconds per sentence to decode each of lines, in full or as ingest decodes them
+static double time_parse(char (*lines)[MINMEA_MAX_SENTENCE_LENGTH + 1], const size_t *which, size_t n,
+        enum minmea_sentence_id id, uint32_t fields) {
+    int passes = 1 + 1000000 / n;
+    uint32_t parsed = 0;
+    uint64_t start = time_us_64();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < n; i++) {
+            parsed += parse_sentence(id, lines[which[i]], fields);
+        }
+    }
+    uint64_t us = time_us_64() - start;
+    return parsed ? us * 1000.0 / ((uint64_t)passes * n) : 0.0;
+}
+
+// Times the parser on the valid sentences of the corpus the fuzz targets start from: the
+// checksum, then each type decoded in full and with only the fields ingest subscribes to
+static void bench_nmea(void) {
+    static char lines[512][MINMEA_MAX_SENTENCE_LENGTH + 1];
+    size_t count = 0;
+    DIR *dir = opendir(NMEA_CORPUS);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", NMEA_CORPUS, entry->d_name);
+        FILE *f = entry->d_name[0] != '.' ? fopen(path, "r") : NULL;
+        while (f && count < count_of(lines) && fgets(lines[count], sizeof(lines[count]), f)) {
+            lines[count][strcspn(lines[count], "\r\n")] = '\0';
+            count += minmea_check(lines[count], true);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    if (count == 0) {
+        fprintf(stderr, "nmea: no sentences in %s\n", NMEA_CORPUS);
+        return;
+    }
+
+    int passes = 1 + 1000000 / count;
+    uint32_t valid = 0;
+    uint64_t start = time_us_64();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < count; i++) {
+            valid += minmea_check(lines[i], true);
+        }
+    }
+    fprintf(stderr, "nmea check: %.1f ns per sentence over %lu sentences\n",
+        (time_us_64() - start) * 1000.0 / ((uint64_t)passes * count), (unsigned long)count);
+
+    for (enum minmea_sentence_id id = MINMEA_SENTENCE_GBS; id <= MINMEA_SENTENCE_ZDA; id++) {
+        size_t which[count_of(lines)], n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (minmea_sentence_id(lines[i], true) == id) {
+                which[n++] = i;
+            }
+        }
+        if (n == 0) {
+            continue;
+        }
+        char type[4] = { lines[which[0]][3], lines[which[0]][4], lines[which[0]][5], '\0' };
+        double full = time_parse(lines, which, n, id, MINMEA_FIELDS_ALL);
+        uint32_t fields = ingest_fields(id);
+        if (fields) {
+            fprintf(stderr, "nmea %s: %.1f ns per sentence in full, %.1f ns for the fields ingest uses (%lu sentences)\n",
+                type, full, time_parse(lines, which, n, id, fields), (unsigned long)n);
+        } else {
+            fprintf(stderr, "nmea %s: %.1f ns per sentence in full, dropped by ingest (%lu sentences)\n",
+                type, full, (unsigned long)n);
+        }
+    }
+}
+
+// Fixes from seq on, up to end, that can be counted before the overlay could fill, as each
+// adds at most one cell. When it is half full it is folded into a snapshot first, as
+// housekeeping does on the device; callers leave that out of their timings.
+static uint32_t overlay_batch(uint32_t seq, uint32_t end) {
+    if (heatmap_overlay_size() > HEATMAP_OVERLAY_CELLS / 2) {
+        heatmap_store_flush();
+    }
+    uint32_t room = HEATMAP_OVERLAY_CELLS - heatmap_overlay_size();
+    return end - seq < room ? end - seq : room;
+}
+
+// End of the longest stretch of the track from its start that the grid counts in full: a
+// fix off the grid or a new cell once the table is full ends it. Leaves the grid empty.
+static uint32_t counted_end(void) {
+    heatmap_init();
+    uint32_t seq = track_begin();
+    while (seq != track_end()) {
+        uint32_t end = seq + overlay_batch(seq, track_end());
+        for (; seq != end; seq++) {
+            const gps_fix_t *fix = track_get(seq);
+            if (!heatmap_add(fix->lat_e7, fix->lon_e7)) {
+                heatmap_init();
+                return seq;
+            }
+        }
+    }
+    heatmap_init();
+    return seq;
+}
+
+// Cost of finding and counting each fix's cell with the grid this binary was built for, timed
+// over the fixes up to end into an empty grid; every one of them must be counted, since a fix
+// turned away takes a short way out and would flatter the lookup
+static bool bench_grid(uint32_t end) {
+    uint32_t fixes = end - track_begin();
+    uint64_t added = 0;
+    uint64_t us = 0;
+    // Enough passes to time
+    int passes = fixes ? 1 + 1000000 / fixes : 0;
+    for (int pass = 0; pass < passes; pass++) {
+        heatmap_init();
+        for (uint32_t seq = track_begin(); seq != end;) {
+            uint32_t batch_end = seq + overlay_batch(seq, end);
+            uint64_t start = time_us_64();
+            for (; seq != batch_end; seq++) {
+                const gps_fix_t *fix = track_get(seq);
+                added += heatmap_add(fix->lat_e7, fix->lon_e7) != NULL;
+            }
+            us += time_us_64() - start;
+        }
+    }
+    if (added != (uint64_t)passes * fixes) {
+        fprintf(stderr, "grid: only %llu of %llu fixes counted, not timed\n", (unsigned long long)added,
+            (unsigned long long)passes * fixes);
+        return false;
+    }
+    fprintf(stderr, "grid cell_e7 %u%s, %u bits, %u cells: %.1f ns per fix, %lu cells from %lu of %lu fixes\n",
+        HEATMAP_CELL_E7, (HEATMAP_CELL_E7 & (HEATMAP_CELL_E7 - 1)) ? "" : " (shift)", HEATMAP_GRID_BITS,
+        HEATMAP_MAX_CELLS, added ? us * 1000.0 / added : 0.0, (unsigned long)heatmap_size(),
+        (unsigned long)fixes, (unsigned long)(track_end() - track_begin()));
+    return true;
+}
+
+// Ingest pays for every fix, rendering for every render. The ingest layer is coarser than a
+// render-mode image, so renders are compared per output pixel, at the ingest image's size:
+// the modes break even at (ingest_i - ingest_r) / (pixels_i * (per_pixel_r - per_pixel_i))
+// renders per fix.
+static bool bench_density(uint32_t end, int frames) {
+    static const char *const names[HEATMAP_DENSITY_COUNT] = { "render", "ingest" };
+    double ingest[HEATMAP_DENSITY_COUNT], render[HEATMAP_DENSITY_COUNT], per_pixel[HEATMAP_DENSITY_COUNT];
+    uint32_t pixels[HEATMAP_DENSITY_COUNT];
+    uint32_t fixes = end - track_begin();
+    for (int mode = 0; mode < HEATMAP_DENSITY_COUNT; mode++) {
+        heatmap_init();
+        heatmap_set_density(mode);
+        uint32_t added = 0;
+        uint64_t us = 0;
+        for (uint32_t seq = track_begin(); seq != end;) {
+            uint32_t batch_end = seq + overlay_batch(seq, end);
+            uint64_t start = time_us_64();
+            for (; seq != batch_end; seq++) {
+                const gps_fix_t *fix = track_get(seq);
+                const Heatmap *cell = heatmap_add(fix->lat_e7, fix->lon_e7);
+                added += cell != NULL;
+                heatmap_density_add(cell);
+                // Rebuilds when the track outgrows the layer are part of the ingest cost
+                while (heatmap_density_step()) {
+                }
+            }
+            us += time_us_64() - start;
+        }
+        // Renders of a heatmap that dropped fixes would not be of the track
+        if (added != fixes) {
+            fprintf(stderr, "density %s: only %lu of %lu fixes counted, not timed\n", names[mode],
+                (unsigned long)added, (unsigned long)fixes);
+            heatmap_set_density(HEATMAP_DENSITY_RENDER);
+            return false;
+        }
+        ingest[mode] = fixes ? (double)us / fixes : 0;
+        render[mode] = render_us(frames);
+        pixels[mode] = (uint32_t)heatmap_render_width() * heatmap_render_height();
+        per_pixel[mode] = pixels[mode] ? render[mode] * 1000 / pixels[mode] : 0;
+        fprintf(stderr, "density %s: %.3f us per fix, %.1f us per %ux%u render (%.1f ns per pixel) of %lu cells\n",
+            names[mode], ingest[mode], render[mode], heatmap_render_width(), heatmap_render_height(),
+            per_pixel[mode], (unsigned long)heatmap_size());
+    }
+    heatmap_set_density(HEATMAP_DENSITY_RENDER);
+    uint32_t at = pixels[HEATMAP_DENSITY_INGEST];
+    double saved = (per_pixel[HEATMAP_DENSITY_RENDER] - per_pixel[HEATMAP_DENSITY_INGEST]) * at / 1000;
+    double cost = ingest[HEATMAP_DENSITY_INGEST] - ingest[HEATMAP_DENSITY_RENDER];
+    if (saved > 0 && cost > 0) {
+        fprintf(stderr, "density crossover: for %lu-pixel images, ingest mode wins above one render per %.0f fixes\n",
+            (unsigned long)at, saved / cost);
+    }
+    return true;
+}
+
+// Block stores the persistence benchmark runs over
+typedef struct {
+    const char *name;
+    bool file;
+    bool sync;
+    uint32_t block_size;
+} bench_store_t;
+
+static bool bench_open(block_store_t *store, const bench_store_t *b, uint32_t size, uint8_t *ram) {
+    if (!b->file) {
+        block_store_ram_init(store, ram, size, b->block_size);
+        return true;
+    }
+    char path[] = "/tmp/gps-heat-mapper-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    bool ok = file_store_open(store, path, size, b->block_size, b->sync);
+    // The open file lives on until it is closed
+    unlink(path);
+    return ok;
+}
+
+static void bench_close(block_store_t *store, const bench_store_t *b) {
+    if (b->file) {
+        file_store_close(store);
+    }
+}
+
+// Log the track and snapshot its heatmap into each kind of store, then read both back as
+// after a reboot and check them against the track
+static void bench_store(void) {
+    static const bench_store_t stores[] = {
+        { "ram", false, false, 512 },
+        { "ram", false, false, 4096 },
+        { "file", true, false, 512 },
+        { "file", true, false, 4096 },
+        { "file+sync", true, true, 4096 },
+    };
+    static uint8_t log_ram[RAM_LOG_SIZE];
+    static uint8_t map_ram[HEATMAP_STORE_SIZE(BLOCK_STORE_MAX_BLOCK)];
+    uint32_t fixes = track_end() - track_begin();
+    for (size_t i = 0; i < sizeof(stores) / sizeof(stores[0]); i++) {
+        const bench_store_t *b = &stores[i];
+        block_store_t log, map;
+        if (!bench_open(&log, b, RAM_LOG_SIZE, log_ram)) {
+            fprintf(stderr, "store %s: cannot open\n", b->name);
+            continue;
+        }
+        if (!bench_open(&map, b, HEATMAP_STORE_SIZE(b->block_size), map_ram)) {
+            fprintf(stderr, "store %s: cannot open\n", b->name);
+            bench_close(&log, b);
+            continue;
+        }
+
+        fix_log_init(&log);
+        uint64_t start = time_us_64();
+        for (uint32_t seq = track_begin(); seq != track_end(); seq++) {
+            fix_log_append(track_get(seq));
+            fix_log_step();
+        }
+        fix_log_flush();
+        uint64_t append_us = time_us_64() - start;
+        uint32_t end = fix_log_end();
+        start = time_us_64();
+        fix_log_init(&log);
+        uint64_t resume_us = time_us_64() - start;
+        uint32_t mismatches = fix_log_end() != end;
+        for (uint32_t seq = fix_log_begin(); seq != fix_log_end(); seq++) {
+            gps_fix_t fix;
+            const gps_fix_t *want = track_get(track_begin() + seq);
+            if (!fix_log_read(seq, &fix) || fix.time != want->time || fix.lat_e7 != want->lat_e7 ||
+                    fix.lon_e7 != want->lon_e7) {
+                mismatches++;
+            }
+        }
+        fprintf(stderr, "store %s/%lu fix log: %.3f us per fix, %.1f us per block write, "
+            "resumed %lu fixes in %lu us (%lu reads), %lu mismatches\n", b->name, (unsigned long)b->block_size,
+            fixes ? (double)append_us / fixes : 0.0,
+            log.stats.blocks_written ? (double)log.stats.write_us / log.stats.blocks_written : 0.0,
+            (unsigned long)fix_log_get_stats()->resumed, (unsigned long)resume_us,
+            (unsigned long)fix_log_get_stats()->resume_reads, (unsigned long)mismatches);
+
+        // Fold the overlay in whenever it fills, as housekeeping would
+        heatmap_init();
+        heatmap_store_init(&map);
+        uint64_t snapshot_us = 0;
+        for (uint32_t seq = track_begin(); seq != track_end(); seq++) {
+            const gps_fix_t *fix = track_get(seq);
+            heatmap_add(fix->lat_e7, fix->lon_e7);
+            if (heatmap_overlay_size() >= HEATMAP_STORE_OVERLAY_HIGH || seq + 1 == track_end()) {
+                start = time_us_64();
+                heatmap_store_flush();
+                snapshot_us += time_us_64() - start;
+            }
+        }
+        size_t cells = heatmap_size();
+        uint32_t compactions = heatmap_store_get_stats()->compactions;
+        heatmap_init();
+        heatmap_store_init(&map);
+        fprintf(stderr, "store %s/%lu heatmap: %lu compactions in %lu us, restored %lu of %lu cells in %lu us\n",
+            b->name, (unsigned long)b->block_size, (unsigned long)compactions, (unsigned long)snapshot_us,
+            (unsigned long)heatmap_store_get_stats()->restored, (unsigned long)cells,
+            (unsigned long)heatmap_store_get_stats()->restore_us);
+
+        bench_close(&log, b);
+        bench_close(&map, b);
+    }
+}
+
+int main(int argc, char **argv) {
+    int port = 8080;
+    int nmea_fd = -1;
+    int bench_frames = 0;
+    const char *map_file = NULL;
+    const char *log_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:m:l:b:")) != -1) {
+        switch (opt) {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'n':
+                nmea_fd = strcmp(optarg, "-") == 0 ? STDIN_FILENO : open(optarg, O_RDONLY);
+                if (nmea_fd < 0) {
+                    perror(optarg);
+                    return 1;
+                }
+                fcntl(nmea_fd, F_SETFL, fcntl(nmea_fd, F_GETFL) | O_NONBLOCK);
+                break;
+            case 'm':
+                map_file = optarg;
+                break;
+            case 'l':
+                log_file = optarg;
+                break;
+            case 'b':
+                bench_frames = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-p PORT] [-n NMEA_FILE|-] [-m MAP_FILE] [-l LOG_FILE] [-b FRAMES]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    power_init(NULL, POWER_DEFAULT_MODE);
+    static block_store_t map_store, log_store;
+    static uint8_t log_ram[RAM_LOG_SIZE];
+    if (!map_file) {
+        block_store_flash_init(&map_store, FLASH_HEATMAP_OFFSET, FLASH_HEATMAP_SIZE);
+    } else if (!file_store_open(&map_store, map_file, FLASH_HEATMAP_SIZE, FLASH_SECTOR_SIZE, false)) {
+        perror(map_file);
+        return 1;
+    }
+    if (!log_file) {
+        block_store_ram_init(&log_store, log_ram, sizeof(log_ram), RAM_LOG_BLOCK);
+    } else if (!file_store_open(&log_store, log_file, FLASH_FIX_LOG_SIZE, FLASH_SECTOR_SIZE, false)) {
+        perror(log_file);
+        return 1;
+    }
+
+    heatmap_init();
+    heatmap_store_init(&map_store);
+    track_init();
+    fix_log_init(&log_store);
+    fprintf(stderr, "heatmap restored %lu cells in %lu us from %s, fix log resumed %lu fixes from %s\n",
+        (unsigned long)heatmap_store_get_stats()->restored, (unsigned long)heatmap_store_get_stats()->restore_us,
+        map_store.name, (unsigned long)fix_log_get_stats()->resumed, log_store.name);
+    trips_init();
+    ingest_init();
+    build_http_page("<!DOCTYPE html><html><body><h1>gps-heat-mapper host build</h1></body></html>");
+
+    if (bench_frames > 0) {
+        while (nmea_fd >= 0 && read_nmea(nmea_fd)) {
+        }
+        bench_nmea();
+        // The grid and density benchmarks take as much of the track as the table holds
+        uint32_t end = counted_end();
+        bool counted = bench_grid(end);
+        bench_render(bench_frames);
+        counted = bench_density(end, bench_frames) && counted;
+        bench_store();
+        return counted ? 0 : 1;
+    }
+
+    struct tcp_pcb *pcb = tcp_new();
+    if (pcb == NULL || tcp_bind(pcb, IP_ADDR_ANY, port) != ERR_OK || (pcb = tcp_listen(pcb)) == NULL) {
+        return 1;
+    }
+    tcp_accept(pcb, http_accept);
+    fprintf(stderr, "listening on http://127.0.0.1:%d/\n", port);
+
+    uint64_t next_stats = time_us_64() + STATS_INTERVAL_US;
+    while (running) {
+        bool nmea_ready = false;
+        // Don't sleep while the density layer is being rebuilt
+        shim_run_once(heatmap_density_pending() ? 0 : 1000, nmea_fd, &nmea_ready);
+        if (nmea_ready && !read_nmea(nmea_fd)) {
+            fprintf(stderr, "end of NMEA input\n");
+            nmea_fd = -1;
+        }
+        heatmap_density_step();
+        heatmap_store_step();
+        fix_log_step();
+        power_step();
+        if (time_us_64() >= next_stats) {
+            next_stats += STATS_INTERVAL_US;
+            print_stats();
+        }
+    }
+    // Keep what was gathered since the last snapshot, as a planned shutdown on the device would
+    heatmap_store_flush();
+    fix_log_flush();
+    print_stats();
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef _ARM_ACLE_H_
+#define _ARM_ACLE_H_
+
+#include <stdint.h>
+
+// Plain-C stand-ins for the ACLE intrinsics heatmap_blur.h uses, as the Arm ARM defines
+// the instructions, so test_blur can run the DSP blur on the host
+
+// SMLAD: both signed halfword products plus the accumulator, wrapping at 32 bits
+static inline int32_t __smlad(uint32_t a, uint32_t b, int32_t acc) {
+    int64_t lo = (int64_t)(int16_t)(a & 0xffff) * (int16_t)(b & 0xffff);
+    int64_t hi = (int64_t)(int16_t)(a >> 16) * (int16_t)(b >> 16);
+    return (int32_t)(uint32_t)(lo + hi + acc);
+}
+
+// SSAT: x clamped to a signed field of the given width
+static inline int32_t __ssat(int32_t x, unsigned bits) {
+    int32_t max = (int32_t)((1u << (bits - 1)) - 1);
+    return x > max ? max : x < -max - 1 ? -max - 1 : x;
+}
+
+#endif
@@ -0,0 +1,80 @@
+// Checks the render's DSP blur against the plain-C one: random splat rows of every width,
+// sparse, dense and saturated, through blur_h_dsp() and blur_h_scalar(), and random counts
+// through both splat_add()s. The DSP intrinsics come from the stand-ins in test/acle.
+// Exits non-zero on the first mismatch.
+
+#define HEATMAP_BLUR_DSP 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heatmap_blur.h"
+
+#define ROWS_PER_WIDTH 64
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            if (++failures > 10) { \
+                exit(1); \
+            } \
+        } \
+    } while (0)
+
+// Laid out as blur_row() has it: the radius either side, and one more for an odd width
+static int16_t splat[HEATMAP_RENDER_MAX + 2 * HEATMAP_RENDER_RADIUS + 1];
+static uint32_t scalar[HEATMAP_RENDER_MAX + 1], dsp[HEATMAP_RENDER_MAX + 1];
+
+static int16_t random_count(unsigned *seed, int kind) {
+    switch (kind) {
+        case 0:     // a track: mostly empty pixels, a few visits each
+            return rand_r(seed) % 8 ? 0 : rand_r(seed) % 16;
+        case 1:     // anything a splat can hold
+            return rand_r(seed) % (SPLAT_MAX + 1);
+        default:    // every pixel saturated, the largest sums the kernel makes
+            return SPLAT_MAX;
+    }
+}
+
+static void check_blur(void) {
+    unsigned seed = 1;
+    int rows = 0;
+    for (uint32_t width = 1; width <= HEATMAP_RENDER_MAX; width++) {
+        for (int r = 0; r < ROWS_PER_WIDTH; r++, rows++) {
+            int kind = r % 3;
+            // The padding is random too, so both must read exactly the same taps
+            for (size_t i = 0; i < sizeof(splat) / sizeof(splat[0]); i++) {
+                splat[i] = random_count(&seed, kind);
+            }
+            memset(scalar, 0xa5, sizeof(scalar));
+            memset(dsp, 0x5a, sizeof(dsp));
+            blur_h_scalar(splat + HEATMAP_RENDER_RADIUS, scalar, width);
+            blur_h_dsp(splat + HEATMAP_RENDER_RADIUS, dsp, width);
+            CHECK(memcmp(scalar, dsp, width * sizeof(scalar[0])) == 0,
+                "width %lu, row %d: DSP blur differs from scalar", (unsigned long)width, r);
+        }
+    }
+    fprintf(stderr, "%d rows blur the same both ways\n", rows);
+}
+
+static void check_splat(void) {
+    unsigned seed = 2;
+    for (int i = 0; i < 1000000; i++) {
+        int16_t s = random_count(&seed, i % 3);
+        uint16_t count = i & 1 ? rand_r(&seed) % 64 : (uint16_t)rand_r(&seed);
+        CHECK(splat_add_scalar(s, count) == splat_add_dsp(s, count), "splat_add(%d, %u): %d scalar, %d DSP",
+            s, count, splat_add_scalar(s, count), splat_add_dsp(s, count));
+    }
+}
+
+int main(void) {
+    check_blur();
+    check_splat();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
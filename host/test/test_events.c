@@ -0,0 +1,220 @@
+// Checks that the event stream only ever carries whole events, however the send buffer,
+// acks and write failures fall: clients are streamed from a shared ring, skipped ahead when
+// they fall behind and dropped when too slow, and none of that may hand a browser half an
+// event glued to the next. events.c runs over the stand-in TCP functions below instead of
+// host/lwip_shim.c. Exits non-zero on the first mismatch.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "events.h"
+
+#define SNDBUF 512
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            if (++failures > 10) { \
+                exit(1); \
+            } \
+        } \
+    } while (0)
+
+// One client connection: what it was sent, and what lwIP would still hold unacked
+static struct {
+    struct tcp_pcb *pcb;
+    void *arg;
+    tcp_sent_fn sent;
+    tcp_recv_fn recv;
+    char stream[1 << 19];
+    size_t len;
+    uint16_t inflight;
+    uint16_t window;        // send buffer the test allows beyond what is in flight
+    bool aborted;
+    bool fail_writes;
+} conn;
+
+static unsigned seed = 1;
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) {
+    conn.arg = arg;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {
+    conn.sent = sent;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+    conn.recv = recv;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {
+}
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval) {
+}
+
+u16_t tcp_sndbuf(const struct tcp_pcb *pcb) {
+    return SNDBUF - conn.inflight < conn.window ? SNDBUF - conn.inflight : conn.window;
+}
+
+u16_t tcp_sndqueuelen(const struct tcp_pcb *pcb) {
+    return 0;
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags) {
+    // Out of pbufs now and then, as on the device under load
+    if (len > tcp_sndbuf(pcb) || (conn.fail_writes && rand_r(&seed) % 4 == 0)) {
+        return ERR_MEM;
+    }
+    CHECK(conn.len + len <= sizeof(conn.stream), "stream buffer overflow");
+    memcpy(conn.stream + conn.len, dataptr, len);
+    conn.len += len;
+    conn.inflight += len;
+    return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+    return ERR_OK;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len) {
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+    return 0;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+    conn.aborted = true;
+}
+
+// The stream after the response headers must be whole events, but for one cut short by the
+// connection being dropped, which the browser discards
+static void check_stream(const char *what) {
+    const char *p = strstr(conn.stream, "\r\n\r\n");
+    CHECK(p != NULL, "%s: no response headers", what);
+    if (p == NULL) {
+        return;
+    }
+    const char *end = conn.stream + conn.len;
+    for (p += 4; p < end;) {
+        const char *blank = memmem(p, end - p, "\n\n", 2);
+        if (blank == NULL) {
+            CHECK(conn.aborted, "%s: stream ends part way through an event", what);
+            return;
+        }
+        bool whole = (strncmp(p, "event: cell\ndata: {", 19) == 0 || strncmp(p, "event: fix\ndata: {", 18) == 0) &&
+            blank[-1] == '}' && memchr(p + 12, '\n', blank - p - 12) == NULL;
+        CHECK(whole, "%s: broken event at byte %ld: %.40s", what, (long)(p - conn.stream), p);
+        p = blank + 2;
+    }
+}
+
+static void attach(void) {
+    memset(&conn, 0, sizeof(conn));
+    conn.pcb = (struct tcp_pcb *)&conn;
+    conn.window = SNDBUF;
+    CHECK(events_attach(conn.pcb) == ERR_OK, "attach failed");
+}
+
+// The viewer goes away, freeing the client slot
+static void detach(void) {
+    if (!conn.aborted) {
+        conn.recv(conn.arg, conn.pcb, NULL, ERR_OK);
+    }
+}
+
+static void ack(uint16_t len) {
+    len = len < conn.inflight ? len : conn.inflight;
+    conn.inflight -= len;
+    conn.sent(conn.arg, conn.pcb, len);
+}
+
+// Let the client catch up: a wrapped event whose second piece was refused is still to come
+static void drain(void) {
+    conn.fail_writes = false;
+    for (int i = 0; i < 1000 && !conn.aborted; i++) {
+        conn.window = SNDBUF;
+        ack(conn.inflight);
+        if (conn.inflight == 0) {
+            break;
+        }
+    }
+}
+
+static void publish(uint32_t i) {
+    if (i % 3) {
+        Heatmap cell = { .loc_id = i * 2654435761u, .count = i % 1000 };
+        events_publish_cell(&cell);
+    } else {
+        gps_fix_t fix = { .time = i, .lat_e7 = -515000000 + (int32_t)i, .lon_e7 = (int32_t)i, .quality = 1 };
+        events_publish_fix(&fix);
+    }
+}
+
+// The send buffer has room for part of an event, everything queued is acked, and then the
+// ring laps the client: it must be skipped ahead to the start of an event, not mid-way
+static void check_lapped(void) {
+    attach();
+    ack(conn.inflight);
+    conn.window = 20;
+    publish(1);
+    conn.window = 0;
+    ack(conn.inflight);
+    for (uint32_t i = 0; i < 2 * EVENTS_RING_SIZE / 32; i++) {
+        publish(i);
+    }
+    conn.window = SNDBUF;
+    publish(7);
+    check_stream("lapped client");
+    CHECK(!conn.aborted, "lapped client was dropped instead of skipped ahead");
+    detach();
+}
+
+// Random send buffer, acks, write failures and bursts
+static void check_random(void) {
+    uint32_t i = 0;
+    int rounds = 0, dropped = 0;
+    for (int run = 0; run < 1000; run++) {
+        attach();
+        conn.fail_writes = true;
+        for (int step = 0; step < 500 && !conn.aborted; step++) {
+            int burst = rand_r(&seed) % 64 ? 1 : rand_r(&seed) % 200;
+            for (int b = 0; b < burst && !conn.aborted; b++) {
+                publish(i++);
+            }
+            if (!conn.aborted && rand_r(&seed) % 2 == 0) {
+                // The send buffer shuts, opens by less than an event or all the way, and acks
+                // come for some or all of what is in flight
+                static const uint16_t windows[] = { 0, 20, 50, SNDBUF };
+                conn.window = windows[rand_r(&seed) % 4];
+                ack(rand_r(&seed) % 2 ? conn.inflight : rand_r(&seed) % (conn.inflight + 1));
+            }
+        }
+        drain();
+        check_stream("random client");
+        dropped += conn.aborted;
+        rounds++;
+        detach();
+    }
+    fprintf(stderr, "%d random clients streamed whole events (%d dropped as too slow)\n", rounds, dropped);
+}
+
+int main(void) {
+    check_lapped();
+    check_random();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
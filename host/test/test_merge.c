@@ -0,0 +1,199 @@
+// Checks that merging a grid dump larger than the RAM overlay loses no cells: every new cell
+// needs an overlay slot, so the merge must wait for compactions into a snapshot to empty the
+// overlay rather than drop what does not fit. Dumps are fed in random pieces, with fixes
+// counted in between, and the cells read back are checked against a model of the sums. Runs
+// heatmap.c and heatmap_store.c over a RAM block store. Exits non-zero on the first mismatch.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hardware/flash.h"
+#include "heatmap.h"
+#include "heatmap_store.h"
+
+#define ORIGIN_LAT_E7 515000000
+#define ORIGIN_LON_E7 -1200000
+#define BLOCK_SIZE 512
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            if (++failures > 10) { \
+                exit(1); \
+            } \
+        } \
+    } while (0)
+
+// Backs hardware/flash.h for block_store.c's flash backend, which is not used here
+uint8_t shim_flash[PICO_FLASH_SIZE_BYTES];
+
+static uint8_t store_ram[HEATMAP_STORE_SIZE(BLOCK_SIZE)];
+static block_store_t store;
+
+// Expected count of each cell, by row and column off the origin
+#define SPAN 128
+static uint32_t model[SPAN][SPAN];
+
+static struct {
+    heatmap_grid_header_t hdr;
+    Heatmap cells[HEATMAP_MAX_CELLS];
+} dump;
+
+static unsigned seed = 1;
+static uint32_t waits;
+
+static uint32_t loc_of(int row, int col) {
+    return (uint32_t)(row + HEATMAP_INDEX_BIAS) << 16 | (uint32_t)(col + HEATMAP_INDEX_BIAS);
+}
+
+static void reset(void) {
+    heatmap_init();
+    block_store_ram_init(&store, store_ram, sizeof(store_ram), BLOCK_SIZE);
+    memset(store_ram, 0xff, sizeof(store_ram));
+    CHECK(heatmap_store_init(&store), "store init failed");
+    memset(model, 0, sizeof(model));
+}
+
+// A dump of n cells picked at random from the span, in loc_id order
+static size_t make_dump(size_t n) {
+    memcpy(dump.hdr.magic, HEATMAP_GRID_MAGIC, sizeof(dump.hdr.magic));
+    dump.hdr.version = HEATMAP_GRID_VERSION;
+    dump.hdr.header_size = sizeof(dump.hdr);
+    dump.hdr.origin_lat_e7 = ORIGIN_LAT_E7;
+    dump.hdr.origin_lon_e7 = ORIGIN_LON_E7;
+    dump.hdr.cell_e7 = HEATMAP_CELL_E7;
+    size_t count = 0;
+    for (int row = 0; row < SPAN; row++) {
+        for (int col = 0; col < SPAN; col++) {
+            // Take each of the cells left with the odds of filling the dump
+            size_t left = (size_t)(SPAN - row) * SPAN - col;
+            if (count < n && (size_t)rand_r(&seed) % left < n - count) {
+                uint16_t c = 1 + rand_r(&seed) % 50;
+                dump.cells[count++] = (Heatmap){ .loc_id = loc_of(row, col), .count = c };
+                model[row][col] += c;
+            }
+        }
+    }
+    return sizeof(dump.hdr) + count * sizeof(Heatmap);
+}
+
+// A fix in the middle of a cell of the span
+static void add_fix_at(int row, int col) {
+    if (heatmap_add(ORIGIN_LAT_E7 + row * HEATMAP_CELL_E7 + HEATMAP_CELL_E7 / 2,
+                    ORIGIN_LON_E7 + col * HEATMAP_CELL_E7 + HEATMAP_CELL_E7 / 2)) {
+        model[row][col]++;
+    }
+}
+
+static void add_fix(void) {
+    add_fix_at(rand_r(&seed) % SPAN, rand_r(&seed) % SPAN);
+}
+
+// Feed the dump in random pieces, as the HTTP server does: whatever the merge does not take
+// is offered again once a compaction has run
+static heatmap_merge_stats_t merge(size_t len, bool fixes, bool compact) {
+    static int owner;
+    const uint8_t *data = (const uint8_t *)&dump;
+    heatmap_merge_stats_t stats = { 0 };
+    CHECK(heatmap_merge_begin(&owner), "merge begin failed");
+    for (size_t at = 0; at < len || heatmap_merge_waiting(&owner);) {
+        size_t piece = 1 + rand_r(&seed) % 1460;
+        piece = piece < len - at ? piece : len - at;
+        size_t taken;
+        CHECK(heatmap_merge_feed(&owner, data + at, piece, &taken), "feed failed at byte %zu", at);
+        at += taken;
+        if (heatmap_merge_waiting(&owner)) {
+            waits++;
+            if (compact) {
+                while (heatmap_store_step()) {
+                }
+                CHECK(heatmap_overlay_size() < HEATMAP_OVERLAY_CELLS, "compaction made no room");
+            } else {
+                heatmap_merge_drop_excess(&owner);
+            }
+        }
+        if (fixes && rand_r(&seed) % 4 == 0) {
+            add_fix();
+        }
+    }
+    CHECK(heatmap_merge_end(&owner, &stats), "merge end failed");
+    return stats;
+}
+
+// Every cell read back must match the model, and every cell of the model must be read
+static void check_cells(const char *what) {
+    static uint32_t seen[SPAN][SPAN];
+    memset(seen, 0, sizeof(seen));
+    uint64_t cursor = 0;
+    Heatmap buf[64];
+    size_t n, total = 0;
+    while ((n = heatmap_read_cells(&cursor, buf, sizeof(buf))) > 0) {
+        for (size_t i = 0; i < n / sizeof(Heatmap); i++) {
+            int row = (int)(buf[i].loc_id >> 16) - HEATMAP_INDEX_BIAS;
+            int col = (int)(buf[i].loc_id & 0xffff) - HEATMAP_INDEX_BIAS;
+            CHECK(row >= 0 && row < SPAN && col >= 0 && col < SPAN, "%s: cell %08lx off the span", what,
+                (unsigned long)buf[i].loc_id);
+            if (row >= 0 && row < SPAN && col >= 0 && col < SPAN) {
+                seen[row][col] = buf[i].count;
+            }
+            total++;
+        }
+    }
+    size_t expected = 0;
+    for (int row = 0; row < SPAN; row++) {
+        for (int col = 0; col < SPAN; col++) {
+            expected += model[row][col] != 0;
+            CHECK(seen[row][col] == model[row][col], "%s: cell %d,%d counts %lu, expected %lu", what, row, col,
+                (unsigned long)seen[row][col], (unsigned long)model[row][col]);
+        }
+    }
+    CHECK(total == expected && total == heatmap_size(), "%s: %zu cells read, expected %zu (size %zu)", what,
+        total, expected, heatmap_size());
+}
+
+// A dump of 3552 cells, three and a half overlays, into an empty unit
+static void check_large(void) {
+    reset();
+    size_t len = make_dump(3552);
+    heatmap_merge_stats_t s = merge(len, false, true);
+    CHECK(s.added == 3552 && s.merged == 0 && s.dropped == 0, "large: added %lu merged %lu dropped %lu",
+        (unsigned long)s.added, (unsigned long)s.merged, (unsigned long)s.dropped);
+    check_cells("large");
+}
+
+// Two overlapping dumps with fixes counted while they stream in, kept within the table
+static void check_overlap(void) {
+    reset();
+    // The first fix puts the grid's origin where the dumps have theirs
+    add_fix_at(0, 0);
+    for (int i = 0; i < 300; i++) {
+        add_fix();
+    }
+    merge(make_dump(1500), true, true);
+    merge(make_dump(1500), true, true);
+    check_cells("overlap");
+}
+
+// With no compaction coming the merge gives up waiting and drops what does not fit
+static void check_no_room(void) {
+    reset();
+    size_t len = make_dump(3000);
+    heatmap_merge_stats_t s = merge(len, false, false);
+    CHECK(s.added == HEATMAP_OVERLAY_CELLS && s.added + s.dropped == 3000, "no room: added %lu dropped %lu",
+        (unsigned long)s.added, (unsigned long)s.dropped);
+}
+
+int main(void) {
+    check_large();
+    check_overlap();
+    check_no_room();
+    fprintf(stderr, "%lu waits for room in the overlay\n", (unsigned long)waits);
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
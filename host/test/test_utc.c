@@ -0,0 +1,117 @@
+// Checks the integer UTC conversions against the C library: every day from 1980 to 2079,
+// through utc_from_nmea(), minmea_gettime() and utc_format(), and as RMC sentences through
+// the parser's date and time validation. Exits non-zero on the first mismatch.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "minmea.h"
+#include "utc.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            if (++failures > 10) { \
+                exit(1); \
+            } \
+        } \
+    } while (0)
+
+static bool parse_rmc(const char *body, struct minmea_sentence_rmc *frame) {
+    char line[256];
+    snprintf(line, sizeof(line), "$GPRMC,%s", body);
+    return minmea_parse_rmc(frame, line);
+}
+
+static bool parse_zda(const char *body, struct minmea_sentence_zda *frame) {
+    char line[256];
+    snprintf(line, sizeof(line), "$GPZDA,%s", body);
+    return minmea_parse_zda(frame, line);
+}
+
+static void check_days(void) {
+    struct tm first = { .tm_year = 80, .tm_mon = 0, .tm_mday = 1 };
+    struct tm last = { .tm_year = 179, .tm_mon = 11, .tm_mday = 31 };
+    time_t begin = timegm(&first), end = timegm(&last);
+    unsigned seed = 1;
+    int days = 0;
+    for (time_t day = begin; day <= end; day += 86400, days++) {
+        // Midnight, the last second and a random time in between
+        time_t times[3] = { day, day + 86399, day + rand_r(&seed) % 86400 };
+        for (int i = 0; i < 3; i++) {
+            time_t t = times[i];
+            struct tm tm;
+            gmtime_r(&t, &tm);
+            struct minmea_time time = { tm.tm_hour, tm.tm_min, tm.tm_sec, 0 };
+            struct minmea_date two = { tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100 };
+            struct minmea_date four = { tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900 };
+
+            CHECK(utc_from_nmea(&two, &time) == (uint32_t)t, "utc_from_nmea %02d-%02d-%02d: %lu, timegm %lld",
+                two.year, two.month, two.day, (unsigned long)utc_from_nmea(&two, &time), (long long)t);
+            CHECK(utc_from_nmea(&four, &time) == (uint32_t)t, "utc_from_nmea %04d-%02d-%02d differs from timegm",
+                four.year, four.month, four.day);
+            struct timespec ts;
+            CHECK(minmea_gettime(&ts, &two, &time) == 0 && ts.tv_sec == t,
+                "minmea_gettime %02d-%02d-%02d: %lld, timegm %lld", two.year, two.month, two.day,
+                (long long)ts.tv_sec, (long long)t);
+
+            char want[UTC_FORMAT_LEN + 1], got[UTC_FORMAT_LEN + 1];
+            strftime(want, sizeof(want), "%Y-%m-%dT%H:%M:%SZ", &tm);
+            got[utc_format(got, (uint32_t)t)] = '\0';
+            CHECK(strcmp(got, want) == 0, "utc_format %lld: %s, strftime %s", (long long)t, got, want);
+
+            // The same instant as the receiver sends it
+            char body[128];
+            struct minmea_sentence_rmc rmc;
+            snprintf(body, sizeof(body), "%02d%02d%02d.00,A,5130.0000,N,00007.0000,W,0.0,0.0,%02d%02d%02d,,,A",
+                tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_mday, tm.tm_mon + 1, tm.tm_year % 100);
+            CHECK(parse_rmc(body, &rmc) && utc_from_nmea(&rmc.date, &rmc.time) == (uint32_t)t,
+                "RMC %s does not give %lld", body, (long long)t);
+        }
+    }
+    fprintf(stderr, "%d days from 1980 to 2079 match timegm and strftime\n", days);
+}
+
+static void check_validation(void) {
+    struct minmea_sentence_rmc rmc;
+    static const char *const bad_rmc[] = {
+        "000000.00,A,,,,,,,000124,,,A",     // day 0
+        "000000.00,A,,,,,,,320124,,,A",     // day 32
+        "000000.00,A,,,,,,,010024,,,A",     // month 0
+        "000000.00,A,,,,,,,011324,,,A",     // month 13
+        "000000.00,A,,,,,,,0101,,,A",       // short date
+        "240000.00,A,,,,,,,010124,,,A",     // hour 24
+        "236000.00,A,,,,,,,010124,,,A",     // minute 60
+        "235961.00,A,,,,,,,010124,,,A",     // second 61
+    };
+    for (size_t i = 0; i < sizeof(bad_rmc) / sizeof(bad_rmc[0]); i++) {
+        CHECK(!parse_rmc(bad_rmc[i], &rmc), "RMC %s accepted", bad_rmc[i]);
+    }
+    // A leap second is a real time of day
+    CHECK(parse_rmc("235960.00,A,,,,,,,311216,,,A", &rmc) && rmc.time.seconds == 60, "leap second rejected");
+    // No date at all is allowed and gives the time of day on 1970-01-01
+    CHECK(parse_rmc("120000.00,V,,,,,,,,,,N", &rmc) && rmc.date.year == -1 &&
+        utc_from_nmea(&rmc.date, &rmc.time) == 12 * 3600, "empty RMC date");
+
+    struct minmea_sentence_zda zda;
+    CHECK(parse_zda("160012.71,11,03,2004,-1,00", &zda), "ZDA rejected");
+    CHECK(!parse_zda("160012.71,11,03,1979,00,00", &zda), "ZDA before 1980 accepted");
+    CHECK(!parse_zda("160012.71,11,03,10000,00,00", &zda), "ZDA with a five digit year accepted");
+    CHECK(!parse_zda("160012.71,11,13,2004,00,00", &zda), "ZDA month 13 accepted");
+    CHECK(!parse_zda("160012.71,11,03,2004,14,00", &zda), "ZDA zone 14 hours accepted");
+}
+
+int main(void) {
+    check_days();
+    check_validation();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -1,12 +1,137 @@
 #include "http_server.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
+#include <strings.h>
 #include "lwip/tcp.h"
 #include "lwip/pbuf.h"
 #include "pico/cyw43_arch.h"
+#include "power.h"
+#include "events.h"
+#include "web_assets.h"
+#include "heatmap.h"
+#include "heatmap_render.h"
+#include "track_export.h"
+#include "trips.h"
 
-void build_http_page(char *msg) {
+// Only the request line and the start of the headers are looked at
+#define HTTP_REQUEST_MAX 512
+
+// Connections are polled every HTTP_POLL_INTERVAL * 500 ms to retry stalled responses and
+// to time out clients that stop talking
+#define HTTP_POLL_INTERVAL 1
+#define HTTP_TICKS_PER_S (2 / HTTP_POLL_INTERVAL)
+
+_Static_assert(HTTP_MAX_CONNS + EVENTS_MAX_CLIENTS < MEMP_NUM_TCP_PCB,
+    "lwIP needs a pcb for every HTTP slot and event stream plus the listener");
+
+// Generated bodies are produced in pieces of up to this size and copied into lwIP
+#define HTTP_CHUNK_SIZE TCP_MSS
+
+static const char http_bad_request[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char http_length_required[] =
+    "HTTP/1.1 411 Length Required\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char http_continue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static const char http_not_allowed[] =
+    "HTTP/1.1 405 Method Not Allowed\r\n"
+    "Allow: GET\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char http_binary_headers[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char http_bmp_headers[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: image/bmp\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char http_json_headers[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/json\r\n"
+    "Cache-Control: no-store\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// Track exports: a snapshot of the stored fixes with a known length, so downloads can be
+// resumed with Range requests. The ETag names the snapshot.
+typedef struct {
+    const char *path;
+    const char *content_type;
+    const char *filename;
+    export_format_t format;
+} export_route_t;
+
+static const export_route_t export_routes[] = {
+    { "/export/track.gpx", "application/gpx+xml", "track.gpx", EXPORT_GPX },
+    { "/export/track.geojson", "application/geo+json", "track.geojson", EXPORT_GEOJSON },
+    { "/export/track.csv", "text/csv", "track.csv", EXPORT_CSV },
+    { "/export/track.bin", "application/octet-stream", "track.bin", EXPORT_RAW },
+};
+
+static const char http_unavailable[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 5\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+typedef struct http_conn_t_ http_conn_t;
+
+// Produces the next piece of a generated body into buf; returns 0 when the body is complete
+typedef size_t (*http_body_fn)(http_conn_t *conn, uint8_t *buf, size_t len);
+
+// Where a generated body has got to; copied so a piece can be produced again
+typedef union {
+    struct {
+        bool header_sent;
+        uint64_t cursor;
+    } grid;
+    export_cursor_t export;
+    uint32_t trips;
+    uint32_t bmp;
+} http_body_state_t;
+
+struct http_conn_t_ {
+    struct tcp_pcb *pcb;        // NULL while the slot is free
+    uint16_t idle_ticks;        // polls since the client last sent or acked anything
+    bool responding;
+    const uint8_t *tx_ptr;      // rest of a response that lives in flash
+    uint32_t tx_remaining;
+    uint32_t tx_unacked;
+    http_body_fn body;          // generated body, sent after the flash part
+    http_body_state_t state;
+    heatmap_view_t view;        // cells a grid dump is sent from
+    uint32_t upload_remaining;  // request body bytes still to come
+    struct pbuf *held;          // upload data the merge has no room for yet, not tcp_recved
+    uint16_t held_offset;       // bytes of it already fed
+};
+
+static http_conn_t http_conns[HTTP_MAX_CONNS];
+static http_stats_t http_stats;
+
+// Generated pieces are copied by tcp_write straight away, so one buffer serves every connection
+static uint8_t http_chunk[HTTP_CHUNK_SIZE] __attribute__((aligned(4)));
+
+void build_http_page(const char *msg) {
     snprintf(html_page, 512,
         "HTTP/1.1 200 OK\r\n"
         "Content-Type: text/html\r\n"
@@ -17,50 +142,611 @@ void build_http_page(char *msg) {
         (int)strlen(msg), msg);
 }
 
-// Callback function for ack and closes connection
+// Give back what the connection holds besides its pcb, however the connection ended
+static void http_conn_release(http_conn_t *conn) {
+    heatmap_render_end(conn);
+    // An upload cut short still has its pending cells applied, on top of those it already
+    // summed in place, so an ingest-mode density layer is stale either way
+    heatmap_merge_stats_t merged = { 0 };
+    heatmap_merge_end(conn, &merged);
+    if (merged.merged || merged.added) {
+        heatmap_density_invalidate();
+    }
+    if (conn->held) {
+        pbuf_free(conn->held);
+        conn->held = NULL;
+    }
+    // A pinned view stops every later one from being brought up to date, and compaction with it
+    heatmap_view_end(&conn->view);
+}
+
+static void http_conn_free(http_conn_t *conn) {
+    tcp_arg(conn->pcb, NULL);
+    tcp_recv(conn->pcb, NULL);
+    tcp_sent(conn->pcb, NULL);
+    tcp_err(conn->pcb, NULL);
+    tcp_poll(conn->pcb, NULL, 0);
+    http_conn_release(conn);
+    conn->pcb = NULL;
+}
+
+static err_t http_close(http_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    http_conn_free(conn);
+    if (tcp_close(pcb) != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+// Drop a connection without the close handshake, freeing its pcb at once
+static err_t http_abort(http_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    http_conn_free(conn);
+    tcp_abort(pcb);
+    return ERR_ABRT;
+}
+
+// Queue as much of the response as the send buffer takes. Flash-resident data is
+// referenced, not copied, so large assets cost no RAM; generated bodies follow it.
+static err_t http_send_more(http_conn_t *conn) {
+    while (conn->tx_remaining) {
+        uint32_t len = LWIP_MIN(conn->tx_remaining, tcp_sndbuf(conn->pcb));
+        if (len == 0 || tcp_sndqueuelen(conn->pcb) >= TCP_SND_QUEUELEN) {
+            break;
+        }
+        u8_t flags = len < conn->tx_remaining ? TCP_WRITE_FLAG_MORE : 0;
+        err_t err = tcp_write(conn->pcb, conn->tx_ptr, len, flags);
+        if (err == ERR_MEM) {
+            break; // try again when something is acked
+        } else if (err != ERR_OK) {
+            return http_close(conn);
+        }
+        conn->tx_ptr += len;
+        conn->tx_remaining -= len;
+        conn->tx_unacked += len;
+    }
+    while (conn->tx_remaining == 0 && conn->body) {
+        size_t space = LWIP_MIN(sizeof(http_chunk), tcp_sndbuf(conn->pcb));
+        if (space < sizeof(http_chunk) / 2 || tcp_sndqueuelen(conn->pcb) >= TCP_SND_QUEUELEN) {
+            break; // wait for acks rather than dribbling out small segments
+        }
+        http_body_state_t resume = conn->state;
+        size_t len = conn->body(conn, http_chunk, space);
+        if (len == 0) {
+            conn->body = NULL;
+            break;
+        }
+        err_t err = tcp_write(conn->pcb, http_chunk, len, TCP_WRITE_FLAG_COPY);
+        if (err == ERR_MEM) {
+            // The lwIP heap is shared by every connection: produce this piece again once
+            // something is acked, or from http_poll if nothing of ours is in flight
+            conn->state = resume;
+            break;
+        } else if (err != ERR_OK) {
+            return http_close(conn);
+        }
+        conn->tx_unacked += len;
+    }
+    if (conn->tx_remaining == 0 && conn->body == NULL && conn->tx_unacked == 0) {
+        return http_close(conn); // all of the response has been acked
+    }
+    tcp_output(conn->pcb);
+    return ERR_OK;
+}
+
+static err_t http_respond_static(http_conn_t *conn, const void *response, uint32_t len) {
+    conn->tx_ptr = response;
+    conn->tx_remaining = len;
+    return http_send_more(conn);
+}
+
+static err_t http_respond_copy(http_conn_t *conn, const char *response, uint32_t len) {
+    if (tcp_write(conn->pcb, response, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        return http_close(conn);
+    }
+    conn->tx_unacked += len;
+    tcp_output(conn->pcb);
+    return ERR_OK;
+}
+
+static err_t http_respond_body(http_conn_t *conn, const char *headers, uint32_t len, http_body_fn body) {
+    conn->body = body;
+    return http_respond_static(conn, headers, len);
+}
+
+// Binary heatmap for the browser to render: header, then 8-byte cells in loc_id order, all
+// from the view taken when the request came in
+static size_t grid_body(http_conn_t *conn, uint8_t *buf, size_t len) {
+    size_t used = 0;
+    if (!conn->state.grid.header_sent) {
+        heatmap_grid_header((heatmap_grid_header_t *)buf);
+        ((heatmap_grid_header_t *)buf)->generation = conn->view.version;
+        conn->state.grid.header_sent = true;
+        used = sizeof(heatmap_grid_header_t);
+    }
+    used += heatmap_view_read(&conn->view, &conn->state.grid.cursor, buf + used, len - used);
+    if (used == 0) {
+        heatmap_view_end(&conn->view);
+    }
+    return used;
+}
+
+// Heatmap rendered on the device, for clients that cannot draw /api/grid.bin themselves
+static size_t bmp_body(http_conn_t *conn, uint8_t *buf, size_t len) {
+    return heatmap_render_bmp_read(&conn->state.bmp, buf, len);
+}
+
+// Trip summaries, a few at a time
+static size_t trips_body(http_conn_t *conn, uint8_t *buf, size_t len) {
+    return trips_read_json(&conn->state.trips, (char *)buf, len);
+}
+
+// Track export, encoded as send buffer space frees up
+static size_t export_body(http_conn_t *conn, uint8_t *buf, size_t len) {
+    return export_read(&conn->state.export, (char *)buf, len);
+}
+
+// Value of a request header, or NULL; the request must be nul terminated
+static const char *find_header(const char *request, const char *name) {
+    size_t len = strlen(name);
+    for (const char *line = strstr(request, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, len) == 0 && line[len] == ':') {
+            line += len + 1;
+            return line + strspn(line, " \t");
+        }
+    }
+    return NULL;
+}
+
+// Parse a single "bytes=" range against a body of the given length. Returns 1 for a
+// satisfiable range, -1 for an unsatisfiable one and 0 to send the whole body (absent,
+// malformed or multiple ranges).
+static int parse_range(const char *value, uint32_t length, uint32_t *first, uint32_t *last) {
+    if (value == NULL || strncmp(value, "bytes=", 6) != 0) {
+        return 0;
+    }
+    char *end;
+    const char *spec = value + 6;
+    if (*spec == '-') {
+        unsigned long suffix = strtoul(spec + 1, &end, 10);
+        if (end == spec + 1 || strchr("\r\n", *end) == NULL) {
+            return 0;
+        }
+        if (suffix == 0 || length == 0) {
+            return -1;
+        }
+        *first = suffix < length ? length - suffix : 0;
+        *last = length - 1;
+        return 1;
+    }
+    unsigned long a = strtoul(spec, &end, 10);
+    if (end == spec || *end != '-') {
+        return 0;
+    }
+    spec = end + 1;
+    unsigned long b = strtoul(spec, &end, 10);
+    if (end == spec) {
+        b = ULONG_MAX;
+    }
+    if (strchr("\r\n", *end) == NULL || b < a) {
+        return 0;
+    }
+    if (a >= length) {
+        return -1;
+    }
+    *first = a;
+    *last = b < length ? b : length - 1;
+    return 1;
+}
+
+// If-Range holds a previous ETag; resume that snapshot if all of it is still stored
+static bool if_range_snapshot(export_cursor_t *cursor, export_format_t format, const char *value) {
+    unsigned long begin, end;
+    int n = 0;
+    if (sscanf(value, "\"%lx-%lx\"%n", &begin, &end, &n) != 2 || n == 0) {
+        return false;
+    }
+    return export_begin_snapshot(cursor, format, begin, end);
+}
+
+static err_t http_respond_export(http_conn_t *conn, const export_route_t *route, const char *request) {
+    export_cursor_t *cursor = &conn->state.export;
+    const char *range = find_header(request, "Range");
+    const char *if_range = find_header(request, "If-Range");
+
+    if (if_range && !if_range_snapshot(cursor, route->format, if_range)) {
+        range = NULL; // representation changed: send it all
+    }
+    if (!if_range || !range) {
+        export_begin(cursor, route->format);
+    }
+
+    uint32_t length = export_length(cursor);
+    uint32_t first = 0, last = length - 1;
+    int ranged = parse_range(range, length, &first, &last);
+    int len;
+    if (ranged < 0) {
+        len = snprintf((char *)http_chunk, sizeof(http_chunk),
+            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+            "Content-Range: bytes */%lu\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            (unsigned long)length);
+        return http_respond_copy(conn, (const char *)http_chunk, len);
+    }
+
+    len = snprintf((char *)http_chunk, sizeof(http_chunk),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Disposition: attachment; filename=\"%s\"\r\n"
+        "Content-Length: %lu\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "ETag: \"%lx-%lx\"\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n",
+        ranged ? "206 Partial Content" : "200 OK", route->content_type, route->filename,
+        ranged ? (unsigned long)(last - first + 1) : (unsigned long)length,
+        (unsigned long)cursor->begin, (unsigned long)cursor->end);
+    if (ranged) {
+        len += snprintf((char *)http_chunk + len, sizeof(http_chunk) - len,
+            "Content-Range: bytes %lu-%lu/%lu\r\n", (unsigned long)first, (unsigned long)last, (unsigned long)length);
+        export_seek(cursor, first, last);
+    }
+    len += snprintf((char *)http_chunk + len, sizeof(http_chunk) - len, "\r\n");
+
+    if (tcp_write(conn->pcb, http_chunk, len, TCP_WRITE_FLAG_COPY) != ERR_OK) {
+        return http_close(conn);
+    }
+    conn->tx_unacked += len;
+    conn->body = length ? export_body : NULL;
+    return http_send_more(conn);
+}
+
+static const web_asset_t *find_asset(const char *path, size_t len) {
+    if (len == 1 && path[0] == '/') {
+        path = "/index.html";
+        len = strlen(path);
+    }
+    for (size_t i = 0; i < web_assets_count; i++) {
+        if (strlen(web_assets[i].path) == len && memcmp(web_assets[i].path, path, len) == 0) {
+            return &web_assets[i];
+        }
+    }
+    return NULL;
+}
+
+static bool path_is(const char *path, size_t len, const char *route) {
+    return strlen(route) == len && memcmp(path, route, len) == 0;
+}
+
+// Callback function for ack; sends more, and closes the connection once the whole response is acked
 err_t http_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) { 
-    tcp_close(tpcb);
+    http_conn_t *conn = arg;
+    conn->idle_ticks = 0;
+    conn->tx_unacked -= LWIP_MIN(len, conn->tx_unacked);
+    // An interim 100 Continue is all that can be in flight before the response
+    return conn->responding ? http_send_more(conn) : ERR_OK;
+}
+
+static err_t http_upload_resume(http_conn_t *conn);
+
+// Retries sending when a response stalled for lack of buffer space, or an upload for room
+static err_t http_poll(void *arg, struct tcp_pcb *tpcb) {
+    http_conn_t *conn = arg;
+    conn->idle_ticks++;
+    if (conn->held) {
+        // The merge is waiting, not the client
+        return http_upload_resume(conn);
+    }
+    uint16_t limit = (conn->responding ? HTTP_SEND_TIMEOUT_S : HTTP_REQUEST_TIMEOUT_S) * HTTP_TICKS_PER_S;
+    if (conn->idle_ticks >= limit) {
+        // Vanished, or too slow to be worth a slot
+        http_stats.timed_out++;
+        return http_abort(conn);
+    }
+    if (conn->responding) {
+        return http_send_more(conn);
+    }
     return ERR_OK;
 }
 
-err_t http_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) { 
-    if (!p) {
-        tcp_close(tpcb);
+static void http_err(void *arg, err_t err) {
+    // The pcb is already freed by lwIP; a render, merge or view this connection held must not
+    // stay claimed, or every other client is turned away until the slot is reused
+    http_conn_t *conn = arg;
+    http_conn_release(conn);
+    conn->pcb = NULL;
+}
+
+// Feed request body bytes from offset on to the heatmap merge, and answer once they are all in.
+// While the merge waits for a compaction to make room in the overlay, the rest of p is held
+// without being acknowledged, so the client's window closes instead of cells being dropped.
+static err_t http_upload(http_conn_t *conn, struct pbuf *p, uint32_t offset) {
+    size_t taken = 0;
+    bool ok = heatmap_merge_feed(conn, NULL, 0, &taken);
+    uint32_t fed = offset;
+    for (struct pbuf *q = p; q && conn->upload_remaining && ok && !heatmap_merge_waiting(conn); q = q->next) {
+        if (offset >= q->len) {
+            offset -= q->len;
+            continue;
+        }
+        uint32_t len = LWIP_MIN(q->len - offset, conn->upload_remaining);
+        ok = heatmap_merge_feed(conn, (const uint8_t *)q->payload + offset, len, &taken);
+        conn->upload_remaining -= taken;
+        fed += taken;
+        offset = 0;
+    }
+    if (ok && heatmap_merge_waiting(conn)) {
+        conn->held = p;
+        conn->held_offset = fed;
+        return ERR_OK;
+    }
+    tcp_recved(conn->pcb, p->tot_len);
+    pbuf_free(p);
+    if (ok && conn->upload_remaining) {
         return ERR_OK;
     }
 
-    // Copy request data
-    char *data = malloc(p->len + 1);
+    // Done, or a bad dump; whatever else the client sends is ignored
+    conn->upload_remaining = 0;
+    conn->responding = true;
+    heatmap_merge_stats_t stats = { 0 };
+    ok = heatmap_merge_end(conn, &stats) && ok;
+    if (stats.merged || stats.added) {
+        heatmap_density_invalidate();
+    }
+    if (!ok) {
+        return http_respond_static(conn, http_bad_request, sizeof(http_bad_request) - 1);
+    }
+    char msg[80];
+    int body_len = snprintf(msg, sizeof(msg), "{\"merged\":%lu,\"added\":%lu,\"dropped\":%lu,\"cells\":%lu}",
+        (unsigned long)stats.merged, (unsigned long)stats.added, (unsigned long)stats.dropped,
+        (unsigned long)heatmap_size());
+    static char response[256];
+    int len = snprintf(response, sizeof(response),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %d\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "%s",
+        body_len, msg);
+    return http_respond_copy(conn, response, len);
+}
+
+// Retried from the poll. Past HTTP_MERGE_WAIT_S with no room made, no compaction is coming
+// (no store, or writes failing), so the merge goes on dropping what does not fit.
+static err_t http_upload_resume(http_conn_t *conn) {
+    struct pbuf *p = conn->held;
+    conn->held = NULL;
+    if (conn->idle_ticks >= HTTP_MERGE_WAIT_S * HTTP_TICKS_PER_S) {
+        heatmap_merge_drop_excess(conn);
+    }
+    uint32_t remaining = conn->upload_remaining;
+    err_t err = http_upload(conn, p, conn->held_offset);
+    if (!conn->held || conn->upload_remaining != remaining) {
+        conn->idle_ticks = 0;
+    }
+    return err;
+}
 
-    if (!data) {
+// POST /api/heatmap/merge: another unit's /api/grid.bin, summed in as it streams in. The
+// headers must arrive in the first segment; the body is never copied.
+static err_t http_upload_begin(http_conn_t *conn, const char *request, struct pbuf *p) {
+    const char *end = strstr(request, "\r\n\r\n");
+    const char *length = find_header(request, "Content-Length");
+    const char *reply = NULL;
+    uint32_t reply_len = 0;
+    char *length_end = NULL;
+    unsigned long body_len = length ? strtoul(length, &length_end, 10) : 0;
+    if (!end) {
+        reply = http_bad_request;
+        reply_len = sizeof(http_bad_request) - 1;
+    } else if (!length || length_end == length || body_len == 0 || body_len > UINT32_MAX) {
+        reply = http_length_required;
+        reply_len = sizeof(http_length_required) - 1;
+    } else if (!heatmap_merge_begin(conn)) {
+        reply = http_unavailable;
+        reply_len = sizeof(http_unavailable) - 1;
+    }
+    if (reply) {
+        tcp_recved(conn->pcb, p->tot_len);
         pbuf_free(p);
+        conn->responding = true;
+        return http_respond_static(conn, reply, reply_len);
+    }
+
+    const char *expect = find_header(request, "Expect");
+    if (expect && strncasecmp(expect, "100-continue", 12) == 0 &&
+        tcp_write(conn->pcb, http_continue, sizeof(http_continue) - 1, 0) == ERR_OK) {
+        conn->tx_unacked += sizeof(http_continue) - 1;
+        tcp_output(conn->pcb);
+    }
+    conn->upload_remaining = body_len;
+    return http_upload(conn, p, end + 4 - request);
+}
+
+err_t http_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) { 
+    http_conn_t *conn = arg;
+    if (!p) {
+        return http_close(conn);
+    }
+    if (conn->held) {
+        // lwIP keeps refused data and offers it again, holding the window shut meanwhile
         return ERR_MEM;
     }
+    conn->idle_ticks = 0;
+    if (conn->upload_remaining) {
+        return http_upload(conn, p, 0);
+    }
+
+    // Copy the start of the request; callbacks never nest, so one buffer serves every connection
+    static char request[HTTP_REQUEST_MAX];
+    u16_t len = pbuf_copy_partial(p, request, sizeof(request) - 1, 0);
+    request[len] = '\0';
+
+    // One request per connection; ignore anything after it
+    if (conn->responding) {
+        tcp_recved(tpcb, p->tot_len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    if (strncmp(request, "POST /api/heatmap/merge ", 24) == 0) {
+        return http_upload_begin(conn, request, p);
+    }
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    conn->responding = true;
+
+    if (strncmp(request, "GET ", 4) != 0) {
+        return http_respond_static(conn, http_not_allowed, sizeof(http_not_allowed) - 1);
+    }
+    const char *path = request + 4;
+    size_t path_len = strcspn(path, " ?\r\n");
+    const char *query = path[path_len] == '?' ? path + path_len + 1 : "";
 
-    memcpy(data, p->payload, p->len);
-    data[p->len] = '\0';
+    // Live updates: the connection stays open and belongs to the event stream from now on
+    if (path_is(path, path_len, "/events")) {
+        http_conn_free(conn);
+        err_t attach_err = events_attach(tpcb);
+        if (attach_err == ERR_MEM) {
+            // All stream slots busy; the constant reply needs no copy and goes out on close
+            tcp_write(tpcb, http_unavailable, sizeof(http_unavailable) - 1, 0);
+            tcp_close(tpcb);
+            return ERR_OK;
+        }
+        return attach_err;
+    }
 
     // Handle toggle
-    if (strstr(data, "GET /toggle") != NULL) {
+    if (path_is(path, path_len, "/toggle")) {
         led_state = !led_state;
         cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, led_state);
+        return http_respond_copy(conn, html_page, strlen(html_page));
     }
 
-    free(data);
-    pbuf_free(p);
+    // Handle power mode, e.g. /power?mode=eco
+    if (path_is(path, path_len, "/power")) {
+        if (strncmp(query, "mode=", 5) == 0) {
+            power_set_mode(power_mode_from_name(query + 5, strcspn(query + 5, " &\r\n")));
+        }
+        return http_respond_copy(conn, html_page, strlen(html_page));
+    }
 
-    // Send response
-    tcp_write(tpcb, html_page, strlen(html_page), TCP_WRITE_FLAG_COPY);
-    tcp_output(tpcb);
+    // Where heatmap density is spread, e.g. /density?mode=ingest
+    if (path_is(path, path_len, "/density")) {
+        if (strncmp(query, "mode=", 5) == 0) {
+            heatmap_set_density(heatmap_density_from_name(query + 5, strcspn(query + 5, " &\r\n")));
+        }
+        return http_respond_copy(conn, html_page, strlen(html_page));
+    }
 
-    // Close connection after sending
-    tcp_sent(tpcb, http_sent);
+    if (path_is(path, path_len, "/api/grid.bin")) {
+        heatmap_view_begin(&conn->view);
+        return http_respond_body(conn, http_binary_headers, sizeof(http_binary_headers) - 1, grid_body);
+    }
 
-    return ERR_OK;
+    // e.g. /api/heatmap.bmp?norm=log; one render runs at a time
+    if (path_is(path, path_len, "/api/heatmap.bmp")) {
+        heatmap_norm_t norm = HEATMAP_NORM_SQRT;
+        if (strncmp(query, "norm=", 5) == 0) {
+            norm = heatmap_norm_from_name(query + 5, strcspn(query + 5, " &\r\n"));
+        }
+        if (norm == HEATMAP_NORM_COUNT || !heatmap_render_begin(conn, norm)) {
+            return http_respond_static(conn, http_unavailable, sizeof(http_unavailable) - 1);
+        }
+        return http_respond_body(conn, http_bmp_headers, sizeof(http_bmp_headers) - 1, bmp_body);
+    }
+
+    if (path_is(path, path_len, "/api/trips")) {
+        return http_respond_body(conn, http_json_headers, sizeof(http_json_headers) - 1, trips_body);
+    }
+
+    for (size_t i = 0; i < count_of(export_routes); i++) {
+        if (path_is(path, path_len, export_routes[i].path)) {
+            return http_respond_export(conn, &export_routes[i], request);
+        }
+    }
+
+    if (path_is(path, path_len, "/status")) {
+        return http_respond_copy(conn, html_page, strlen(html_page));
+    }
+
+    // Anything else gets the app, which also makes it the captive portal page
+    const web_asset_t *asset = find_asset(path, path_len);
+    if (asset == NULL) {
+        asset = find_asset("/", 1);
+    }
+    return http_respond_static(conn, asset->response, asset->length);
+}
+
+// A free slot, or failing that the one idle longest of those still waiting for a request, if
+// it has been idle long enough to give up
+static http_conn_t *http_slot(void) {
+    http_conn_t *victim = NULL;
+    for (size_t i = 0; i < HTTP_MAX_CONNS; i++) {
+        http_conn_t *conn = &http_conns[i];
+        if (conn->pcb == NULL) {
+            return conn;
+        }
+        // A slow export, render or upload is live work, not an idle client
+        if (conn->responding || conn->upload_remaining || conn->held) {
+            continue;
+        }
+        if (victim == NULL || conn->idle_ticks > victim->idle_ticks) {
+            victim = conn;
+        }
+    }
+    if (victim == NULL || victim->idle_ticks < HTTP_EVICT_IDLE_TICKS) {
+        return NULL; // everyone is busy; a burst of new clients must not kill live transfers
+    }
+    http_stats.evicted++;
+    http_abort(victim);
+    return victim;
 }
 
 err_t http_accept(void *arg, struct tcp_pcb *newpcb, err_t err) { 
+    if (err != ERR_OK || newpcb == NULL) {
+        return ERR_VAL;
+    }
+    http_conn_t *conn = http_slot();
+    if (!conn) {
+        // Turn the client away politely; the constant reply needs no copy and goes out on close
+        http_stats.refused++;
+        tcp_arg(newpcb, NULL);
+        if (tcp_write(newpcb, http_unavailable, sizeof(http_unavailable) - 1, 0) != ERR_OK ||
+            tcp_close(newpcb) != ERR_OK) {
+            tcp_abort(newpcb);
+            return ERR_ABRT;
+        }
+        return ERR_OK;
+    }
+    http_stats.accepted++;
+    memset(conn, 0, sizeof(*conn));
+    conn->pcb = newpcb;
+    tcp_arg(newpcb, conn);
     tcp_recv(newpcb, http_recv);
-    tcp_arg(newpcb, NULL);
+    tcp_sent(newpcb, http_sent);
+    tcp_err(newpcb, http_err);
+    tcp_poll(newpcb, http_poll, HTTP_POLL_INTERVAL);
     return ERR_OK;
-}
\ No newline at end of file
+}
+
+void http_report(void) {
+    size_t active = 0;
+    for (size_t i = 0; i < HTTP_MAX_CONNS; i++) {
+        active += http_conns[i].pcb != NULL;
+    }
+    printf("HTTP: active=%u/%u accepted=%lu evicted=%lu timed_out=%lu refused=%lu\n",
+        (unsigned)active, (unsigned)HTTP_MAX_CONNS, (unsigned long)http_stats.accepted,
+        (unsigned long)http_stats.evicted, (unsigned long)http_stats.timed_out,
+        (unsigned long)http_stats.refused);
+}
+
+const http_stats_t *http_get_stats(void) {
+    return &http_stats;
+}
@@ -1,12 +1,51 @@
 #include "lwip/tcp.h"
 #include "pico/cyw43_arch.h"
 
+// Concurrent HTTP connections; event streams have their own slots (EVENTS_MAX_CLIENTS)
+#ifndef HTTP_MAX_CONNS
+#define HTTP_MAX_CONNS 6
+#endif
+
+// A client must finish its request, and then keep acking the response, within these
+#ifndef HTTP_REQUEST_TIMEOUT_S
+#define HTTP_REQUEST_TIMEOUT_S 5
+#endif
+#ifndef HTTP_SEND_TIMEOUT_S
+#define HTTP_SEND_TIMEOUT_S 10
+#endif
+
+// A merge upload held back for room in the heatmap overlay waits this long for a compaction
+// to make some before it drops the cells that do not fit; longer than compacting the largest
+// map takes a block per second
+#ifndef HTTP_MERGE_WAIT_S
+#define HTTP_MERGE_WAIT_S 60
+#endif
+
+// When all slots are taken a new client evicts the connection idle longest that is still
+// waiting for its request headers, if it has been idle for at least this many 500 ms polls.
+// Responses and uploads are never evicted, however slowly they are acked or sent; they
+// answer to HTTP_SEND_TIMEOUT_S and HTTP_REQUEST_TIMEOUT_S instead.
+#ifndef HTTP_EVICT_IDLE_TICKS
+#define HTTP_EVICT_IDLE_TICKS 2
+#endif
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t evicted;
+    uint32_t timed_out;
+    uint32_t refused;
+} http_stats_t;
+
 // External variables that the HTTP server needs access to
 extern bool led_state;
 extern char html_page[512];
 
 // Function declarations
-void build_http_page(char *msg);
+void build_http_page(const char *msg);
 err_t http_sent(void *arg, struct tcp_pcb *tpcb, u16_t len);          
 err_t http_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err); 
-err_t http_accept(void *arg, struct tcp_pcb *newpcb, err_t err);      
\ No newline at end of file
+err_t http_accept(void *arg, struct tcp_pcb *newpcb, err_t err);      
+
+// Log connection counts; called with the periodic reports
+void http_report(void);
+const http_stats_t *http_get_stats(void);
\ No newline at end of file
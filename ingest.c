@@ -0,0 +1,127 @@
+#include "ingest.h"
+#include <stdio.h>
+#include <string.h>
+#include "minmea.h"
+#include "gps_fix.h"
+#include "http_server.h"
+#include "heatmap.h"
+#include "heatmap_render.h"
+#include "events.h"
+#include "track.h"
+#include "fix_log.h"
+#include "track_export.h"
+#include "trips.h"
+#include "numfmt.h"
+#include "fix_epoch.h"
+
+// Fields each subscribed sentence type is decoded for; types with no fields are dropped as
+// soon as their header has been read, before the checksum or any field is looked at
+static uint32_t subscribed[MINMEA_SENTENCE_ZDA + 1];
+
+static ingest_stats_t stats;
+
+static bool fix_stored;
+
+// One merged fix per epoch: store it and update the live outputs
+static void ingest_fix(const gps_fix_t *fix) {
+    uint32_t seq = track_append(fix);
+    fix_log_append(fix);
+    export_index_append(seq);
+    trips_add(fix, seq);
+
+    char lat[13], lon[13], msg[100];
+    lat[fmt_e7(lat, fix->lat_e7)] = '\0';
+    lon[fmt_e7(lon, fix->lon_e7)] = '\0';
+    uint32_t s = fix->time % 86400;
+    snprintf(msg, sizeof(msg), "Time: %02lu:%02lu:%02lu\nLatitude: %s\nLongitude: %s\n",
+        (unsigned long)s / 3600, (unsigned long)s / 60 % 60, (unsigned long)s % 60, lat, lon);
+    build_http_page(msg);
+
+    // Heatmap and live viewers
+    events_publish_fix(fix);
+    const Heatmap *cell = heatmap_add(fix->lat_e7, fix->lon_e7);
+    heatmap_density_add(cell);
+    if (cell) {
+        events_publish_cell(cell);
+    }
+    fix_stored = true;
+}
+
+void ingest_init(void) {
+    memset(subscribed, 0, sizeof(subscribed));
+    // What a stored fix is made of
+    ingest_subscribe(MINMEA_SENTENCE_GGA, MINMEA_GGA_TIME | MINMEA_GGA_LATITUDE | MINMEA_GGA_LONGITUDE |
+        MINMEA_GGA_FIX_QUALITY | MINMEA_GGA_SATELLITES | MINMEA_GGA_HDOP);
+    ingest_subscribe(MINMEA_SENTENCE_RMC, MINMEA_RMC_TIME | MINMEA_RMC_VALID | MINMEA_RMC_LATITUDE |
+        MINMEA_RMC_LONGITUDE | MINMEA_RMC_SPEED | MINMEA_RMC_COURSE | MINMEA_RMC_DATE);
+    ingest_subscribe(MINMEA_SENTENCE_VTG, MINMEA_VTG_TRUE_TRACK | MINMEA_VTG_SPEED_KNOTS |
+        MINMEA_VTG_SPEED_KPH | MINMEA_VTG_FAA_MODE);
+    fix_epoch_init(INGEST_EPOCH_PARTS, ingest_fix);
+}
+
+void ingest_subscribe(enum minmea_sentence_id id, uint32_t fields) {
+    if (id > MINMEA_UNKNOWN && id <= MINMEA_SENTENCE_ZDA) {
+        subscribed[id] |= fields;
+    }
+}
+
+uint32_t ingest_fields(enum minmea_sentence_id id) {
+    return id > MINMEA_UNKNOWN && id <= MINMEA_SENTENCE_ZDA ? subscribed[id] : 0;
+}
+
+const ingest_stats_t *ingest_get_stats(void) {
+    return &stats;
+}
+
+static bool talker_wanted(const char *sentence) {
+    static const char talkers[] = INGEST_TALKERS;
+    for (size_t i = 0; i + 1 < sizeof(talkers); i += 2) {
+        if (sentence[1] == talkers[i] && sentence[2] == talkers[i + 1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ingest_sentence(const char *sentence) {
+    stats.lines++;
+    enum minmea_sentence_id id = minmea_sentence_type(sentence);
+    if (id <= MINMEA_UNKNOWN || subscribed[id] == 0 || !talker_wanted(sentence)) {
+        stats.filtered++;
+        return false;
+    }
+    // The receiver always sends checksums, so anything without a valid one is line noise
+    if (!minmea_check(sentence, true)) {
+        stats.invalid++;
+        return false;
+    }
+
+    fix_stored = false;
+    switch (id) {
+        case MINMEA_SENTENCE_GGA: {
+            struct minmea_sentence_gga frame = {0};
+            if (!minmea_parse_gga_fields(&frame, sentence, subscribed[id])) {
+                break;
+            }
+#if INGEST_TRACE
+            printf("NMEA: %s%s\n", sentence, frame.fix_quality <= 0 ? " (no fix)" : "");
+#endif
+            fix_epoch_gga(&frame);
+        } break;
+        case MINMEA_SENTENCE_RMC: {
+            struct minmea_sentence_rmc frame = {0};
+            if (minmea_parse_rmc_fields(&frame, sentence, subscribed[id])) {
+                fix_epoch_rmc(&frame);
+            }
+        } break;
+        case MINMEA_SENTENCE_VTG: {
+            struct minmea_sentence_vtg frame = {0};
+            if (minmea_parse_vtg_fields(&frame, sentence, subscribed[id])) {
+                fix_epoch_vtg(&frame);
+            }
+        } break;
+        default:
+            break;
+    }
+    return fix_stored;
+}
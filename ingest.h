@@ -0,0 +1,45 @@
+#ifndef _INGEST_H_
+#define _INGEST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "minmea.h"
+#include "fix_epoch.h"
+
+// Talkers whose sentences are used, as a string of two-letter IDs
+#ifndef INGEST_TALKERS
+#define INGEST_TALKERS "GPGN"
+#endif
+
+// Sentences expected every epoch; a fix is stored once all have arrived
+#ifndef INGEST_EPOCH_PARTS
+#define INGEST_EPOCH_PARTS (FIX_EPOCH_GGA | FIX_EPOCH_RMC | FIX_EPOCH_VTG)
+#endif
+
+// Echo each GGA to stdio, for bench debugging only: printing costs far more than the parse
+#ifndef INGEST_TRACE
+#define INGEST_TRACE 0
+#endif
+
+typedef struct {
+    uint32_t lines;
+    uint32_t filtered;      // unsubscribed type or talker, dropped after the header
+    uint32_t invalid;       // bad or missing checksum
+} ingest_stats_t;
+
+// Reset the subscriptions to what the fix pipeline needs
+void ingest_init(void);
+
+// Also decode the given fields (MINMEA_<TYPE>_* bits) of a sentence type
+void ingest_subscribe(enum minmea_sentence_id id, uint32_t fields);
+
+// Fields decoded of a sentence type, 0 if it is dropped
+uint32_t ingest_fields(enum minmea_sentence_id id);
+
+// Feed one NMEA line (without the line ending) through parsing, epoch assembly, storage and
+// the live outputs. Returns true if it completed and stored a fix.
+bool ingest_sentence(const char *sentence);
+
+const ingest_stats_t *ingest_get_stats(void);
+
+#endif
@@ -24,6 +24,8 @@
 #define MEM_SIZE                    4000
 #endif
 #define MEMP_NUM_TCP_SEG            32
+// HTTP_MAX_CONNS + EVENTS_MAX_CLIENTS, with room for connections still closing
+#define MEMP_NUM_TCP_PCB            12
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
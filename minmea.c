@@ -84,17 +84,15 @@ bool minmea_check(const char *sentence, bool strict)
     return true;
 }
 
-bool minmea_scan(const char *sentence, const char *format, ...)
+static bool minmea_vscan(const char *sentence, uint32_t fields, const char *format, va_list ap)
 {
     bool result = false;
     bool optional = false;
+    int index = -1;
 
     if (sentence == NULL)
         return false;
 
-    va_list ap;
-    va_start(ap, format);
-
     const char *field = sentence;
 #define next_field() \
     do { \
@@ -119,11 +117,33 @@ bool minmea_scan(const char *sentence, const char *format, ...)
             continue;
         }
 
+        index++;
+        if (index < 32 && (fields >> index) == 0) {
+            // Nothing further was asked for; leave the rest of the sentence alone.
+            break;
+        }
+
         if (!field && !optional) {
             // Field requested but we ran out if input. Bail out.
             goto parse_error;
         }
 
+        if (index < 32 && !(fields & (UINT32_C(1) << index))) {
+            // Not wanted: skip its argument without decoding the field.
+            switch (type) {
+                case 'c': case 's': (void) va_arg(ap, char *); break;
+                case 'd': case 'i': (void) va_arg(ap, int *); break;
+                case 'f': (void) va_arg(ap, struct minmea_float *); break;
+                case 't': (void) va_arg(ap, struct minmea_type *); break;
+                case 'D': (void) va_arg(ap, struct minmea_date *); break;
+                case 'T': (void) va_arg(ap, struct minmea_time *); break;
+                case '_': break;
+                default: goto parse_error;
+            }
+            next_field();
+            continue;
+        }
+
         switch (type) {
             case 'c': { // Single character field (char).
                 char value = '\0';
@@ -170,6 +190,10 @@ bool minmea_scan(const char *sentence, const char *format, ...)
                             int digit = *field - '0';
                             if (value == -1)
                                 value = 0;
+                            if (scale > INT_LEAST32_MAX / 10) {
+                                /* more fractional digits than the scale holds; truncate */
+                                break;
+                            }
                             if (value > (INT_LEAST32_MAX-digit) / 10) {
                                 /* we ran out of bits, what do we do? */
                                 if (scale) {
@@ -270,6 +294,8 @@ bool minmea_scan(const char *sentence, const char *format, ...)
                     d = strtol(dArr, NULL, 10);
                     m = strtol(mArr, NULL, 10);
                     y = strtol(yArr, NULL, 10);
+                    if (d < 1 || d > 31 || m < 1 || m > 12)
+                        goto parse_error;
                 }
 
                 date->day = d;
@@ -294,6 +320,9 @@ bool minmea_scan(const char *sentence, const char *format, ...)
                     h = strtol(hArr, NULL, 10);
                     i = strtol(iArr, NULL, 10);
                     s = strtol(sArr, NULL, 10);
+                    // Allow for a leap second.
+                    if (h > 23 || i > 59 || s > 60)
+                        goto parse_error;
                     field += 6;
 
                     // Extra: fractional time. Saved as microseconds.
@@ -330,18 +359,35 @@ bool minmea_scan(const char *sentence, const char *format, ...)
     result = true;
 
 parse_error:
+    return result;
+}
+
+bool minmea_scan(const char *sentence, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    bool result = minmea_vscan(sentence, MINMEA_FIELDS_ALL, format, ap);
+    va_end(ap);
+    return result;
+}
+
+bool minmea_scan_fields(const char *sentence, uint32_t fields, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    bool result = minmea_vscan(sentence, fields, format, ap);
     va_end(ap);
     return result;
 }
 
 bool minmea_talker_id(char talker[3], const char *sentence)
 {
-    char type[6];
-    if (!minmea_scan(sentence, "t", type))
+    struct minmea_type type;
+    if (!minmea_scan(sentence, "t", &type))
         return false;
 
-    talker[0] = type[0];
-    talker[1] = type[1];
+    talker[0] = type.talker_id[0];
+    talker[1] = type.talker_id[1];
     talker[2] = '\0';
 
     return true;
@@ -352,28 +398,33 @@ enum minmea_sentence_id minmea_sentence_id(const char *sentence, bool strict)
     if (!minmea_check(sentence, strict))
         return MINMEA_INVALID;
 
-    char type[6];
-    if (!minmea_scan(sentence, "t", type))
+    return minmea_sentence_type(sentence);
+}
+
+enum minmea_sentence_id minmea_sentence_type(const char *sentence)
+{
+    static const char types[][3] = {
+        [MINMEA_SENTENCE_GBS] = "GBS",
+        [MINMEA_SENTENCE_GGA] = "GGA",
+        [MINMEA_SENTENCE_GLL] = "GLL",
+        [MINMEA_SENTENCE_GSA] = "GSA",
+        [MINMEA_SENTENCE_GST] = "GST",
+        [MINMEA_SENTENCE_GSV] = "GSV",
+        [MINMEA_SENTENCE_RMC] = "RMC",
+        [MINMEA_SENTENCE_VTG] = "VTG",
+        [MINMEA_SENTENCE_ZDA] = "ZDA",
+    };
+
+    // "$TTSSS": stop at the first character that cannot be part of the header.
+    if (sentence[0] != '$')
         return MINMEA_INVALID;
+    for (int i = 1; i <= 5; i++)
+        if (!minmea_isfield(sentence[i]))
+            return MINMEA_INVALID;
 
-    if (!strcmp(type+2, "GBS"))
-        return MINMEA_SENTENCE_GBS;
-    if (!strcmp(type+2, "GGA"))
-        return MINMEA_SENTENCE_GGA;
-    if (!strcmp(type+2, "GLL"))
-        return MINMEA_SENTENCE_GLL;
-    if (!strcmp(type+2, "GSA"))
-        return MINMEA_SENTENCE_GSA;
-    if (!strcmp(type+2, "GST"))
-        return MINMEA_SENTENCE_GST;
-    if (!strcmp(type+2, "GSV"))
-        return MINMEA_SENTENCE_GSV;
-    if (!strcmp(type+2, "RMC"))
-        return MINMEA_SENTENCE_RMC;
-    if (!strcmp(type+2, "VTG"))
-        return MINMEA_SENTENCE_VTG;
-    if (!strcmp(type+2, "ZDA"))
-        return MINMEA_SENTENCE_ZDA;
+    for (int id = MINMEA_SENTENCE_GBS; id <= MINMEA_SENTENCE_ZDA; id++)
+        if (!memcmp(sentence + 3, types[id], 3))
+            return (enum minmea_sentence_id) id;
 
     return MINMEA_UNKNOWN;
 }
@@ -400,13 +451,18 @@ bool minmea_parse_gbs(struct minmea_sentence_gbs *frame, const char *sentence)
 }
 
 bool minmea_parse_rmc(struct minmea_sentence_rmc *frame, const char *sentence)
+{
+    return minmea_parse_rmc_fields(frame, sentence, MINMEA_FIELDS_ALL);
+}
+
+bool minmea_parse_rmc_fields(struct minmea_sentence_rmc *frame, const char *sentence, uint32_t fields)
 {
     // $GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62
-    char validity;
-    int latitude_direction;
-    int longitude_direction;
-    int variation_direction;
-    if (!minmea_scan(sentence, "tTcfdfdffDfd",
+    char validity = '\0';
+    int latitude_direction = 1;
+    int longitude_direction = 1;
+    int variation_direction = 1;
+    if (!minmea_scan_fields(sentence, fields | MINMEA_FIELD_TYPE, "tTcfdfdffDfd",
             &frame->type,
             &frame->time,
             &validity,
@@ -421,20 +477,28 @@ bool minmea_parse_rmc(struct minmea_sentence_rmc *frame, const char *sentence)
         return false;
 
     frame->valid = (validity == 'A');
-    frame->latitude.value *= latitude_direction;
-    frame->longitude.value *= longitude_direction;
-    frame->variation.value *= variation_direction;
+    if (fields & MINMEA_RMC_LATITUDE)
+        frame->latitude.value *= latitude_direction;
+    if (fields & MINMEA_RMC_LONGITUDE)
+        frame->longitude.value *= longitude_direction;
+    if (fields & MINMEA_RMC_VARIATION)
+        frame->variation.value *= variation_direction;
 
     return true;
 }
 
 bool minmea_parse_gga(struct minmea_sentence_gga *frame, const char *sentence)
+{
+    return minmea_parse_gga_fields(frame, sentence, MINMEA_FIELDS_ALL);
+}
+
+bool minmea_parse_gga_fields(struct minmea_sentence_gga *frame, const char *sentence, uint32_t fields)
 {
     // $GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47
-    int latitude_direction;
-    int longitude_direction;
+    int latitude_direction = 1;
+    int longitude_direction = 1;
 
-    if (!minmea_scan(sentence, "tTfdfdiiffcfcf_",
+    if (!minmea_scan_fields(sentence, fields | MINMEA_FIELD_TYPE, "tTfdfdiiffcfcf_",
             &frame->type,
             &frame->time,
             &frame->latitude, &latitude_direction,
@@ -449,8 +513,10 @@ bool minmea_parse_gga(struct minmea_sentence_gga *frame, const char *sentence)
     if (memcmp(frame->type.sentence_id, "GGA", sizeof(frame->type.sentence_id)))
         return false;
 
-    frame->latitude.value *= latitude_direction;
-    frame->longitude.value *= longitude_direction;
+    if (fields & MINMEA_GGA_LATITUDE)
+        frame->latitude.value *= latitude_direction;
+    if (fields & MINMEA_GGA_LONGITUDE)
+        frame->longitude.value *= longitude_direction;
 
     return true;
 }
@@ -566,14 +632,19 @@ bool minmea_parse_gsv(struct minmea_sentence_gsv *frame, const char *sentence)
 }
 
 bool minmea_parse_vtg(struct minmea_sentence_vtg *frame, const char *sentence)
+{
+    return minmea_parse_vtg_fields(frame, sentence, MINMEA_FIELDS_ALL);
+}
+
+bool minmea_parse_vtg_fields(struct minmea_sentence_vtg *frame, const char *sentence, uint32_t fields)
 {
     // $GPVTG,054.7,T,034.4,M,005.5,N,010.2,K*48
     // $GPVTG,156.1,T,140.9,M,0.0,N,0.0,K*41
     // $GPVTG,096.5,T,083.5,M,0.0,N,0.0,K,D*22
     // $GPVTG,188.36,T,,M,0.820,N,1.519,K,A*3F
-    char c_true, c_magnetic, c_knots, c_kph, c_faa_mode;
+    char c_true = '\0', c_magnetic = '\0', c_knots = '\0', c_kph = '\0', c_faa_mode = '\0';
 
-    if (!minmea_scan(sentence, "t;fcfcfcfcc",
+    if (!minmea_scan_fields(sentence, fields | MINMEA_FIELD_TYPE, "t;fcfcfcfcc",
             &frame->type,
             &frame->true_track_degrees,
             &c_true,
@@ -588,13 +659,13 @@ bool minmea_parse_vtg(struct minmea_sentence_vtg *frame, const char *sentence)
     if (memcmp(frame->type.sentence_id, "VTG", sizeof(frame->type.sentence_id)))
         return false;
     // values are only valid with the accompanying characters
-    if (c_true != 'T')
+    if ((fields & MINMEA_VTG_TRUE_TRACK) && c_true != 'T')
         frame->true_track_degrees.scale = 0;
-    if (c_magnetic != 'M')
+    if ((fields & MINMEA_VTG_MAGNETIC_TRACK) && c_magnetic != 'M')
         frame->magnetic_track_degrees.scale = 0;
-    if (c_knots != 'N')
+    if ((fields & MINMEA_VTG_SPEED_KNOTS) && c_knots != 'N')
         frame->speed_knots.scale = 0;
-    if (c_kph != 'K')
+    if ((fields & MINMEA_VTG_SPEED_KPH) && c_kph != 'K')
         frame->speed_kph.scale = 0;
     frame->faa_mode = (enum minmea_faa_mode)c_faa_mode;
 
@@ -616,8 +687,11 @@ bool minmea_parse_zda(struct minmea_sentence_zda *frame, const char *sentence)
     if (memcmp(frame->type.sentence_id, "ZDA", sizeof(frame->type.sentence_id)))
       return false;
 
-  // check offsets
-  if (abs(frame->hour_offset) > 13 ||
+  // check date and offsets
+  if (frame->date.day < 1 || frame->date.day > 31 ||
+      frame->date.month < 1 || frame->date.month > 12 ||
+      frame->date.year < 1980 || frame->date.year > 9999 ||
+      abs(frame->hour_offset) > 13 ||
       frame->minute_offset > 59 ||
       frame->minute_offset < 0)
       return false;
@@ -647,20 +721,28 @@ int minmea_getdatetime(struct tm *tm, const struct minmea_date *date, const stru
     return 0;
 }
 
+int32_t minmea_days_from_civil(int year, int month, int day)
+{
+    // Howard Hinnant's days_from_civil: years start in March so the leap day comes last.
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t yoe = (uint32_t)(year - era * 400);
+    uint32_t doy = (153 * (uint32_t)(month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
 int minmea_gettime(struct timespec *ts, const struct minmea_date *date, const struct minmea_time *time_)
 {
     struct tm tm;
     if (minmea_getdatetime(&tm, date, time_))
         return -1;
 
-    time_t timestamp = timegm(&tm); /* See README.md if your system lacks timegm(). */
-    if (timestamp != (time_t)-1) {
-        ts->tv_sec = timestamp;
-        ts->tv_nsec = time_->microseconds * 1000;
-        return 0;
-    } else {
-        return -1;
-    }
+    // Computed directly rather than with timegm(), which not every libc has
+    ts->tv_sec = (time_t)minmea_days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * 86400 +
+        tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    ts->tv_nsec = time_->microseconds * 1000;
+    return 0;
 }
 
 /* vim: set ts=4 sw=4 et: */
\ No newline at end of file
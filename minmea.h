@@ -226,6 +226,52 @@ enum minmea_sentence_id minmea_sentence_id(const char *sentence, bool strict);
  */
 bool minmea_scan(const char *sentence, const char *format, ...);
 
+/**
+ * As minmea_scan, but only fields whose bit is set in fields are decoded; the
+ * arguments of the others are left untouched. Bit n stands for the n-th field
+ * of the format ('t' is field 0; ';' does not count). Scanning stops after the
+ * highest requested field.
+ */
+bool minmea_scan_fields(const char *sentence, uint32_t fields, const char *format, ...);
+
+#define MINMEA_FIELDS_ALL UINT32_C(0xffffffff)
+#define MINMEA_FIELD_TYPE (UINT32_C(1) << 0)
+
+/**
+ * Classify a sentence from its "$TTSSS" header alone, without looking at the
+ * rest of it or its checksum.
+ */
+enum minmea_sentence_id minmea_sentence_type(const char *sentence);
+
+/*
+ * Field selections for the minmea_parse_*_fields() variants. A coordinate
+ * includes its hemisphere and a measurement its unit.
+ */
+#define MINMEA_GGA_TIME         (UINT32_C(1) << 1)
+#define MINMEA_GGA_LATITUDE     (UINT32_C(3) << 2)
+#define MINMEA_GGA_LONGITUDE    (UINT32_C(3) << 4)
+#define MINMEA_GGA_FIX_QUALITY  (UINT32_C(1) << 6)
+#define MINMEA_GGA_SATELLITES   (UINT32_C(1) << 7)
+#define MINMEA_GGA_HDOP         (UINT32_C(1) << 8)
+#define MINMEA_GGA_ALTITUDE     (UINT32_C(3) << 9)
+#define MINMEA_GGA_HEIGHT       (UINT32_C(3) << 11)
+#define MINMEA_GGA_DGPS_AGE     (UINT32_C(1) << 13)
+
+#define MINMEA_RMC_TIME         (UINT32_C(1) << 1)
+#define MINMEA_RMC_VALID        (UINT32_C(1) << 2)
+#define MINMEA_RMC_LATITUDE     (UINT32_C(3) << 3)
+#define MINMEA_RMC_LONGITUDE    (UINT32_C(3) << 5)
+#define MINMEA_RMC_SPEED        (UINT32_C(1) << 7)
+#define MINMEA_RMC_COURSE       (UINT32_C(1) << 8)
+#define MINMEA_RMC_DATE         (UINT32_C(1) << 9)
+#define MINMEA_RMC_VARIATION    (UINT32_C(3) << 10)
+
+#define MINMEA_VTG_TRUE_TRACK     (UINT32_C(3) << 1)
+#define MINMEA_VTG_MAGNETIC_TRACK (UINT32_C(3) << 3)
+#define MINMEA_VTG_SPEED_KNOTS    (UINT32_C(3) << 5)
+#define MINMEA_VTG_SPEED_KPH      (UINT32_C(3) << 7)
+#define MINMEA_VTG_FAA_MODE       (UINT32_C(1) << 9)
+
 /*
  * Parse a specific type of sentence. Return true on success.
  */
@@ -239,11 +285,24 @@ bool minmea_parse_gsv(struct minmea_sentence_gsv *frame, const char *sentence);
 bool minmea_parse_vtg(struct minmea_sentence_vtg *frame, const char *sentence);
 bool minmea_parse_zda(struct minmea_sentence_zda *frame, const char *sentence);
 
+/*
+ * Parse only the selected fields (MINMEA_<TYPE>_* bits); the others are left untouched.
+ */
+bool minmea_parse_gga_fields(struct minmea_sentence_gga *frame, const char *sentence, uint32_t fields);
+bool minmea_parse_rmc_fields(struct minmea_sentence_rmc *frame, const char *sentence, uint32_t fields);
+bool minmea_parse_vtg_fields(struct minmea_sentence_vtg *frame, const char *sentence, uint32_t fields);
+
 /**
  * Convert GPS UTC date/time representation to a UNIX calendar time.
  */
 int minmea_getdatetime(struct tm *tm, const struct minmea_date *date, const struct minmea_time *time_);
 
+/**
+ * Days from 1970-01-01 to a proleptic Gregorian date, for years within five
+ * million of it (beyond that the count overflows).
+ */
+int32_t minmea_days_from_civil(int year, int month, int day);
+
 /**
  * Convert GPS UTC date/time representation to a UNIX timestamp.
  */
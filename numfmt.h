@@ -0,0 +1,77 @@
+#ifndef _NUMFMT_H_
+#define _NUMFMT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+// Integer to ASCII without snprintf. Each returns the number of characters written;
+// nothing is NUL terminated.
+
+static const char numfmt_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// At most 10 characters
+static inline int fmt_u32(char *out, uint32_t v) {
+    char tmp[10];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        uint32_t pair = v % 100;
+        v /= 100;
+        p -= 2;
+        memcpy(p, &numfmt_digit_pairs[pair * 2], 2);
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &numfmt_digit_pairs[v * 2], 2);
+    } else {
+        *--p = '0' + v;
+    }
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
+
+// At most 11 characters
+static inline int fmt_i32(char *out, int32_t v) {
+    if (v < 0) {
+        *out = '-';
+        return 1 + fmt_u32(out + 1, -(uint32_t)v);
+    }
+    return fmt_u32(out, v);
+}
+
+// Exactly two digits, zero padded
+static inline int fmt_2d(char *out, uint32_t v) {
+    memcpy(out, &numfmt_digit_pairs[(v % 100) * 2], 2);
+    return 2;
+}
+
+// Fixed point with 7 decimals, e.g. degrees * 1e7 -> "-0.1234567". At most 12 characters.
+static inline int fmt_e7(char *out, int32_t v) {
+    char *p = out;
+    uint32_t mag = v < 0 ? -(uint32_t)v : (uint32_t)v;
+    if (v < 0) {
+        *p++ = '-';
+    }
+    p += fmt_u32(p, mag / 10000000);
+    *p++ = '.';
+    uint32_t frac = mag % 10000000;
+    p[0] = '0' + frac / 1000000;
+    frac %= 1000000;
+    p += 1;
+    p += fmt_2d(p, frac / 10000);
+    p += fmt_2d(p, frac / 100 % 100);
+    p += fmt_2d(p, frac % 100);
+    return p - out;
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include "power.h"
+#include <stdio.h>
+#include <string.h>
+#include "hardware/sync.h"
+
+// Rough supply currents in mA, for estimates only (3.7 V LiPo through the Pico's buck-boost)
+#define MCU_ACTIVE_MA       25  // RP2350 running at 150 MHz
+#define MCU_WFI_MA          9   // clocks running, core in WFI
+#define WIFI_AP_MA          40  // CYW43439 beaconing with no traffic
+#define GPS_TRACKING_MA     45  // NEO-6 acquiring/tracking
+#define GPS_BACKUP_MA       2   // NEO-6 between cycles in power save
+
+// UBX framing
+#define UBX_SYNC1           0xb5
+#define UBX_SYNC2           0x62
+#define UBX_CLASS_CFG       0x06
+#define UBX_CFG_RATE        0x08
+#define UBX_CFG_RXM         0x11
+#define UBX_CFG_PM2         0x3b
+
+// CFG-PM2 flags (u-blox 6 receiver description)
+#define PM2_FLAGS_WAIT_TIME_FIX     (1u << 10)  // stay on until the time is fixed
+#define PM2_FLAGS_UPDATE_EPH        (1u << 12)  // wake to keep ephemeris current
+
+static const power_profile_t profiles[POWER_MODE_COUNT] = {
+    [POWER_MODE_CONTINUOUS] = { "continuous", 1000, 0, false },
+    [POWER_MODE_BALANCED]   = { "balanced", 5000, 1, true },
+    [POWER_MODE_ECO]        = { "eco", 30000, 2, true },
+};
+
+static uart_inst_t *uart;
+static power_mode_t current_mode;
+static power_mode_t requested_mode = POWER_MODE_COUNT;
+
+// UBX bytes of a mode switch not yet in the UART FIFO
+#define UBX_QUEUE_SIZE 128
+_Static_assert(UBX_QUEUE_SIZE >= 3 * 8 + 44 + 6 + 2, "queue must hold CFG-PM2, CFG-RATE and CFG-RXM");
+static uint8_t ubx_queue[UBX_QUEUE_SIZE];
+static uint16_t ubx_queued;
+static uint16_t ubx_sent;
+
+// Duty-cycle counters since the last report
+static uint64_t window_start_us;
+static uint64_t wfi_us;
+
+static void ubx_put(const uint8_t *data, uint16_t len) {
+    memcpy(&ubx_queue[ubx_queued], data, len);
+    ubx_queued += len;
+}
+
+// Queue one UBX message for power_step() to send
+static void ubx_send(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t len) {
+    uint8_t hdr[6] = { UBX_SYNC1, UBX_SYNC2, msg_class, msg_id, len & 0xff, len >> 8 };
+    uint8_t ck_a = 0, ck_b = 0;
+
+    // Fletcher checksum over class, id, length and payload
+    for (int i = 2; i < 6; i++) {
+        ck_a += hdr[i];
+        ck_b += ck_a;
+    }
+    for (int i = 0; i < len; i++) {
+        ck_a += payload[i];
+        ck_b += ck_a;
+    }
+    uint8_t ck[2] = { ck_a, ck_b };
+
+    ubx_put(hdr, sizeof(hdr));
+    ubx_put(payload, len);
+    ubx_put(ck, sizeof(ck));
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void configure_receiver(const power_profile_t *profile) {
+    // CFG-PM2 first, so the cycle is set up before power save is switched on
+    if (profile->power_save) {
+        uint8_t pm2[44] = { 0 };
+        pm2[0] = 1;                                     // version
+        put_u32(&pm2[4], PM2_FLAGS_WAIT_TIME_FIX | PM2_FLAGS_UPDATE_EPH);
+        put_u32(&pm2[8], profile->fix_interval_ms);     // updatePeriod
+        put_u32(&pm2[12], 10 * profile->fix_interval_ms); // searchPeriod after a failed acquisition
+        put_u16(&pm2[20], profile->on_time_s);          // onTime
+        ubx_send(UBX_CLASS_CFG, UBX_CFG_PM2, pm2, sizeof(pm2));
+    }
+
+    uint8_t rate[6];
+    put_u16(&rate[0], profile->power_save ? 1000 : profile->fix_interval_ms); // measRate
+    put_u16(&rate[2], 1);                               // navRate
+    put_u16(&rate[4], 1);                               // timeRef = GPS
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_RATE, rate, sizeof(rate));
+
+    uint8_t rxm[2] = { 8, profile->power_save ? 1 : 0 }; // reserved, lpMode
+    ubx_send(UBX_CLASS_CFG, UBX_CFG_RXM, rxm, sizeof(rxm));
+}
+
+void power_init(uart_inst_t *gps_uart, power_mode_t mode) {
+    uart = gps_uart;
+    window_start_us = time_us_64();
+    wfi_us = 0;
+    power_set_mode(mode);
+    while (power_step()) {
+    }
+}
+
+void power_set_mode(power_mode_t mode) {
+    if (mode < POWER_MODE_COUNT) {
+        requested_mode = mode;
+    }
+}
+
+bool power_step(void) {
+    // A mode asked for while another was going out follows it
+    if (ubx_sent == ubx_queued && requested_mode < POWER_MODE_COUNT) {
+        current_mode = requested_mode;
+        requested_mode = POWER_MODE_COUNT;
+        ubx_queued = ubx_sent = 0;
+        configure_receiver(&profiles[current_mode]);
+        printf("Power mode: %s (fix every %lums)\n", profiles[current_mode].name,
+            (unsigned long)profiles[current_mode].fix_interval_ms);
+    }
+    while (ubx_sent < ubx_queued && uart_is_writable(uart)) {
+        uart_putc_raw(uart, ubx_queue[ubx_sent++]);
+    }
+    return ubx_sent < ubx_queued;
+}
+
+bool power_pending(void) {
+    return ubx_sent < ubx_queued || requested_mode < POWER_MODE_COUNT;
+}
+
+power_mode_t power_get_mode(void) {
+    return requested_mode < POWER_MODE_COUNT ? requested_mode : current_mode;
+}
+
+const power_profile_t *power_profile(power_mode_t mode) {
+    return mode < POWER_MODE_COUNT ? &profiles[mode] : NULL;
+}
+
+power_mode_t power_mode_from_name(const char *name, size_t len) {
+    for (int i = 0; i < POWER_MODE_COUNT; i++) {
+        if (strlen(profiles[i].name) == len && strncmp(profiles[i].name, name, len) == 0) {
+            return i;
+        }
+    }
+    return POWER_MODE_COUNT;
+}
+
+// WFI is as deep as the core goes: the cyw43 AP beacons, lwIP's timers and USB stdio all
+// need clk_sys and the timer, so DORMANT or a powman sleep would take the access point down
+// with it. The GPS power mode is where the fix cadence saves current; here the core only
+// stops between interrupts.
+void power_idle(void) {
+    // With interrupts masked WFI still wakes on a pending IRQ, but the handler only runs
+    // once they are restored, so the measured time excludes interrupt work
+    uint32_t status = save_and_disable_interrupts();
+    uint64_t start = time_us_64();
+    __wfi();
+    wfi_us += time_us_64() - start;
+    restore_interrupts(status);
+}
+
+void power_report(void) {
+    uint64_t now = time_us_64();
+    uint64_t elapsed = now - window_start_us;
+    if (elapsed == 0) {
+        return;
+    }
+    const power_profile_t *profile = &profiles[current_mode];
+
+    // Per-mille duty cycles and currents in tenths of a mA keep this in integer maths
+    uint32_t mcu_wfi = (uint32_t)(wfi_us * 1000 / elapsed);
+    uint32_t gps_on = 1000;
+    if (profile->power_save) {
+        gps_on = profile->on_time_s * 1000000u / profile->fix_interval_ms;
+        if (gps_on > 1000) gps_on = 1000;
+    }
+
+    uint32_t mcu_ma10 = (MCU_ACTIVE_MA * (1000 - mcu_wfi) + MCU_WFI_MA * mcu_wfi) / 100;
+    uint32_t gps_ma10 = (GPS_TRACKING_MA * gps_on + GPS_BACKUP_MA * (1000 - gps_on)) / 100;
+    uint32_t total_ma10 = mcu_ma10 + gps_ma10 + WIFI_AP_MA * 10;
+
+    printf("Power: mode=%s mcu_wfi=%lu.%lu%% gps_on=%lu.%lu%% est mcu=%lu.%lumA gps=%lu.%lumA total=%lu.%lumA\n",
+        profile->name,
+        (unsigned long)(mcu_wfi / 10), (unsigned long)(mcu_wfi % 10),
+        (unsigned long)(gps_on / 10), (unsigned long)(gps_on % 10),
+        (unsigned long)(mcu_ma10 / 10), (unsigned long)(mcu_ma10 % 10),
+        (unsigned long)(gps_ma10 / 10), (unsigned long)(gps_ma10 % 10),
+        (unsigned long)(total_ma10 / 10), (unsigned long)(total_ma10 % 10));
+
+    window_start_us = now;
+    wfi_us = 0;
+}
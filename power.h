@@ -0,0 +1,52 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+
+// Trade-off between how often we get a fix and how long the battery lasts
+typedef enum {
+    POWER_MODE_CONTINUOUS = 0,   // receiver always tracking, fix every second
+    POWER_MODE_BALANCED,         // cyclic power save, fix every 5 s
+    POWER_MODE_ECO,              // cyclic power save, fix every 30 s
+    POWER_MODE_COUNT
+} power_mode_t;
+
+#ifndef POWER_DEFAULT_MODE
+#define POWER_DEFAULT_MODE POWER_MODE_BALANCED
+#endif
+
+typedef struct {
+    const char *name;
+    uint32_t fix_interval_ms;    // NEO-6 update period
+    uint16_t on_time_s;          // time the receiver stays on after a fix
+    bool power_save;             // CFG-RXM lpMode
+} power_profile_t;
+
+// Configure the receiver for mode, waiting for the UBX commands to go out; for boot only
+void power_init(uart_inst_t *gps_uart, power_mode_t mode);
+
+// Ask for a mode; safe from lwIP callbacks, as nothing is sent until power_step()
+void power_set_mode(power_mode_t mode);
+
+// Send what the UART FIFO takes of the requested mode's UBX commands, about 80 ms of them
+// at 9600 baud in all; true while more remain. Call again once the FIFO has drained.
+bool power_step(void);
+
+// A mode was asked for and is not yet all sent
+bool power_pending(void);
+
+// The mode asked for last
+power_mode_t power_get_mode(void);
+const power_profile_t *power_profile(power_mode_t mode);
+
+// Parse a mode name ("continuous", "balanced", "eco"); returns POWER_MODE_COUNT if unknown
+power_mode_t power_mode_from_name(const char *name, size_t len);
+
+// Wait for the next interrupt in WFI, counting the time spent there; clocks keep running
+void power_idle(void);
+
+// Log the duty cycle and estimated current draw since the last report
+void power_report(void);
+
+#endif
@@ -0,0 +1,264 @@
+#include "sd_card.h"
+#include <string.h>
+#include "pico/stdlib.h"
+
+// Clock while the card is identified, which must be between 100 and 400 kHz
+#define SD_INIT_BAUD 400000
+
+#define SD_INIT_TIMEOUT_US 1000000
+#define SD_READ_TIMEOUT_US 100000
+#define SD_WRITE_TIMEOUT_US 500000
+
+#define CMD_GO_IDLE_STATE 0
+#define CMD_SEND_IF_COND 8
+#define CMD_SEND_CSD 9
+#define CMD_SET_BLOCKLEN 16
+#define CMD_READ_SINGLE_BLOCK 17
+#define CMD_WRITE_BLOCK 24
+#define CMD_APP_CMD 55
+#define CMD_READ_OCR 58
+#define ACMD_SD_SEND_OP_COND 41
+
+#define R1_IDLE 0x01
+#define R1_ILLEGAL_COMMAND 0x04
+
+#define TOKEN_START_BLOCK 0xfe
+#define DATA_ACCEPTED 0x05
+
+static struct {
+    spi_inst_t *spi;
+    uint cs;
+    bool block_addressed;   // SDHC and later take sector numbers rather than byte offsets
+} card;
+
+static uint8_t xfer(uint8_t out) {
+    uint8_t in;
+    spi_write_read_blocking(card.spi, &out, &in, 1);
+    return in;
+}
+
+static void deselect(void) {
+    gpio_put(card.cs, 1);
+    // The card only lets go of MISO on the next clock edge
+    xfer(0xff);
+}
+
+// Busy cards hold MISO low
+static bool wait_ready(uint32_t timeout_us) {
+    uint64_t start = time_us_64();
+    while (xfer(0xff) != 0xff) {
+        if (time_us_64() - start > timeout_us) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Select the card and send a command; returns the R1 response, 0xff if none came. The card
+// stays selected so the caller can read the rest of the response.
+static uint8_t command(uint8_t cmd, uint32_t arg) {
+    gpio_put(card.cs, 0);
+    if (cmd != CMD_GO_IDLE_STATE && !wait_ready(SD_READ_TIMEOUT_US)) {
+        return 0xff;
+    }
+    // Only the first two commands are checked in SPI mode; the rest carry any CRC
+    uint8_t crc = cmd == CMD_GO_IDLE_STATE ? 0x95 : cmd == CMD_SEND_IF_COND ? 0x87 : 0x01;
+    uint8_t frame[6] = { 0x40 | cmd, arg >> 24, arg >> 16, arg >> 8, arg, crc };
+    spi_write_blocking(card.spi, frame, sizeof(frame));
+    uint8_t r1 = 0xff;
+    for (int i = 0; i < 8 && (r1 & 0x80); i++) {
+        r1 = xfer(0xff);
+    }
+    return r1;
+}
+
+static uint8_t app_command(uint8_t cmd, uint32_t arg) {
+    command(CMD_APP_CMD, 0);
+    deselect();
+    return command(cmd, arg);
+}
+
+static bool read_data(uint8_t *buf, size_t len) {
+    uint64_t start = time_us_64();
+    uint8_t token;
+    while ((token = xfer(0xff)) == 0xff) {
+        if (time_us_64() - start > SD_READ_TIMEOUT_US) {
+            return false;
+        }
+    }
+    if (token != TOKEN_START_BLOCK) {
+        return false;
+    }
+    spi_read_blocking(card.spi, 0xff, buf, len);
+    uint8_t crc[2];
+    spi_read_blocking(card.spi, 0xff, crc, sizeof(crc));
+    return true;
+}
+
+static uint32_t address(uint32_t offset) {
+    return card.block_addressed ? offset / SD_CARD_BLOCK : offset;
+}
+
+static bool read_block(uint32_t offset, uint8_t *buf) {
+    bool ok = command(CMD_READ_SINGLE_BLOCK, address(offset)) == 0 && read_data(buf, SD_CARD_BLOCK);
+    deselect();
+    return ok;
+}
+
+static bool write_block(uint32_t offset, const uint8_t *data) {
+    bool ok = command(CMD_WRITE_BLOCK, address(offset)) == 0;
+    if (ok) {
+        static const uint8_t crc[2] = { 0xff, 0xff };
+        xfer(0xff);
+        xfer(TOKEN_START_BLOCK);
+        spi_write_blocking(card.spi, data, SD_CARD_BLOCK);
+        spi_write_blocking(card.spi, crc, sizeof(crc));
+        ok = (xfer(0xff) & 0x1f) == DATA_ACCEPTED && wait_ready(SD_WRITE_TIMEOUT_US);
+    }
+    deselect();
+    return ok;
+}
+
+static bool sd_read(block_store_t *store, uint32_t offset, void *buf, size_t len) {
+    (void)store;
+    // One bounce buffer for the one card: not reentrant, so reads must not overlap, which
+    // holds while every store call is made from the async context
+    static uint8_t block[SD_CARD_BLOCK];
+    uint8_t *out = buf;
+    while (len) {
+        uint32_t start = offset % SD_CARD_BLOCK;
+        size_t n = SD_CARD_BLOCK - start < len ? SD_CARD_BLOCK - start : len;
+        // Whole aligned blocks go straight into the caller's buffer
+        uint8_t *dst = n == SD_CARD_BLOCK ? out : block;
+        if (!read_block(offset - start, dst)) {
+            return false;
+        }
+        if (dst == block) {
+            memcpy(out, block + start, n);
+        }
+        out += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool sd_program(block_store_t *store, uint32_t offset, const void *data, size_t len) {
+    (void)store;
+    for (size_t done = 0; done < len; done += SD_CARD_BLOCK) {
+        if (!write_block(offset + done, (const uint8_t *)data + done)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const block_store_ops_t sd_ops = { sd_read, sd_program, NULL };
+
+// Card capacity in bytes from its CSD register, 0 if the layout is unknown
+static uint64_t csd_capacity(const uint8_t *csd) {
+    switch (csd[0] >> 6) {
+        case 0: {
+            uint32_t c_size = (csd[6] & 0x03) << 10 | csd[7] << 2 | csd[8] >> 6;
+            uint32_t mult = (csd[9] & 0x03) << 1 | csd[10] >> 7;
+            uint32_t read_bl_len = csd[5] & 0x0f;
+            return (uint64_t)(c_size + 1) << (mult + 2 + read_bl_len);
+        }
+        case 1: {
+            uint32_t c_size = (csd[7] & 0x3f) << 16 | csd[8] << 8 | csd[9];
+            return (uint64_t)(c_size + 1) * 512 * 1024;
+        }
+        default:
+            return 0;
+    }
+}
+
+bool sd_card_init(block_store_t *store, spi_inst_t *spi, uint sck_pin, uint mosi_pin, uint miso_pin, uint cs_pin) {
+    card.spi = spi;
+    card.cs = cs_pin;
+    card.block_addressed = false;
+
+    spi_init(spi, SD_INIT_BAUD);
+    spi_set_format(spi, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    gpio_set_function(sck_pin, GPIO_FUNC_SPI);
+    gpio_set_function(mosi_pin, GPIO_FUNC_SPI);
+    gpio_set_function(miso_pin, GPIO_FUNC_SPI);
+    gpio_pull_up(miso_pin);
+    gpio_init(cs_pin);
+    gpio_set_dir(cs_pin, GPIO_OUT);
+    gpio_put(cs_pin, 1);
+
+    // At least 74 clocks with the card deselected put it into native mode, ready for CMD0
+    for (int i = 0; i < 10; i++) {
+        xfer(0xff);
+    }
+    uint8_t r1 = command(CMD_GO_IDLE_STATE, 0);
+    deselect();
+    if (r1 != R1_IDLE) {
+        return false;
+    }
+
+    // Version 2 cards echo the check pattern and may be high capacity
+    bool v2 = false;
+    r1 = command(CMD_SEND_IF_COND, 0x1aa);
+    if (!(r1 & R1_ILLEGAL_COMMAND)) {
+        uint8_t r7[4];
+        spi_read_blocking(spi, 0xff, r7, sizeof(r7));
+        if ((r7[2] & 0x0f) != 0x01 || r7[3] != 0xaa) {
+            deselect();
+            return false;
+        }
+        v2 = true;
+    }
+    deselect();
+
+    uint64_t start = time_us_64();
+    do {
+        r1 = app_command(ACMD_SD_SEND_OP_COND, v2 ? 0x40000000 : 0);
+        deselect();
+        if (time_us_64() - start > SD_INIT_TIMEOUT_US) {
+            return false;
+        }
+    } while (r1 == R1_IDLE);
+    if (r1 != 0) {
+        return false;
+    }
+
+    if (v2) {
+        // Without the OCR a high-capacity card would be addressed in bytes and every access
+        // would land on the wrong sector
+        uint8_t ocr[4];
+        r1 = command(CMD_READ_OCR, 0);
+        if (r1 == 0) {
+            spi_read_blocking(spi, 0xff, ocr, sizeof(ocr));
+        }
+        deselect();
+        if (r1 != 0) {
+            return false;
+        }
+        card.block_addressed = ocr[0] & 0x40;
+    }
+    if (!card.block_addressed) {
+        r1 = command(CMD_SET_BLOCKLEN, SD_CARD_BLOCK);
+        deselect();
+        if (r1 != 0) {
+            return false;
+        }
+    }
+
+    uint8_t csd[16];
+    bool ok = command(CMD_SEND_CSD, 0) == 0 && read_data(csd, sizeof(csd));
+    deselect();
+    uint64_t capacity = ok ? csd_capacity(csd) : 0;
+    if (capacity == 0) {
+        return false;
+    }
+    if (capacity > UINT32_MAX) {
+        capacity = UINT32_MAX;
+    }
+
+    spi_set_baudrate(spi, SD_CARD_BAUD);
+    *store = (block_store_t){ .ops = &sd_ops, .name = "sd", .size = (uint32_t)capacity & ~(SD_CARD_BLOCK - 1),
+        .block_size = SD_CARD_BLOCK };
+    return true;
+}
@@ -0,0 +1,22 @@
+#ifndef _SD_CARD_H_
+#define _SD_CARD_H_
+
+#include <stdbool.h>
+#include "hardware/spi.h"
+#include "block_store.h"
+
+// An SD card in SPI mode as a block store of 512-byte sectors. The card is used raw from its
+// first sector, so any filesystem on it is overwritten; only one card is supported.
+
+#define SD_CARD_BLOCK 512
+
+// Clock once the card is initialised; cards must accept 25 MHz in SPI mode
+#ifndef SD_CARD_BAUD
+#define SD_CARD_BAUD 12500000
+#endif
+
+// Bring up the card and describe it in store, which covers the whole card up to 4 GB.
+// False if no card answers or it is not one we can drive.
+bool sd_card_init(block_store_t *store, spi_inst_t *spi, uint sck_pin, uint mosi_pin, uint miso_pin, uint cs_pin);
+
+#endif
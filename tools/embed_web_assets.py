@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""Gzip the web assets and emit them as a C table of complete HTTP responses.
+
+Each entry holds the response headers followed by the gzipped body, so the server can hand
+it to tcp_write straight from flash without copying.
+
+usage: embed_web_assets.py OUTPUT.c ASSET...
+"""
+
+import gzip
+import os
+import sys
+
+CONTENT_TYPES = {
+    '.html': 'text/html; charset=utf-8',
+    '.js': 'text/javascript; charset=utf-8',
+    '.css': 'text/css; charset=utf-8',
+    '.svg': 'image/svg+xml',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+}
+
+
+def c_bytes(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append('    ' + ' '.join('0x%02x,' % b for b in data[i:i + 16]))
+    return '\n'.join(lines)
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    output, assets = sys.argv[1], sys.argv[2:]
+
+    out = [
+        '// Generated by tools/embed_web_assets.py from the files in web/ - do not edit',
+        '',
+        '#include "web_assets.h"',
+        '',
+    ]
+    table = []
+    for i, path in enumerate(sorted(assets, key=os.path.basename)):
+        name = os.path.basename(path)
+        ext = os.path.splitext(name)[1]
+        with open(path, 'rb') as f:
+            # mtime=0 keeps the output reproducible
+            body = gzip.compress(f.read(), compresslevel=9, mtime=0)
+        headers = (
+            'HTTP/1.1 200 OK\r\n'
+            'Content-Type: %s\r\n'
+            'Content-Encoding: gzip\r\n'
+            'Content-Length: %d\r\n'
+            'Cache-Control: max-age=3600\r\n'
+            'Connection: close\r\n'
+            '\r\n' % (CONTENT_TYPES.get(ext, 'application/octet-stream'), len(body))
+        ).encode()
+        response = headers + body
+        out.append('// %s: %d bytes gzipped' % (name, len(body)))
+        out.append('static const uint8_t asset_%d[%d] = {' % (i, len(response)))
+        out.append(c_bytes(response))
+        out.append('};')
+        out.append('')
+        table.append('    { "/%s", asset_%d, sizeof(asset_%d) },' % (name, i, i))
+
+    out.append('const web_asset_t web_assets[] = {')
+    out.extend(table)
+    out.append('};')
+    out.append('')
+    out.append('const size_t web_assets_count = %d;' % len(table))
+    out.append('')
+
+    with open(output, 'w') as f:
+        f.write('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main()
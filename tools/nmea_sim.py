@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""Generate a deterministic NMEA stream (GGA, RMC, VTG, GSV) from a scripted route.
+
+The route is a comma separated list of KIND:SECONDS segments, played in order:
+
+  walk    a loop at walking pace that returns close to where it started
+  drive   road speed with gentle turns
+  dwell   stationary, with a little receiver jitter
+  loss    no fix (empty position fields, RMC status V)
+  spike   multipath: reported positions jump tens to hundreds of metres
+
+The same seed, route and rate always give the same bytes, so recorded streams can be
+replayed as repeatable load profiles.
+
+examples:
+  nmea_sim.py --route walk:600,dwell:300,drive:3600,loss:30 --rate 10 -o day.nmea
+  nmea_sim.py --route drive:86400 --rate 10 --pty --baud 115200 --realtime
+"""
+
+import argparse
+import datetime
+import math
+import os
+import random
+import sys
+import time
+
+EARTH_RADIUS_M = 6371000.0
+
+SPEEDS = {'walk': 1.4, 'drive': 13.0, 'dwell': 0.0, 'loss': 0.0, 'spike': 0.0}
+
+
+def checksum(body):
+    c = 0
+    for ch in body.encode('ascii'):
+        c ^= ch
+    return c
+
+
+def sentence(body):
+    return '$%s*%02X\r\n' % (body, checksum(body))
+
+
+def nmea_time(t):
+    return '%02d%02d%02d.%02d' % (t.hour, t.minute, t.second, t.microsecond // 10000)
+
+
+def nmea_date(t):
+    return '%02d%02d%02d' % (t.day, t.month, t.year % 100)
+
+
+def nmea_coord(value, degree_digits, positive, negative):
+    hemisphere = positive if value >= 0 else negative
+    value = abs(value)
+    degrees = int(value)
+    minutes = (value - degrees) * 60
+    # Round the minutes once so 59.999995 does not print as 60.00000
+    minutes = round(minutes, 5)
+    if minutes >= 60:
+        degrees, minutes = degrees + 1, 0.0
+    return '%0*d%08.5f' % (degree_digits, degrees, minutes), hemisphere
+
+
+def offset(lat, lon, north_m, east_m):
+    lat2 = lat + math.degrees(north_m / EARTH_RADIUS_M)
+    lon2 = lon + math.degrees(east_m / (EARTH_RADIUS_M * math.cos(math.radians(lat))))
+    return lat2, lon2
+
+
+class Satellites:
+    """A fixed constellation whose elevations and SNRs drift slowly."""
+
+    def __init__(self, rng):
+        self.rng = rng
+        prns = rng.sample(range(1, 33), 12)
+        self.sats = [[prn, rng.randint(5, 85), rng.randint(0, 359), rng.randint(20, 45)] for prn in prns]
+
+    def step(self):
+        for sat in self.sats:
+            sat[1] = min(89, max(1, sat[1] + self.rng.choice((-1, 0, 0, 1))))
+            sat[2] = (sat[2] + self.rng.choice((0, 0, 1))) % 360
+            sat[3] = min(50, max(15, sat[3] + self.rng.randint(-2, 2)))
+
+    def gsv(self, lost):
+        sats = self.sats[:0 if lost else len(self.sats)]
+        total = max(1, (len(sats) + 3) // 4)
+        out = []
+        for i in range(total):
+            fields = ['GPGSV', str(total), str(i + 1), '%02d' % len(sats)]
+            for prn, elevation, azimuth, snr in sats[i * 4:i * 4 + 4]:
+                fields += ['%02d' % prn, '%02d' % elevation, '%03d' % azimuth, '%02d' % snr]
+            out.append(sentence(','.join(fields)))
+        return out
+
+
+def parse_route(text):
+    route = []
+    for part in text.split(','):
+        kind, _, seconds = part.partition(':')
+        if kind not in SPEEDS or not seconds:
+            raise argparse.ArgumentTypeError('bad route segment %r' % part)
+        route.append((kind, float(seconds)))
+    return route
+
+
+def generate(args, write):
+    rng = random.Random(args.seed)
+    sats = Satellites(rng)
+    lat, lon = args.origin
+    t = args.start
+    step = 1.0 / args.rate
+    heading = rng.uniform(0, 360)
+    epoch = 0
+
+    for kind, seconds in args.route:
+        epochs = int(round(seconds * args.rate))
+        spike = (0.0, 0.0)
+        for i in range(epochs):
+            speed = SPEEDS[kind]
+            if kind == 'walk':
+                heading += 360.0 / epochs
+            elif kind == 'drive':
+                heading += rng.gauss(0, 2.0) * step
+                if rng.random() < 0.01 * step:
+                    heading += rng.choice((-90, 90))
+                speed *= 1 + 0.2 * math.sin(epoch * step / 30)
+            heading %= 360
+
+            distance = speed * step
+            lat, lon = offset(lat, lon, distance * math.cos(math.radians(heading)),
+                              distance * math.sin(math.radians(heading)))
+
+            # Reported position: truth plus jitter, or a multipath excursion
+            jitter = 0.8 if kind == 'dwell' else 0.3
+            north, east = rng.gauss(0, jitter), rng.gauss(0, jitter)
+            if kind == 'spike':
+                if i % max(1, int(args.rate * 3)) == 0:
+                    angle = rng.uniform(0, 2 * math.pi)
+                    size = rng.uniform(30, 250)
+                    spike = (size * math.cos(angle), size * math.sin(angle))
+                north, east = north + spike[0], east + spike[1]
+            rlat, rlon = offset(lat, lon, north, east)
+
+            lost = kind == 'loss'
+            hhmmss = nmea_time(t)
+            if lost:
+                write(epoch, sentence('GPGGA,%s,,,,,0,00,99.99,,,,,,' % hhmmss))
+                write(epoch, sentence('GPRMC,%s,V,,,,,,,%s,,,N' % (hhmmss, nmea_date(t))))
+                write(epoch, sentence('GPVTG,,,,,,,,,N'))
+            else:
+                la, ns = nmea_coord(rlat, 2, 'N', 'S')
+                lo, ew = nmea_coord(rlon, 3, 'E', 'W')
+                hdop = 4.5 if kind == 'spike' else 0.9 + rng.random() * 0.4
+                knots = speed * 1.943844
+                write(epoch, sentence('GPGGA,%s,%s,%s,%s,%s,1,%02d,%.2f,%.1f,M,47.0,M,,'
+                                      % (hhmmss, la, ns, lo, ew, len(sats.sats), hdop, args.altitude)))
+                write(epoch, sentence('GPRMC,%s,A,%s,%s,%s,%s,%.3f,%.2f,%s,,,A'
+                                      % (hhmmss, la, ns, lo, ew, knots, heading, nmea_date(t))))
+                write(epoch, sentence('GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,A' % (heading, knots, speed * 3.6)))
+
+            # Satellites are reported once a second, as the NEO-6 does
+            if epoch % max(1, int(args.rate)) == 0:
+                sats.step()
+                for line in sats.gsv(lost):
+                    write(epoch, line)
+
+            t += datetime.timedelta(seconds=step)
+            epoch += 1
+
+
+def open_pty(baud):
+    import termios
+    import tty
+
+    master, slave = os.openpty()
+    tty.setraw(slave)
+    speed = getattr(termios, 'B%d' % baud, None)
+    if speed is None:
+        sys.exit('unsupported baud rate %d' % baud)
+    attrs = termios.tcgetattr(slave)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(slave, termios.TCSANOW, attrs)
+    print('streaming on %s' % os.ttyname(slave), file=sys.stderr)
+    return os.fdopen(master, 'wb', buffering=0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--route', type=parse_route, default=parse_route('walk:600'))
+    parser.add_argument('--rate', type=float, default=1.0, help='epochs per second (default 1)')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--origin', type=lambda s: tuple(float(v) for v in s.split(',')),
+                        default=(51.5007, -0.1246), help='start position LAT,LON')
+    parser.add_argument('--start', type=lambda s: datetime.datetime.fromisoformat(s.rstrip('Z')),
+                        default=datetime.datetime(2024, 6, 1, 8, 0, 0), help='start time, UTC ISO 8601')
+    parser.add_argument('--altitude', type=float, default=35.0)
+    parser.add_argument('-o', '--output', default='-', help='file to write, - for stdout')
+    parser.add_argument('--pty', action='store_true', help='stream to a new pseudo-terminal instead')
+    parser.add_argument('--baud', type=int, default=9600, help='pty line rate, also paces output')
+    parser.add_argument('--realtime', action='store_true', help='pace epochs at the simulated rate')
+    args = parser.parse_args()
+
+    if args.pty:
+        out = open_pty(args.baud)
+    elif args.output == '-':
+        out = sys.stdout.buffer
+    else:
+        out = open(args.output, 'wb')
+
+    started = time.monotonic()
+    sent = 0
+    epoch_len = 1.0 / args.rate
+
+    def write(epoch, line):
+        nonlocal sent
+        data = line.encode('ascii')
+        out.write(data)
+        sent += len(data)
+        if args.pty:
+            # 8N1: ten bits on the wire per byte
+            due = sent * 10.0 / args.baud
+            if args.realtime and line.startswith('$GPGGA'):
+                due = max(due, (generate.epochs_written) * epoch_len)
+            delay = started + due - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        if line.startswith('$GPGGA'):
+            generate.epochs_written += 1
+
+    generate.epochs_written = 0
+    try:
+        generate(args, write)
+    except (BrokenPipeError, KeyboardInterrupt):
+        pass
+    finally:
+        if out is not sys.stdout.buffer:
+            out.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,30 @@
+#include "track.h"
+
+_Static_assert((TRACK_MAX_FIXES & (TRACK_MAX_FIXES - 1)) == 0, "TRACK_MAX_FIXES must be a power of two");
+
+static gps_fix_t fixes[TRACK_MAX_FIXES];
+static uint32_t fix_end;
+
+void track_init(void) {
+    fix_end = 0;
+}
+
+uint32_t track_append(const gps_fix_t *fix) {
+    fixes[fix_end % TRACK_MAX_FIXES] = *fix;
+    return fix_end++;
+}
+
+uint32_t track_begin(void) {
+    return fix_end > TRACK_MAX_FIXES ? fix_end - TRACK_MAX_FIXES : 0;
+}
+
+uint32_t track_end(void) {
+    return fix_end;
+}
+
+const gps_fix_t *track_get(uint32_t seq) {
+    if (seq < track_begin() || seq >= fix_end) {
+        return NULL;
+    }
+    return &fixes[seq % TRACK_MAX_FIXES];
+}
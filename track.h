@@ -0,0 +1,25 @@
+#ifndef _TRACK_H_
+#define _TRACK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gps_fix.h"
+
+// Fixes kept in RAM; once full the oldest are overwritten. Must be a power of two.
+#ifndef TRACK_MAX_FIXES
+#define TRACK_MAX_FIXES 16384
+#endif
+
+// Fixes are addressed by a sequence number that counts every fix since boot
+
+void track_init(void);
+uint32_t track_append(const gps_fix_t *fix);
+
+// Oldest sequence number still stored, and one past the newest
+uint32_t track_begin(void);
+uint32_t track_end(void);
+
+// NULL if the fix has been overwritten or does not exist yet
+const gps_fix_t *track_get(uint32_t seq);
+
+#endif
@@ -0,0 +1,292 @@
+#include "track_export.h"
+#include <string.h>
+#include "track.h"
+#include "numfmt.h"
+#include "utc.h"
+
+// Checkpoints needed to cover every stored fix plus the partial blocks at either end
+#define EXPORT_INDEX_SIZE (TRACK_MAX_FIXES / EXPORT_INDEX_STRIDE + 2)
+
+typedef struct {
+    const char *header;
+    const char *footer;
+    int (*encode)(char *out, const gps_fix_t *fix, bool first);
+    uint8_t fixed_len;      // record size if constant, else 0 and the index is used
+} export_encoder_t;
+
+static int encode_gpx(char *out, const gps_fix_t *fix, bool first) {
+    char *p = out;
+    memcpy(p, "<trkpt lat=\"", 12); p += 12;
+    p += fmt_e7(p, fix->lat_e7);
+    memcpy(p, "\" lon=\"", 7); p += 7;
+    p += fmt_e7(p, fix->lon_e7);
+    memcpy(p, "\"><time>", 8); p += 8;
+    p += utc_format(p, fix->time);
+    memcpy(p, "</time><sat>", 12); p += 12;
+    p += fmt_u32(p, fix->satellites);
+    memcpy(p, "</sat></trkpt>\n", 15); p += 15;
+    return p - out;
+}
+
+static int encode_geojson(char *out, const gps_fix_t *fix, bool first) {
+    char *p = out;
+    if (!first) {
+        *p++ = ',';
+    }
+    *p++ = '[';
+    p += fmt_e7(p, fix->lon_e7);
+    *p++ = ',';
+    p += fmt_e7(p, fix->lat_e7);
+    *p++ = ']';
+    return p - out;
+}
+
+static int encode_csv(char *out, const gps_fix_t *fix, bool first) {
+    char *p = out;
+    p += utc_format(p, fix->time);
+    *p++ = ',';
+    p += fmt_e7(p, fix->lat_e7);
+    *p++ = ',';
+    p += fmt_e7(p, fix->lon_e7);
+    *p++ = ',';
+    p += fmt_u32(p, fix->quality);
+    *p++ = ',';
+    p += fmt_u32(p, fix->satellites);
+    *p++ = '\n';
+    return p - out;
+}
+
+static inline void put_le32(char *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static int encode_raw(char *out, const gps_fix_t *fix, bool first) {
+    put_le32(out, fix->time);
+    put_le32(out + 4, fix->lat_e7);
+    put_le32(out + 8, fix->lon_e7);
+    out[12] = fix->quality;
+    out[13] = fix->satellites;
+    return EXPORT_RAW_RECORD;
+}
+
+static const export_encoder_t encoders[EXPORT_FORMAT_COUNT] = {
+    [EXPORT_GPX] = {
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<gpx version=\"1.1\" creator=\"gps-heat-mapper\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+        "<trk><name>gps-heat-mapper</name><trkseg>\n",
+        "</trkseg></trk>\n</gpx>\n",
+        encode_gpx,
+        0,
+    },
+    [EXPORT_GEOJSON] = {
+        "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"gps-heat-mapper\"},"
+        "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[",
+        "]}}]}\n",
+        encode_geojson,
+        0,
+    },
+    [EXPORT_CSV] = {
+        "time,lat,lon,quality,satellites\n",
+        "",
+        encode_csv,
+        0,
+    },
+    [EXPORT_RAW] = {
+        "",
+        "",
+        encode_raw,
+        EXPORT_RAW_RECORD,
+    },
+};
+
+// checkpoint[f][k % EXPORT_INDEX_SIZE] is the encoded size of fixes [0, k * STRIDE) in format f,
+// modulo 2^32; sizes are always taken as differences. Records are counted as encoded when not
+// first, i.e. with any separator.
+static uint32_t checkpoint[EXPORT_FORMAT_COUNT][EXPORT_INDEX_SIZE];
+static uint32_t encoded_total[EXPORT_FORMAT_COUNT];
+
+static int record_len(const export_encoder_t *enc, uint32_t seq) {
+    char scratch[EXPORT_RECORD_MAX];
+    if (enc->fixed_len) {
+        return enc->fixed_len;
+    }
+    return enc->encode(scratch, track_get(seq), false);
+}
+
+void export_index_append(uint32_t seq) {
+    for (int f = 0; f < EXPORT_FORMAT_COUNT; f++) {
+        if (encoders[f].fixed_len) {
+            continue;
+        }
+        encoded_total[f] += record_len(&encoders[f], seq);
+        if ((seq + 1) % EXPORT_INDEX_STRIDE == 0) {
+            checkpoint[f][(seq + 1) / EXPORT_INDEX_STRIDE % EXPORT_INDEX_SIZE] = encoded_total[f];
+        }
+    }
+}
+
+static uint32_t sum_len(const export_encoder_t *enc, uint32_t a, uint32_t b) {
+    uint32_t total = 0;
+    for (uint32_t seq = a; seq < b; seq++) {
+        total += record_len(enc, seq);
+    }
+    return total;
+}
+
+static inline uint32_t checkpoint_at(export_format_t f, uint32_t k) {
+    return checkpoint[f][k % EXPORT_INDEX_SIZE];
+}
+
+// Encoded size of the stored fixes [a, b), with separators
+static uint32_t bytes_between(export_format_t f, uint32_t a, uint32_t b) {
+    const export_encoder_t *enc = &encoders[f];
+    if (enc->fixed_len) {
+        return (b - a) * enc->fixed_len;
+    }
+    uint32_t ka = a / EXPORT_INDEX_STRIDE + 1;
+    uint32_t kb = b / EXPORT_INDEX_STRIDE;
+    if (ka > kb) {
+        return sum_len(enc, a, b);
+    }
+    return sum_len(enc, a, ka * EXPORT_INDEX_STRIDE) + (checkpoint_at(f, kb) - checkpoint_at(f, ka)) +
+        sum_len(enc, kb * EXPORT_INDEX_STRIDE, b);
+}
+
+// The first record of a GeoJSON export has no leading comma
+static inline uint32_t first_skip(const export_cursor_t *cursor) {
+    return cursor->format == EXPORT_GEOJSON && cursor->begin < cursor->end;
+}
+
+static inline uint32_t header_len(const export_cursor_t *cursor) {
+    return strlen(encoders[cursor->format].header);
+}
+
+static inline uint32_t records_len(const export_cursor_t *cursor) {
+    return bytes_between(cursor->format, cursor->begin, cursor->end) - first_skip(cursor);
+}
+
+bool export_begin_snapshot(export_cursor_t *cursor, export_format_t format, uint32_t begin, uint32_t end) {
+    if (begin < track_begin() || end > track_end() || begin > end) {
+        return false;
+    }
+    cursor->format = format;
+    cursor->begin = begin;
+    cursor->end = end;
+    cursor->next = begin;
+    cursor->rec_pos = header_len(cursor);
+    cursor->pos = 0;
+    cursor->limit = export_length(cursor);
+    return true;
+}
+
+void export_begin(export_cursor_t *cursor, export_format_t format) {
+    export_begin_snapshot(cursor, format, track_begin(), track_end());
+}
+
+uint32_t export_length(const export_cursor_t *cursor) {
+    return header_len(cursor) + records_len(cursor) + strlen(encoders[cursor->format].footer);
+}
+
+// Find the fix whose encoding contains records byte t (counted with separators)
+static uint32_t find_record(const export_cursor_t *cursor, uint32_t t, uint32_t *start) {
+    const export_encoder_t *enc = &encoders[cursor->format];
+    uint32_t seq = cursor->begin;
+    uint32_t at = 0;
+
+    if (enc->fixed_len) {
+        seq += t / enc->fixed_len;
+        *start = (seq - cursor->begin) * enc->fixed_len;
+        return seq;
+    }
+
+    // Binary search the checkpoints inside the export, then walk at most one block
+    uint32_t ka = cursor->begin / EXPORT_INDEX_STRIDE + 1;
+    uint32_t kb = cursor->end / EXPORT_INDEX_STRIDE;
+    if (ka <= kb) {
+        uint32_t lead = sum_len(enc, cursor->begin, ka * EXPORT_INDEX_STRIDE);
+        if (t >= lead) {
+            uint32_t lo = ka, hi = kb;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo + 1) / 2;
+                if (lead + (checkpoint_at(cursor->format, mid) - checkpoint_at(cursor->format, ka)) <= t) {
+                    lo = mid;
+                } else {
+                    hi = mid - 1;
+                }
+            }
+            seq = lo * EXPORT_INDEX_STRIDE;
+            at = lead + (checkpoint_at(cursor->format, lo) - checkpoint_at(cursor->format, ka));
+        }
+    }
+    while (seq < cursor->end) {
+        uint32_t len = record_len(enc, seq);
+        if (at + len > t) {
+            break;
+        }
+        at += len;
+        seq++;
+    }
+    *start = at;
+    return seq;
+}
+
+void export_seek(export_cursor_t *cursor, uint32_t first, uint32_t last) {
+    uint32_t hdr = header_len(cursor);
+    uint32_t skip = first_skip(cursor);
+
+    cursor->pos = first;
+    cursor->limit = last + 1;
+    cursor->next = cursor->begin;
+    cursor->rec_pos = hdr;
+    if (first > hdr && cursor->begin < cursor->end) {
+        uint32_t start;
+        cursor->next = find_record(cursor, first - hdr + skip, &start);
+        cursor->rec_pos = hdr + (cursor->next == cursor->begin ? 0 : start - skip);
+    }
+}
+
+// Copy the part of src overlapping the output window; src occupies bytes [at, at + n)
+static size_t emit(export_cursor_t *cursor, const char *src, uint32_t at, uint32_t n, char *buf, size_t len) {
+    if (cursor->pos < at || cursor->pos >= at + n) {
+        return 0;
+    }
+    uint32_t count = at + n - cursor->pos;
+    if (count > cursor->limit - cursor->pos) count = cursor->limit - cursor->pos;
+    if (count > len) count = len;
+    memcpy(buf, src + (cursor->pos - at), count);
+    cursor->pos += count;
+    return count;
+}
+
+size_t export_read(export_cursor_t *cursor, char *buf, size_t len) {
+    const export_encoder_t *enc = &encoders[cursor->format];
+    uint32_t hdr = header_len(cursor);
+    size_t used = 0;
+
+    used += emit(cursor, enc->header, 0, hdr, buf, len);
+
+    char scratch[EXPORT_RECORD_MAX];
+    while (cursor->next < cursor->end && cursor->pos < cursor->limit && used < len) {
+        const gps_fix_t *fix = track_get(cursor->next);
+        if (fix == NULL) {
+            // Overwritten while we were sending; the client has to start again
+            cursor->limit = cursor->pos;
+            return used;
+        }
+        uint32_t n = enc->encode(scratch, fix, cursor->next == cursor->begin);
+        used += emit(cursor, scratch, cursor->rec_pos, n, buf + used, len - used);
+        if (cursor->pos < cursor->rec_pos + n) {
+            return used; // buffer full mid-record
+        }
+        cursor->rec_pos += n;
+        cursor->next++;
+    }
+
+    if (cursor->next >= cursor->end) {
+        used += emit(cursor, enc->footer, cursor->rec_pos, strlen(enc->footer), buf + used, len - used);
+    }
+    return used;
+}
@@ -0,0 +1,60 @@
+#ifndef _TRACK_EXPORT_H_
+#define _TRACK_EXPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Streaming encoders for the stored track. Output is produced a buffer at a time from a
+// small cursor, so an export of any length needs constant memory.
+//
+// An export covers the fixes [begin, end) that were stored when it started, so it has a
+// fixed length and can be resumed at any byte offset. Offsets are mapped back to fixes
+// through a sparse index of cumulative encoded sizes kept every EXPORT_INDEX_STRIDE fixes.
+
+typedef enum {
+    EXPORT_GPX,
+    EXPORT_GEOJSON,
+    EXPORT_CSV,
+    EXPORT_RAW,             // packed little-endian records, EXPORT_RAW_RECORD bytes each
+    EXPORT_FORMAT_COUNT
+} export_format_t;
+
+// Longest single encoded fix
+#define EXPORT_RECORD_MAX 128
+
+// Raw record: u32 UTC time (seconds since 1970), i32 lat_e7, i32 lon_e7, u8 quality, u8 satellites
+#define EXPORT_RAW_RECORD 14
+
+#define EXPORT_INDEX_STRIDE 64
+
+typedef struct {
+    uint8_t format;
+    uint32_t begin;         // fixes covered by this export
+    uint32_t end;
+    uint32_t pos;           // next byte to produce
+    uint32_t limit;         // one past the last byte to produce
+    uint32_t next;          // fix being encoded, starting at byte rec_pos
+    uint32_t rec_pos;
+} export_cursor_t;
+
+// Record a newly stored fix in the offset index; call for every fix in order
+void export_index_append(uint32_t seq);
+
+// Start an export of everything stored now
+void export_begin(export_cursor_t *cursor, export_format_t format);
+
+// Start an export of a specific earlier snapshot; false if some of it has been overwritten
+bool export_begin_snapshot(export_cursor_t *cursor, export_format_t format, uint32_t begin, uint32_t end);
+
+// Total size in bytes of the export
+uint32_t export_length(const export_cursor_t *cursor);
+
+// Restrict output to the bytes [first, last]; both must be within the export
+void export_seek(export_cursor_t *cursor, uint32_t first, uint32_t last);
+
+// Fill buf with the next part of the export; returns 0 when it is complete, or early if
+// the fixes still to be sent were overwritten
+size_t export_read(export_cursor_t *cursor, char *buf, size_t len);
+
+#endif
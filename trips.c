@@ -0,0 +1,246 @@
+#include "trips.h"
+#include <string.h>
+#include <stdbool.h>
+#include "numfmt.h"
+
+// cos(degrees) in Q15 for 0..91 degrees, interpolated linearly
+static const int16_t cos_q15[92] = {
+    32767, 32762, 32747, 32722, 32687, 32642, 32587, 32523, 32448, 32364, 32269, 32165, 32051, 31927,
+    31794, 31650, 31498, 31335, 31163, 30982, 30791, 30591, 30381, 30162, 29934, 29697, 29451, 29196,
+    28932, 28659, 28377, 28087, 27788, 27481, 27165, 26841, 26509, 26169, 25821, 25465, 25101, 24730,
+    24351, 23964, 23571, 23170, 22762, 22347, 21925, 21497, 21062, 20621, 20173, 19720, 19260, 18794,
+    18323, 17846, 17364, 16876, 16384, 15886, 15383, 14876, 14364, 13848, 13328, 12803, 12275, 11743,
+    11207, 10668, 10126, 9580, 9032, 8481, 7927, 7371, 6813, 6252, 5690, 5126, 4560, 3993,
+    3425, 2856, 2286, 1715, 1144, 572, 0, -572,
+};
+
+// One 1e-7 degree of latitude is 1.11319 cm; in Q16
+#define CM_PER_E7_Q16 72955
+
+static trip_t trips[TRIPS_MAX];
+static uint32_t trip_end;
+
+// Segmentation state for the fix stream
+static struct {
+    bool have_prev;
+    bool open;              // trips[trip_end - 1] is still being extended
+    gps_fix_t prev;
+    gps_fix_t anchor;       // start of the current possible dwell
+    uint32_t anchor_seq;
+} seg;
+
+void trips_init(void) {
+    trip_end = 0;
+    memset(&seg, 0, sizeof(seg));
+}
+
+static int32_t cos_e7(int32_t lat_e7) {
+    uint32_t a = lat_e7 < 0 ? -(int64_t)lat_e7 : lat_e7;
+    uint32_t deg = a / 10000000;
+    uint32_t frac = a % 10000000;
+    if (deg > 90) {
+        return 0;
+    }
+    return cos_q15[deg] + (int32_t)((int64_t)(cos_q15[deg + 1] - cos_q15[deg]) * frac / 10000000);
+}
+
+static uint32_t isqrt64(uint64_t v) {
+    uint64_t r = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= r + bit) {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+    return r;
+}
+
+uint32_t trips_distance_cm(int32_t lat1_e7, int32_t lon1_e7, int32_t lat2_e7, int32_t lon2_e7) {
+    int64_t dlat = (int64_t)lat2_e7 - lat1_e7;
+    int64_t dlon = (int64_t)lon2_e7 - lon1_e7;
+    if (dlon > 1800000000) dlon -= 3600000000LL;
+    if (dlon < -1800000000) dlon += 3600000000LL;
+    // Scale longitude by the cosine of the mean latitude
+    dlon = dlon * cos_e7((int32_t)(((int64_t)lat1_e7 + lat2_e7) / 2)) >> 15;
+    int64_t dy = dlat * CM_PER_E7_Q16 >> 16;
+    int64_t dx = dlon * CM_PER_E7_Q16 >> 16;
+    return isqrt64((uint64_t)(dx * dx + dy * dy));
+}
+
+// Seconds from a to b; a receiver that steps its clock back is treated as no time passing
+static uint32_t elapsed_s(uint32_t a, uint32_t b) {
+    return b > a ? b - a : 0;
+}
+
+static void trip_start(const gps_fix_t *fix, uint32_t seq) {
+    trip_t *t = &trips[trip_end++ % TRIPS_MAX];
+    *t = (trip_t){
+        .start_time = fix->time,
+        .end_time = fix->time,
+        .first_seq = seq,
+        .last_seq = seq,
+        .min_lat_e7 = fix->lat_e7, .max_lat_e7 = fix->lat_e7,
+        .min_lon_e7 = fix->lon_e7, .max_lon_e7 = fix->lon_e7,
+    };
+    seg.open = true;
+}
+
+static void trip_extend(trip_t *t, const gps_fix_t *fix, uint32_t seq, uint32_t dist_cm, uint32_t dt) {
+    t->end_time = fix->time;
+    t->last_seq = seq;
+    if (fix->lat_e7 < t->min_lat_e7) t->min_lat_e7 = fix->lat_e7;
+    if (fix->lat_e7 > t->max_lat_e7) t->max_lat_e7 = fix->lat_e7;
+    if (fix->lon_e7 < t->min_lon_e7) t->min_lon_e7 = fix->lon_e7;
+    if (fix->lon_e7 > t->max_lon_e7) t->max_lon_e7 = fix->lon_e7;
+    if (dt == 0) {
+        return;
+    }
+    uint32_t speed = dist_cm / dt;
+    if (speed >= TRIP_MOVING_CM_S) {
+        t->moving_s += dt;
+        t->distance_cm += dist_cm;
+        if (speed > t->max_speed_cm_s) {
+            t->max_speed_cm_s = speed;
+        }
+    }
+}
+
+void trips_add(const gps_fix_t *fix, uint32_t seq) {
+    if (!seg.have_prev) {
+        seg.have_prev = true;
+        seg.prev = *fix;
+        seg.anchor = *fix;
+        seg.anchor_seq = seq;
+        trip_start(fix, seq);
+        return;
+    }
+
+    uint32_t dt = elapsed_s(seg.prev.time, fix->time);
+    uint32_t dist_cm = trips_distance_cm(seg.prev.lat_e7, seg.prev.lon_e7, fix->lat_e7, fix->lon_e7);
+    bool left_anchor = trips_distance_cm(seg.anchor.lat_e7, seg.anchor.lon_e7, fix->lat_e7, fix->lon_e7) >
+        TRIP_DWELL_RADIUS_M * 100;
+    seg.prev = *fix;
+
+    if (dt > TRIP_GAP_S) {
+        // Lost reception for a while: whatever happened in between is not this trip
+        seg.anchor = *fix;
+        seg.anchor_seq = seq;
+        trip_start(fix, seq);
+        return;
+    }
+
+    if (left_anchor) {
+        seg.anchor = *fix;
+        seg.anchor_seq = seq;
+        if (!seg.open) {
+            trip_start(fix, seq);
+            return;
+        }
+    } else if (seg.open && elapsed_s(seg.anchor.time, fix->time) >= TRIP_DWELL_S) {
+        // Stopped: the trip ended when we arrived at the anchor
+        trip_t *t = &trips[(trip_end - 1) % TRIPS_MAX];
+        t->end_time = seg.anchor.time;
+        t->last_seq = seg.anchor_seq;
+        seg.open = false;
+    }
+
+    if (seg.open) {
+        trip_extend(&trips[(trip_end - 1) % TRIPS_MAX], fix, seq, dist_cm, dt);
+    }
+}
+
+uint32_t trips_begin(void) {
+    return trip_end > TRIPS_MAX ? trip_end - TRIPS_MAX : 0;
+}
+
+uint32_t trips_end(void) {
+    return trip_end;
+}
+
+const trip_t *trips_get(uint32_t n) {
+    if (n < trips_begin() || n >= trip_end) {
+        return NULL;
+    }
+    return &trips[n % TRIPS_MAX];
+}
+
+// Longest single trip object
+#define TRIP_JSON_MAX 200
+
+static int trip_json(char *out, uint32_t n, const trip_t *t) {
+    char *p = out;
+    memcpy(p, "{\"id\":", 6); p += 6;
+    p += fmt_u32(p, n);
+    memcpy(p, ",\"start\":", 9); p += 9;
+    p += fmt_u32(p, t->start_time);
+    memcpy(p, ",\"end\":", 7); p += 7;
+    p += fmt_u32(p, t->end_time);
+    memcpy(p, ",\"dist_m\":", 10); p += 10;
+    p += fmt_u32(p, t->distance_cm / 100);
+    memcpy(p, ",\"moving_s\":", 12); p += 12;
+    p += fmt_u32(p, t->moving_s);
+    memcpy(p, ",\"max_cm_s\":", 12); p += 12;
+    p += fmt_u32(p, t->max_speed_cm_s);
+    memcpy(p, ",\"bbox\":[", 9); p += 9;
+    p += fmt_e7(p, t->min_lat_e7);
+    *p++ = ',';
+    p += fmt_e7(p, t->min_lon_e7);
+    *p++ = ',';
+    p += fmt_e7(p, t->max_lat_e7);
+    *p++ = ',';
+    p += fmt_e7(p, t->max_lon_e7);
+    memcpy(p, "]}", 2); p += 2;
+    return p - out;
+}
+
+// *cursor is 0 before the opening bracket, then 1 + the next trip number with
+// JSON_SEPARATE set once a trip has been written, then JSON_DONE
+#define JSON_SEPARATE 0x80000000u
+#define JSON_DONE UINT32_MAX
+
+size_t trips_read_json(uint32_t *cursor, char *buf, size_t len) {
+    static const char open[] = "{\"trips\":[";
+    static const char close[] = "]}\n";
+    size_t used = 0;
+
+    if (*cursor == 0) {
+        if (len < sizeof(open) - 1) {
+            return 0;
+        }
+        memcpy(buf, open, sizeof(open) - 1);
+        used = sizeof(open) - 1;
+        *cursor = 1 + trips_begin();
+    }
+    while (*cursor != JSON_DONE) {
+        uint32_t separate = *cursor & JSON_SEPARATE;
+        uint32_t n = (*cursor & ~JSON_SEPARATE) - 1;
+        if (n < trips_begin()) {
+            n = trips_begin(); // overwritten while we were sending
+        }
+        if (n >= trip_end) {
+            if (len - used < sizeof(close) - 1) {
+                break;
+            }
+            memcpy(buf + used, close, sizeof(close) - 1);
+            used += sizeof(close) - 1;
+            *cursor = JSON_DONE;
+            break;
+        }
+        if (len - used < TRIP_JSON_MAX + 1) {
+            break;
+        }
+        if (separate) {
+            buf[used++] = ',';
+        }
+        used += trip_json(buf + used, n, &trips[n % TRIPS_MAX]);
+        *cursor = (n + 2) | JSON_SEPARATE;
+    }
+    return used;
+}
@@ -0,0 +1,62 @@
+#ifndef _TRIPS_H_
+#define _TRIPS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gps_fix.h"
+
+// Trips are split out of the fix stream as it arrives: a gap in reception longer than
+// TRIP_GAP_S, or staying within TRIP_DWELL_RADIUS_M for TRIP_DWELL_S, ends the current trip.
+// Only the summaries are kept, so reporting costs O(trips) whatever the number of fixes.
+
+#ifndef TRIPS_MAX
+#define TRIPS_MAX 64
+#endif
+
+#ifndef TRIP_GAP_S
+#define TRIP_GAP_S 300
+#endif
+
+#ifndef TRIP_DWELL_S
+#define TRIP_DWELL_S 180
+#endif
+
+#ifndef TRIP_DWELL_RADIUS_M
+#define TRIP_DWELL_RADIUS_M 25
+#endif
+
+// Below this speed a segment counts as GPS jitter, not movement
+#ifndef TRIP_MOVING_CM_S
+#define TRIP_MOVING_CM_S 50
+#endif
+
+typedef struct {
+    uint32_t start_time;    // as gps_fix_t.time
+    uint32_t end_time;
+    uint32_t first_seq;     // track sequence numbers, the fixes may since have been overwritten
+    uint32_t last_seq;
+    uint32_t distance_cm;
+    uint32_t moving_s;
+    uint32_t max_speed_cm_s;
+    int32_t min_lat_e7, min_lon_e7;
+    int32_t max_lat_e7, max_lon_e7;
+} trip_t;
+
+void trips_init(void);
+
+// Feed a stored fix and its track sequence number
+void trips_add(const gps_fix_t *fix, uint32_t seq);
+
+// Trips are numbered since boot; [trips_begin(), trips_end()) are still held, the last
+// one possibly still open
+uint32_t trips_begin(void);
+uint32_t trips_end(void);
+const trip_t *trips_get(uint32_t n);
+
+// Distance in centimetres between two positions, equirectangular in fixed point
+uint32_t trips_distance_cm(int32_t lat1_e7, int32_t lon1_e7, int32_t lat2_e7, int32_t lon2_e7);
+
+// Write the summaries as JSON, resuming at *cursor (start at 0); returns 0 when done
+size_t trips_read_json(uint32_t *cursor, char *buf, size_t len);
+
+#endif
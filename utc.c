@@ -0,0 +1,70 @@
+#include "utc.h"
+#include <string.h>
+#include "numfmt.h"
+
+// Each direction has its own cache: ingest converts to timestamps, exports format them
+static struct {
+    int year, month, day;
+    uint32_t days;
+} to_days = { .year = -1 };
+
+static struct {
+    uint32_t days;
+    char date[11];          // "YYYY-MM-DDT"
+} from_days = { .days = UINT32_MAX };
+
+uint32_t utc_from_nmea(const struct minmea_date *date, const struct minmea_time *time) {
+    uint32_t days = 0;
+    if (date->year >= 0) {
+        if (date->year != to_days.year || date->month != to_days.month || date->day != to_days.day) {
+            int year = date->year < 80 ? 2000 + date->year : date->year < 1900 ? 1900 + date->year : date->year;
+            to_days.year = date->year;
+            to_days.month = date->month;
+            to_days.day = date->day;
+            to_days.days = minmea_days_from_civil(year, date->month, date->day);
+        }
+        days = to_days.days;
+    }
+    return days * 86400 + time->hours * 3600 + time->minutes * 60 + time->seconds;
+}
+
+// Inverse of minmea_days_from_civil() for days since 1970
+static void civil_from_days(uint32_t days, uint32_t *year, uint32_t *month, uint32_t *day) {
+    uint32_t z = days + 719468;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+int utc_format(char *out, uint32_t t) {
+    uint32_t days = t / 86400;
+    uint32_t s = t % 86400;
+    if (days != from_days.days) {
+        uint32_t year, month, day;
+        civil_from_days(days, &year, &month, &day);
+        char *p = from_days.date;
+        p += fmt_2d(p, year / 100);
+        p += fmt_2d(p, year);
+        *p++ = '-';
+        p += fmt_2d(p, month);
+        *p++ = '-';
+        p += fmt_2d(p, day);
+        *p = 'T';
+        from_days.days = days;
+    }
+    char *p = out;
+    memcpy(p, from_days.date, sizeof(from_days.date));
+    p += sizeof(from_days.date);
+    p += fmt_2d(p, s / 3600);
+    *p++ = ':';
+    p += fmt_2d(p, s / 60 % 60);
+    *p++ = ':';
+    p += fmt_2d(p, s % 60);
+    *p++ = 'Z';
+    return p - out;
+}
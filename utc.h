@@ -0,0 +1,19 @@
+#ifndef _UTC_H_
+#define _UTC_H_
+
+#include <stdint.h>
+#include "minmea.h"
+
+// UTC timestamps as seconds since 1970-01-01T00:00:00Z, good until 2106. Conversions are
+// integer only and remember the last day they handled, since consecutive fixes are almost
+// always on the same day.
+
+// An empty date (year -1) gives the time of day on 1970-01-01. Two digit years are
+// 1980-2079, as in minmea_getdatetime().
+uint32_t utc_from_nmea(const struct minmea_date *date, const struct minmea_time *time);
+
+// "2024-06-01T08:00:00Z", always UTC_FORMAT_LEN characters and not NUL terminated
+#define UTC_FORMAT_LEN 20
+int utc_format(char *out, uint32_t t);
+
+#endif
@@ -0,0 +1,189 @@
+'use strict';
+
+// Fixes arrive as degrees * 1e7
+const E7 = 1e7;
+
+const canvas = document.getElementById('map');
+const ctx = canvas.getContext('2d');
+const statusEl = document.getElementById('status');
+const fixEl = document.getElementById('fix');
+
+const track = [];
+let bounds = null;
+
+// Heatmap cells keyed by loc_id, seeded from /api/grid.bin and kept current by 'cell' events
+const grid = { originLat: 0, originLon: 0, cell: 0, generation: -1, cells: new Map() };
+const GRID_HEADER_SIZE = 24;
+const INDEX_BIAS = 0x8000;
+
+// 256-entry colour ramp: transparent blue through yellow to white
+const palette = new Uint8ClampedArray(256 * 4);
+for (let i = 0; i < 256; i++) {
+  const t = i / 255;
+  palette[i * 4] = Math.min(255, 512 * t);
+  palette[i * 4 + 1] = Math.min(255, Math.max(0, 512 * t - 128));
+  palette[i * 4 + 2] = Math.max(0, 255 - 512 * Math.abs(t - 0.25)) + Math.max(0, 1020 * t - 765);
+  palette[i * 4 + 3] = Math.min(255, 768 * t);
+}
+
+const layer = document.createElement('canvas');
+const layerCtx = layer.getContext('2d');
+let drawPending = false;
+
+function resize() {
+  canvas.width = canvas.clientWidth * devicePixelRatio;
+  canvas.height = canvas.clientHeight * devicePixelRatio;
+  draw();
+}
+
+function extend(lat, lon) {
+  if (!bounds) {
+    bounds = { minLat: lat, maxLat: lat, minLon: lon, maxLon: lon };
+  } else {
+    bounds.minLat = Math.min(bounds.minLat, lat);
+    bounds.maxLat = Math.max(bounds.maxLat, lat);
+    bounds.minLon = Math.min(bounds.minLon, lon);
+    bounds.maxLon = Math.max(bounds.maxLon, lon);
+  }
+}
+
+// Equirectangular projection fitted to the bounds, keeping the aspect ratio
+function projector() {
+  const midLat = (bounds.minLat + bounds.maxLat) / 2 / E7;
+  const kx = Math.cos(midLat * Math.PI / 180);
+  const w = Math.max((bounds.maxLon - bounds.minLon) * kx, 1);
+  const h = Math.max(bounds.maxLat - bounds.minLat, 1);
+  const scale = 0.9 * Math.min(canvas.width / w, canvas.height / h);
+  const ox = (canvas.width - w * scale) / 2;
+  const oy = (canvas.height + h * scale) / 2;
+  return (lat, lon) => [ox + (lon - bounds.minLon) * kx * scale, oy - (lat - bounds.minLat) * scale];
+}
+
+function cellCorner(key) {
+  const row = (key >>> 16) - INDEX_BIAS;
+  const col = (key & 0xffff) - INDEX_BIAS;
+  return [grid.originLat + row * grid.cell, grid.originLon + col * grid.cell];
+}
+
+function setCell(key, count) {
+  if (!grid.cells.has(key)) {
+    const [lat, lon] = cellCorner(key);
+    extend(lat, lon);
+    extend(lat + grid.cell, lon + grid.cell);
+  }
+  grid.cells.set(key, count);
+}
+
+async function loadGrid() {
+  const response = await fetch('/api/grid.bin', { cache: 'no-store' });
+  const buf = await response.arrayBuffer();
+  const view = new DataView(buf);
+  if (buf.byteLength < GRID_HEADER_SIZE || String.fromCharCode(...new Uint8Array(buf, 0, 4)) !== 'HMAP') {
+    return;
+  }
+  const headerSize = view.getUint16(6, true);
+  grid.originLat = view.getInt32(8, true);
+  grid.originLon = view.getInt32(12, true);
+  grid.cell = view.getUint32(16, true);
+  grid.generation = view.getUint32(20, true);
+  grid.cells.clear();
+  // Each cell is { u32 loc_id, u16 count, u16 reserved }
+  const cells = new Uint32Array(buf, headerSize, Math.floor((buf.byteLength - headerSize) / 8) * 2);
+  for (let i = 0; i < cells.length; i += 2) {
+    setCell(cells[i], cells[i + 1] & 0xffff);
+  }
+  scheduleDraw();
+}
+
+// Splat the cells as intensities, blur them, then colour them through the palette
+function drawHeatmap(project) {
+  if (grid.cells.size === 0) {
+    return;
+  }
+  layer.width = canvas.width;
+  layer.height = canvas.height;
+  let max = 1;
+  grid.cells.forEach((count) => { max = Math.max(max, count); });
+  const [x0, y0] = project(grid.originLat, grid.originLon);
+  const [x1, y1] = project(grid.originLat + grid.cell, grid.originLon + grid.cell);
+  const size = Math.max(Math.abs(x1 - x0), 2);
+  layerCtx.filter = `blur(${Math.ceil(size)}px)`;
+  grid.cells.forEach((count, key) => {
+    const [lat, lon] = cellCorner(key);
+    const [x, y] = project(lat + grid.cell, lon);
+    layerCtx.globalAlpha = Math.log1p(count) / Math.log1p(max);
+    layerCtx.fillRect(x, y, size, size);
+  });
+  const image = layerCtx.getImageData(0, 0, layer.width, layer.height);
+  const px = image.data;
+  for (let i = 0; i < px.length; i += 4) {
+    const p = px[i + 3] * 4;
+    px[i] = palette[p];
+    px[i + 1] = palette[p + 1];
+    px[i + 2] = palette[p + 2];
+    px[i + 3] = palette[p + 3];
+  }
+  layerCtx.putImageData(image, 0, 0);
+  ctx.drawImage(layer, 0, 0);
+}
+
+function scheduleDraw() {
+  if (!drawPending) {
+    drawPending = true;
+    requestAnimationFrame(() => {
+      drawPending = false;
+      draw();
+    });
+  }
+}
+
+function draw() {
+  ctx.fillStyle = '#111';
+  ctx.fillRect(0, 0, canvas.width, canvas.height);
+  if (!bounds) {
+    return;
+  }
+  const project = projector();
+  drawHeatmap(project);
+  ctx.strokeStyle = '#4af';
+  ctx.lineWidth = 2 * devicePixelRatio;
+  ctx.beginPath();
+  track.forEach(([lat, lon], i) => {
+    const [x, y] = project(lat, lon);
+    if (i === 0) {
+      ctx.moveTo(x, y);
+    } else {
+      ctx.lineTo(x, y);
+    }
+  });
+  ctx.stroke();
+}
+
+function formatTime(t) {
+  const pad = (n) => String(n).padStart(2, '0');
+  return `${pad(Math.floor(t / 3600) % 24)}:${pad(Math.floor(t / 60) % 60)}:${pad(t % 60)}`;
+}
+
+const events = new EventSource('/events');
+events.onopen = () => {
+  statusEl.textContent = 'live';
+  loadGrid();
+};
+events.onerror = () => { statusEl.textContent = 'reconnecting…'; };
+events.addEventListener('fix', (e) => {
+  const fix = JSON.parse(e.data);
+  track.push([fix.lat, fix.lon]);
+  extend(fix.lat, fix.lon);
+  fixEl.textContent = `${formatTime(fix.t)}  ${(fix.lat / E7).toFixed(6)}, ${(fix.lon / E7).toFixed(6)}  (${fix.s} sats)`;
+  scheduleDraw();
+});
+events.addEventListener('cell', (e) => {
+  const cell = JSON.parse(e.data);
+  if (grid.cell) {
+    setCell(cell.k, cell.c);
+    scheduleDraw();
+  }
+});
+
+window.addEventListener('resize', resize);
+resize();
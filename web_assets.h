@@ -0,0 +1,18 @@
+#ifndef _WEB_ASSETS_H_
+#define _WEB_ASSETS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Static web files, gzipped at build time into web_assets.c (see tools/embed_web_assets.py).
+// response is a complete HTTP response, headers included, stored in flash.
+typedef struct {
+    const char *path;
+    const uint8_t *response;
+    uint32_t length;
+} web_asset_t;
+
+extern const web_asset_t web_assets[];
+extern const size_t web_assets_count;
+
+#endif